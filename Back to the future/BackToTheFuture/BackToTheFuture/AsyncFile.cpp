@@ -0,0 +1,565 @@
+#include "AsyncFile.hpp"
+#include "IoRing.hpp"
+#include "Logger.hpp"
+
+#include <fstream>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#if defined(BTTF_WITH_URING)
+	// smaller files gain more from the page cache than from bypassing it
+	constexpr uint64_t DIRECT_IO_LIMIT = 64 << 20;
+	constexpr uint64_t DIRECT_IO_ALIGNMENT = 4096;
+	constexpr std::size_t NO_BLOCK = SIZE_MAX;
+
+	/**
+	* Name: RingReadBuffer
+	* Description: Input buffer over the read blocks of the thread ring. All blocks are kept in flight on the next
+	*              file offsets, a consumed block is queued again right away. Seeks wait for the queued reads and
+	*              start over, direct reads start at an aligned offset and skip the head.
+	*/
+	class RingReadBuffer : public std::streambuf
+	{
+	public:
+		RingReadBuffer(IoRing& ring, int fd, uint64_t size, bool direct) :
+			m_ring(ring), m_fd(fd), m_size(size), m_direct(direct)
+		{
+			for (std::size_t i = 0; i < IoRing::READ_BLOCKS; i++)
+			{
+				m_requests[i].block = static_cast<unsigned>(i);
+				m_requests[i].data = m_ring.block(i);
+			}
+			m_ok = start(0);
+		}
+
+		~RingReadBuffer() override
+		{
+			drain();
+			m_ring.releaseReader();
+			::close(m_fd);
+		}
+
+	protected:
+		int_type underflow() override
+		{
+			if (gptr() < egptr())
+			{
+				return traits_type::to_int_type(*gptr());
+			}
+
+			// the block just consumed goes back in flight on the next offset
+			if (NO_BLOCK != m_current)
+			{
+				std::size_t done = m_current;
+				m_current = NO_BLOCK;
+				m_queued[done] = false;
+				if (!m_end && m_next < m_size && !(queueNext(done) && m_ring.submit()))
+				{
+					m_ok = false;
+				}
+			}
+
+			if (!m_ok)
+			{
+				throw std::ios_base::failure("read failed");
+			}
+			if (m_end)
+			{
+				return traits_type::eof();
+			}
+
+			// nothing ahead below the size seen at open, one more read tells whether the file grew
+			if (!m_queued[m_head] && !(queueNext(m_head) && m_ring.submit()))
+			{
+				m_ok = false;
+				throw std::ios_base::failure("read failed");
+			}
+
+			IoRing::Request& request = m_requests[m_head];
+			if (!m_ring.wait(request) || 0 > request.result)
+			{
+				LOG(Error, "Read failed at offset %llu.", static_cast<unsigned long long>(request.offset));
+				m_ok = false;
+				throw std::ios_base::failure("read failed");
+			}
+
+			std::size_t length = static_cast<std::size_t>(request.result);
+			m_current = m_head;
+			m_head = (m_head + 1) % IoRing::READ_BLOCKS;
+
+			// a short read is the end of the file
+			m_end = length < request.length;
+			if (length <= m_skip)
+			{
+				m_end = true;
+				return traits_type::eof();
+			}
+
+			m_areaOffset = request.offset;
+			setg(request.data, request.data + m_skip, request.data + length);
+			m_skip = 0;
+			return traits_type::to_int_type(*gptr());
+		}
+
+		pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+		{
+			uint64_t current = m_areaOffset + static_cast<uint64_t>(gptr() - eback());
+			if (0 == (which & std::ios_base::in))
+			{
+				return pos_type(off_type(-1));
+			}
+			if (std::ios_base::cur == dir && 0 == off)
+			{
+				return pos_type(static_cast<off_type>(current));
+			}
+
+			off_type base = std::ios_base::beg == dir ? 0 : std::ios_base::cur == dir ? static_cast<off_type>(current) : static_cast<off_type>(m_size);
+			return seekpos(pos_type(base + off), which);
+		}
+
+		pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+		{
+			if (0 == (which & std::ios_base::in) || 0 > off_type(pos) || !start(static_cast<uint64_t>(off_type(pos))))
+			{
+				return pos_type(off_type(-1));
+			}
+			return pos;
+		}
+
+	private:
+		bool start(uint64_t position)
+		{
+			drain();
+			setg(nullptr, nullptr, nullptr);
+			m_current = NO_BLOCK;
+			m_head = 0;
+			m_end = false;
+
+			m_next = m_direct ? position & ~(DIRECT_IO_ALIGNMENT - 1) : position;
+			m_skip = static_cast<std::size_t>(position - m_next);
+			m_areaOffset = position;
+
+			for (std::size_t i = 0; i < IoRing::READ_BLOCKS && (0 == i || m_next < m_size); i++)
+			{
+				if (!queueNext(i))
+				{
+					return false;
+				}
+			}
+			return m_ring.submit();
+		}
+
+		bool queueNext(std::size_t index)
+		{
+			IoRing::Request& request = m_requests[index];
+			request.offset = m_next;
+			request.length = static_cast<uint32_t>(IoRing::BLOCK_BYTES);
+			m_next += IoRing::BLOCK_BYTES;
+			m_queued[index] = m_ring.queueRead(m_fd, request);
+			return m_queued[index];
+		}
+
+		void drain()
+		{
+			for (std::size_t i = 0; i < IoRing::READ_BLOCKS; i++)
+			{
+				if (m_queued[i] && !m_ring.wait(m_requests[i]))
+				{
+					m_ok = false;
+				}
+				m_queued[i] = false;
+			}
+		}
+
+		IoRing& m_ring;
+		const int m_fd;
+		const uint64_t m_size;
+		const bool m_direct;
+		IoRing::Request m_requests[IoRing::READ_BLOCKS];
+		bool m_queued[IoRing::READ_BLOCKS] = {};
+		// block holding the next data in file order, and the block in the get area
+		std::size_t m_head = 0;
+		std::size_t m_current = NO_BLOCK;
+		uint64_t m_next = 0;
+		uint64_t m_areaOffset = 0;
+		std::size_t m_skip = 0;
+		bool m_end = false;
+		bool m_ok = true;
+	};
+
+	/**
+	* Name: RingWriteBuffer
+	* Description: Output buffer over the write blocks of the thread ring. A full block is queued at its file offset
+	*              and the next free block takes the data, sync waits for all blocks and completes short writes.
+	*/
+	class RingWriteBuffer : public std::streambuf
+	{
+	public:
+		RingWriteBuffer(IoRing& ring, int fd) :
+			m_ring(ring), m_fd(fd)
+		{
+			for (std::size_t i = 0; i < IoRing::WRITE_BLOCKS; i++)
+			{
+				m_requests[i].block = static_cast<unsigned>(IoRing::READ_BLOCKS + i);
+				m_requests[i].data = m_ring.block(IoRing::READ_BLOCKS + i);
+			}
+			setp(m_requests[0].data, m_requests[0].data + IoRing::BLOCK_BYTES);
+		}
+
+		~RingWriteBuffer() override
+		{
+			close();
+		}
+
+		bool close()
+		{
+			if (0 > m_fd)
+			{
+				return !m_failed;
+			}
+
+			sync();
+			if (0 != ::close(m_fd))
+			{
+				m_failed = true;
+			}
+			m_fd = -1;
+			m_ring.releaseWriter();
+			return !m_failed;
+		}
+
+	protected:
+		int_type overflow(int_type ch) override
+		{
+			if (!queueCurrent())
+			{
+				return traits_type::eof();
+			}
+			if (!traits_type::eq_int_type(ch, traits_type::eof()))
+			{
+				*pptr() = traits_type::to_char_type(ch);
+				pbump(1);
+			}
+			return traits_type::not_eof(ch);
+		}
+
+		int sync() override
+		{
+			queueCurrent();
+			for (std::size_t i = 0; i < IoRing::WRITE_BLOCKS; i++)
+			{
+				finish(i);
+			}
+			return m_failed ? -1 : 0;
+		}
+
+		pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override
+		{
+			uint64_t current = m_position + static_cast<uint64_t>(pptr() - pbase());
+			if (0 == (which & std::ios_base::out))
+			{
+				return pos_type(off_type(-1));
+			}
+			if (std::ios_base::cur == dir && 0 == off)
+			{
+				return pos_type(static_cast<off_type>(current));
+			}
+
+			off_type base = static_cast<off_type>(current);
+			if (std::ios_base::beg == dir)
+			{
+				base = 0;
+			}
+			else if (std::ios_base::end == dir)
+			{
+				struct stat st{};
+				sync();
+				base = 0 == fstat(m_fd, &st) ? static_cast<off_type>(st.st_size) : 0;
+			}
+			return seekpos(pos_type(base + off), which);
+		}
+
+		// queued writes may overlap the new position, so they complete first
+		pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+		{
+			if (0 == (which & std::ios_base::out) || 0 > off_type(pos) || 0 != sync())
+			{
+				return pos_type(off_type(-1));
+			}
+			m_position = static_cast<uint64_t>(off_type(pos));
+			return pos;
+		}
+
+	private:
+		bool queueCurrent()
+		{
+			std::size_t length = static_cast<std::size_t>(pptr() - pbase());
+			if (m_failed || 0 == length)
+			{
+				return !m_failed;
+			}
+
+			IoRing::Request& request = m_requests[m_current];
+			request.offset = m_position;
+			request.length = static_cast<uint32_t>(length);
+			m_queued[m_current] = m_ring.queueWrite(m_fd, request) && m_ring.submit();
+			m_failed = !m_queued[m_current];
+			m_position += length;
+
+			m_current = (m_current + 1) % IoRing::WRITE_BLOCKS;
+			finish(m_current);
+			setp(m_requests[m_current].data, m_requests[m_current].data + IoRing::BLOCK_BYTES);
+			return !m_failed;
+		}
+
+		void finish(std::size_t index)
+		{
+			if (!m_queued[index])
+			{
+				return;
+			}
+			m_queued[index] = false;
+
+			IoRing::Request& request = m_requests[index];
+			if (!m_ring.wait(request) || 0 > request.result)
+			{
+				LOG(Error, "Write failed at offset %llu.", static_cast<unsigned long long>(request.offset));
+				m_failed = true;
+				return;
+			}
+
+			// rare short write, the rest goes out directly
+			for (uint32_t done = static_cast<uint32_t>(request.result); done < request.length; )
+			{
+				ssize_t written = pwrite(m_fd, request.data + done, request.length - done, static_cast<off_t>(request.offset + done));
+				if (0 >= written)
+				{
+					m_failed = true;
+					return;
+				}
+				done += static_cast<uint32_t>(written);
+			}
+		}
+
+		IoRing& m_ring;
+		int m_fd;
+		IoRing::Request m_requests[IoRing::WRITE_BLOCKS];
+		bool m_queued[IoRing::WRITE_BLOCKS] = {};
+		// block in the put area and file offset of its first byte
+		std::size_t m_current = 0;
+		uint64_t m_position = 0;
+		bool m_failed = false;
+	};
+
+	/**
+	* Name: openRingInput
+	* Description: Open a regular file on the ring of the thread, nullptr when it has to go through std::filebuf
+	*/
+	std::unique_ptr<std::streambuf> openRingInput(const fs::path& path, bool direct)
+	{
+		IoRing* ring = IoRing::forThread();
+		if (!ring)
+		{
+			return nullptr;
+		}
+
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		struct stat st{};
+		if (0 > fd || 0 != fstat(fd, &st) || !S_ISREG(st.st_mode) || !ring->acquireReader())
+		{
+			if (0 <= fd)
+			{
+				::close(fd);
+			}
+			return nullptr;
+		}
+
+		uint64_t size = static_cast<uint64_t>(st.st_size);
+		direct = direct && size >= DIRECT_IO_LIMIT;
+		if (direct)
+		{
+			// file systems without O_DIRECT keep the cached descriptor
+			int directFd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+			direct = 0 <= directFd;
+			if (direct)
+			{
+				::close(fd);
+				fd = directFd;
+			}
+		}
+		if (!direct)
+		{
+			posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		}
+
+		return std::make_unique<RingReadBuffer>(*ring, fd, size, direct);
+	}
+
+	/**
+	* Name: openRingOutput
+	* Description: Create or open a file on the ring of the thread, nullptr when it has to go through std::filebuf
+	*/
+	std::unique_ptr<std::streambuf> openRingOutput(const fs::path& path, bool update)
+	{
+		IoRing* ring = IoRing::forThread();
+		if (!ring || !ring->acquireWriter())
+		{
+			return nullptr;
+		}
+
+		int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (update ? 0 : O_TRUNC), 0666);
+		struct stat st{};
+		if (0 > fd || 0 != fstat(fd, &st) || !S_ISREG(st.st_mode))
+		{
+			if (0 <= fd)
+			{
+				::close(fd);
+			}
+			ring->releaseWriter();
+			return nullptr;
+		}
+
+		return std::make_unique<RingWriteBuffer>(*ring, fd);
+	}
+#endif // BTTF_WITH_URING
+} // anonymous namespace
+
+/**
+* Name: InputFile::InputFile
+* Description: Constructor, opens the file, a failed open sets failbit
+* @Param path - absolute path to file
+* @Param direct - read very large files with O_DIRECT
+*/
+InputFile::InputFile(const fs::path& path, bool direct) :
+	std::istream(nullptr)
+{
+#if defined(BTTF_WITH_URING)
+	m_buffer = openRingInput(path, direct);
+#else
+	(void)direct;
+#endif
+
+	if (!m_buffer)
+	{
+		auto file = std::make_unique<std::filebuf>();
+		m_open = nullptr != file->open(path, std::ios::in | std::ios::binary);
+		m_buffer = std::move(file);
+	}
+	else
+	{
+		m_open = true;
+	}
+
+	rdbuf(m_buffer.get());
+	if (!m_open)
+	{
+		setstate(std::ios::failbit);
+	}
+}
+
+/**
+* Name: InputFile::~InputFile
+* Description: Destructor, the buffer waits for reads still in flight
+*/
+InputFile::~InputFile() = default;
+
+/**
+* Name: OutputFile::OutputFile
+* Description: Constructor, creates or opens the file, a failed open sets failbit
+* @Param path - absolute path to file
+* @Param update - keep the content of an existing file
+*/
+OutputFile::OutputFile(const fs::path& path, bool update) :
+	std::ostream(nullptr)
+{
+#if defined(BTTF_WITH_URING)
+	m_buffer = openRingOutput(path, update);
+	m_ring = nullptr != m_buffer;
+#endif
+
+	if (!m_buffer)
+	{
+		auto file = std::make_unique<std::filebuf>();
+		m_open = nullptr != file->open(path, update ? std::ios::in | std::ios::out | std::ios::binary : std::ios::out | std::ios::binary);
+		m_buffer = std::move(file);
+	}
+	else
+	{
+		m_open = true;
+	}
+
+	rdbuf(m_buffer.get());
+	if (!m_open)
+	{
+		setstate(std::ios::failbit);
+	}
+}
+
+/**
+* Name: OutputFile::~OutputFile
+* Description: Destructor, closes the file
+*/
+OutputFile::~OutputFile()
+{
+	close();
+}
+
+/**
+* Name: OutputFile::close
+* Description: Write everything still buffered or in flight and close the file, failure sets failbit
+*/
+void OutputFile::close()
+{
+	if (!m_open)
+	{
+		return;
+	}
+	m_open = false;
+
+	bool closed = true;
+#if defined(BTTF_WITH_URING)
+	if (m_ring)
+	{
+		closed = static_cast<RingWriteBuffer*>(m_buffer.get())->close();
+	}
+#endif
+	if (!m_ring)
+	{
+		closed = nullptr != static_cast<std::filebuf*>(m_buffer.get())->close();
+	}
+
+	if (!closed)
+	{
+		setstate(std::ios::failbit);
+	}
+}
+
+/**
+* Name: prefetchFile
+* Description: Ask the kernel to start reading a file range into the page cache, so a later read does not wait
+* @Param path - absolute path to file
+* @Param offset - first byte of the range
+* @Param length - range length, 0 up to the end of the file
+*/
+void prefetchFile(const fs::path& path, uint64_t offset, uint64_t length)
+{
+#if !defined(_WIN32)
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (0 > fd)
+	{
+		return;
+	}
+	posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+	::close(fd);
+#else
+	(void)path;
+	(void)offset;
+	(void)length;
+#endif
+}
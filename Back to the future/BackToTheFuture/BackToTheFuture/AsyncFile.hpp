@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+
+namespace fs = std::filesystem;
+
+/**
+* Name: InputFile
+* Description: Binary input file stream. Linux builds with BTTF_WITH_URING read regular files through the io_uring
+*              of the thread and keep several blocks ahead in flight, so the disk works while the caller compresses.
+*              Other builds, other files and threads without a free ring read through std::filebuf.
+*/
+class InputFile : public std::istream
+{
+public:
+	// direct bypasses the page cache for very large files where the file system allows it
+	explicit InputFile(const fs::path& path, bool direct = false);
+	~InputFile() override;
+
+	bool is_open() const { return m_open; }
+
+private:
+	std::unique_ptr<std::streambuf> m_buffer;
+	bool m_open = false;
+};
+
+/**
+* Name: OutputFile
+* Description: Binary output file stream. With io_uring full blocks are written asynchronously while the caller fills
+*              the next one, close() and seeks wait for all of them. Other builds write through std::filebuf.
+*/
+class OutputFile : public std::ostream
+{
+public:
+	// update opens an existing file without truncating it
+	explicit OutputFile(const fs::path& path, bool update = false);
+	~OutputFile() override;
+
+	bool is_open() const { return m_open; }
+	void close();
+
+private:
+	std::unique_ptr<std::streambuf> m_buffer;
+	bool m_ring = false;
+	bool m_open = false;
+};
+
+void prefetchFile(const fs::path& path, uint64_t offset = 0, uint64_t length = 0);
@@ -1,7 +1,23 @@
-﻿#include <iostream>
-#include <thread>
+﻿#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
 
 #include "FileManager.hpp"
+#include "Logger.hpp"
+#include "Stats.hpp"
+#include "WorkerPool.hpp"
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 namespace fs = std::filesystem;
 
@@ -9,56 +25,535 @@ namespace
 {
     const char* PACK_MODE = "pack";
     const char* UNPACK_MODE = "unpack";
+    const char* LIST_MODE = "list";
+    const char* EXTRACT_MODE = "extract";
+    const char* CAT_MODE = "cat";
+    const char* VERIFY_MODE = "verify";
+    const char* THREADS_OPTION = "--threads";
+    const char* CDC_OPTION = "--cdc";
+    const char* CDC_SIZES_OPTION = "--cdc-sizes";
+    const char* ALWAYS_COMPRESS_OPTION = "--always-compress";
+    const char* CODEC_OPTION = "--codec";
+    const char* LONG_OPTION = "--long";
+    const char* HASH_OPTION = "--hash";
+    const char* BLOCK_SIZE_OPTION = "--block-size";
+    const char* SOLID_OPTION = "--solid";
+    const char* SOLID_BLOCK_OPTION = "--solid-block";
+    const char* DICT_OPTION = "--dict";
+    const char* DICT_SIZE_OPTION = "--dict-size";
+    const char* DIRECT_IO_OPTION = "--direct-io";
+    const char* NO_CACHE_OPTION = "--no-cache";
+    const char* VERIFY_CACHE_OPTION = "--verify-cache";
+    const char* CACHE_OPTION = "--cache";
+    const char* HARDLINK_OPTION = "--hardlink";
+    const char* OFFSET_OPTION = "--offset";
+    const char* LENGTH_OPTION = "--length";
+    const char* LOG_LEVEL_OPTION = "--log-level";
+    const char* LOG_FILE_OPTION = "--log-file";
+    const char* STATS_OPTION = "--stats";
+    const char* PROGRESS_OPTION = "--progress";
+
+    constexpr uint64_t DEFAULT_SOLID_BLOCK = 4 << 20;
+    // smaller blocks would store more headers and digests than content, 0 still disables them
+    constexpr uint64_t MIN_BLOCK_SIZE = 64 << 10;
+    constexpr uint64_t DEFAULT_DICTIONARY_SIZE = 112 << 10;
+
+    // whole text as a decimal number, no sign, spaces or trailing characters
+    template <typename T>
+    bool parseNumber(const std::string& text, T& value)
+    {
+        const char* end = text.data() + text.size();
+        auto [last, error] = std::from_chars(text.data(), end, value);
+        return std::errc() == error && end == last;
+    }
+
+    // size with optional K, M or G suffix, e.g. 64K, nothing may follow the suffix
+    bool parseSize(const std::string& text, uint64_t& value)
+    {
+        const char* end = text.data() + text.size();
+        auto [last, error] = std::from_chars(text.data(), end, value);
+        if (std::errc() != error)
+        {
+            return false;
+        }
+        if (end == last)
+        {
+            return true;
+        }
+
+        char unit = static_cast<char>(std::toupper(static_cast<unsigned char>(*last)));
+        int shift = 'K' == unit ? 10 : ('M' == unit ? 20 : ('G' == unit ? 30 : 0));
+        if (0 == shift || end != last + 1 || value > (UINT64_MAX >> shift))
+        {
+            return false;
+        }
+        value <<= shift;
+        return true;
+    }
+
+    // block sizes are 0 or at least MIN_BLOCK_SIZE
+    bool parseBlockSize(const std::string& text, uint64_t& value)
+    {
+        if (!parseSize(text, value))
+        {
+            std::cout << "Invalid size " << text << "\n";
+            return false;
+        }
+        if (0 != value && MIN_BLOCK_SIZE > value)
+        {
+            std::cout << "Block size " << text << " is below the minimum of 64K\n";
+            return false;
+        }
+        return true;
+    }
+
+    bool parseThreads(const std::string& text, std::size_t& threads)
+    {
+        uint64_t value = 0;
+        if (!parseNumber(text, value))
+        {
+            std::cout << "Invalid thread count " << text << "\n";
+            return false;
+        }
+        threads = static_cast<std::size_t>(std::min<uint64_t>(value, WorkerPool::MAX_THREADS));
+        return true;
+    }
+
+    bool parseChunkerParams(const std::string& text, ChunkerParams& params)
+    {
+        std::size_t first = text.find(':');
+        std::size_t second = text.find(':', first + 1);
+        if (std::string::npos == first || std::string::npos == second)
+        {
+            return false;
+        }
+
+        uint64_t minSize = 0;
+        uint64_t avgSize = 0;
+        uint64_t maxSize = 0;
+        if (!parseSize(text.substr(0, first), minSize) || !parseSize(text.substr(first + 1, second - first - 1), avgSize) || !parseSize(text.substr(second + 1), maxSize))
+        {
+            return false;
+        }
+        params.minSize = static_cast<std::size_t>(minSize);
+        params.avgSize = static_cast<std::size_t>(avgSize);
+        params.maxSize = static_cast<std::size_t>(maxSize);
+        return Chunker::validate(params);
+    }
+
+    // codec name with optional level, e.g. zstd:19
+    bool parseCodecParams(const std::string& text, CodecParams& params)
+    {
+        std::size_t colon = text.find(':');
+        if (!parseCodecName(text.substr(0, colon), params.id))
+        {
+            return false;
+        }
+
+        params.level = CodecParams::DEFAULT_LEVEL;
+        return std::string::npos == colon || parseNumber(text.substr(colon + 1), params.level);
+    }
 } //anonymous namespace
 
 void printHelp()
 {
-    std::cout << "Usage: app pack <input_folder> <archive_path>\n"
-        << "       app unpack <archive_path> <output_folder>\n";
+    std::cout << "Usage: app pack <input_folder> <archive_path> [--threads N] [--cdc] [--cdc-sizes MIN:AVG:MAX]\n"
+        << "                [--codec NAME[:LEVEL]] [--long] [--hash NAME] [--block-size SIZE] [--always-compress]\n"
+        << "                [--solid] [--solid-block SIZE] [--dict] [--dict-size SIZE] [--direct-io]\n"
+        << "                [--no-cache | --verify-cache] [--cache PATH]\n"
+        << "       app unpack <archive_path> <output_folder> [--threads N] [--hardlink]\n"
+        << "       app list <archive_path>\n"
+        << "       app extract <archive_path> <output_folder> <pattern...> [--threads N] [--hardlink]\n"
+        << "       app cat <archive_path> <file_path> [--offset N] [--length N]\n"
+        << "       app verify <archive_path> [--threads N]\n"
+        << "       every mode also takes [--log-level LEVEL] [--log-file PATH] [--stats PATH] [--progress SECONDS]\n"
+        << "       archive_path - writes the archive to stdout when packing and reads it from stdin when unpacking\n"
+        << "Options:\n"
+        << "       --threads N                 number of worker threads, 0 uses all cores (default 1)\n"
+        << "       --cdc                       deduplicate content defined chunks instead of whole files\n"
+        << "       --cdc-sizes MIN:AVG:MAX     chunk sizes for --cdc, K/M/G suffixes allowed (default 16K:64K:256K)\n"
+        << "       --codec NAME[:LEVEL]        store, zlib (default, level 9), zstd (level 3) or lz4 (level 0, 3+ is HC)\n"
+        << "       --long                      zstd long distance matching with a 128 MiB window\n"
+        << "       --hash NAME                 content hash: sha256 (default), blake3 or xxh3 (128 bit, not cryptographic)\n"
+        << "       --block-size SIZE           compress larger files as independent blocks of SIZE (64K or more), 0 disables (default 4M)\n"
+        << "       --solid                     compress files up to 64K together in solid blocks, ordered by extension\n"
+        << "       --solid-block SIZE          solid block size of 64K or more, implies --solid (default 4M)\n"
+        << "       --dict                      train a dictionary for blobs up to 64K, zlib and zstd (default 112K)\n"
+        << "       --dict-size SIZE            dictionary size, implies --dict\n"
+        << "       --direct-io                 read files of 64M and more with O_DIRECT (io_uring builds)\n"
+        << "       --always-compress           compress already compressed data too, instead of storing it\n"
+        << "       --no-cache                  do not read or write the digest cache of the input folder (on by default)\n"
+        << "       --verify-cache              read every file and report digest cache entries which are out of date\n"
+        << "       --cache PATH                digest cache file (default: per folder in the user cache directory)\n"
+        << "       --hardlink                  restore files with the same content as hard links, for read only trees\n"
+        << "       --log-level LEVEL           debug, info, warn (default), error or off\n"
+        << "       --log-file PATH             append the log to PATH, stderr then only gets warnings and errors\n"
+        << "       --stats PATH                write phase counters and timings as JSON to PATH, - for stderr\n"
+        << "       --progress SECONDS          print progress to stderr every SECONDS\n";
+}
+
+bool parsePackOptions(int argc, char** argv, PackOptions& options)
+{
+    for (int i = 4; i < argc; i++)
+    {
+        std::string option(argv[i]);
+        if (THREADS_OPTION == option && i + 1 < argc)
+        {
+            if (!parseThreads(argv[++i], options.threads))
+            {
+                return false;
+            }
+        }
+        else if (ALWAYS_COMPRESS_OPTION == option)
+        {
+            options.entropyCheck = false;
+        }
+        else if (CDC_OPTION == option)
+        {
+            options.chunking = true;
+        }
+        else if (CODEC_OPTION == option && i + 1 < argc)
+        {
+            if (!parseCodecParams(argv[++i], options.codec))
+            {
+                std::cout << "Unknown codec " << argv[i] << "\n";
+                return false;
+            }
+            if (!isCodecAvailable(options.codec.id))
+            {
+                std::cout << "Codec " << argv[i] << " is not available in this build\n";
+                return false;
+            }
+            if (!isCodecLevelValid(options.codec))
+            {
+                std::cout << "Invalid level for codec " << argv[i] << "\n";
+                return false;
+            }
+        }
+        else if (LONG_OPTION == option)
+        {
+            options.codec.longRange = true;
+        }
+        else if (HASH_OPTION == option && i + 1 < argc)
+        {
+            if (!parseHashName(argv[++i], options.hash))
+            {
+                std::cout << "Unknown hash " << argv[i] << "\n";
+                return false;
+            }
+            if (!isHashAvailable(options.hash))
+            {
+                std::cout << "Hash " << argv[i] << " is not available in this build\n";
+                return false;
+            }
+        }
+        else if (BLOCK_SIZE_OPTION == option && i + 1 < argc)
+        {
+            if (!parseBlockSize(argv[++i], options.blockSize))
+            {
+                return false;
+            }
+        }
+        else if (SOLID_OPTION == option)
+        {
+            options.solidBlockSize = DEFAULT_SOLID_BLOCK;
+        }
+        else if (SOLID_BLOCK_OPTION == option && i + 1 < argc)
+        {
+            if (!parseBlockSize(argv[++i], options.solidBlockSize))
+            {
+                return false;
+            }
+        }
+        else if (DICT_OPTION == option)
+        {
+            options.dictionarySize = DEFAULT_DICTIONARY_SIZE;
+        }
+        else if (DICT_SIZE_OPTION == option && i + 1 < argc)
+        {
+            uint64_t size = 0;
+            if (!parseSize(argv[++i], size))
+            {
+                std::cout << "Invalid size " << argv[i] << "\n";
+                return false;
+            }
+            options.dictionarySize = static_cast<std::size_t>(size);
+        }
+        else if (DIRECT_IO_OPTION == option)
+        {
+            options.directIo = true;
+        }
+        else if (NO_CACHE_OPTION == option)
+        {
+            options.cache = CacheMode::Off;
+        }
+        else if (VERIFY_CACHE_OPTION == option)
+        {
+            options.cache = CacheMode::Verify;
+        }
+        else if (CACHE_OPTION == option && i + 1 < argc)
+        {
+            options.cachePath = argv[++i];
+        }
+        else if (CDC_SIZES_OPTION == option && i + 1 < argc)
+        {
+            options.chunking = true;
+            if (!parseChunkerParams(argv[++i], options.chunker))
+            {
+                std::cout << "Invalid chunk sizes " << argv[i] << "\n";
+                return false;
+            }
+        }
+        else
+        {
+            std::cout << "Unknown option " << option << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parseUnpackOptions(int argc, char** argv, int first, UnpackOptions& options, std::vector<std::string>* patterns)
+{
+    for (int i = first; i < argc; i++)
+    {
+        std::string option(argv[i]);
+        if (THREADS_OPTION == option && i + 1 < argc)
+        {
+            if (!parseThreads(argv[++i], options.threads))
+            {
+                return false;
+            }
+        }
+        else if (HARDLINK_OPTION == option)
+        {
+            options.hardlinks = true;
+        }
+        else if (patterns && 0 != option.compare(0, 2, "--"))
+        {
+            patterns->push_back(option);
+        }
+        else
+        {
+            std::cout << "Unknown option " << option << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parseRange(int argc, char** argv, uint64_t& offset, uint64_t& length)
+{
+    for (int i = 4; i < argc; i++)
+    {
+        std::string option(argv[i]);
+        if (OFFSET_OPTION == option && i + 1 < argc)
+        {
+            if (!parseSize(argv[++i], offset))
+            {
+                std::cout << "Invalid size " << argv[i] << "\n";
+                return false;
+            }
+        }
+        else if (LENGTH_OPTION == option && i + 1 < argc)
+        {
+            if (!parseSize(argv[++i], length))
+            {
+                std::cout << "Invalid size " << argv[i] << "\n";
+                return false;
+            }
+        }
+        else
+        {
+            std::cout << "Unknown option " << option << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parseCommonOptions(int& argc, char** argv, std::string& statsPath, double& progress)
+{
+    // logging and report options are accepted anywhere and removed before the mode options are parsed
+    LogLevel level = Logger::instance().enabled(LogLevel::Debug) ? LogLevel::Debug : LogLevel::Warn;
+    std::string logFile;
+    int kept = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option(argv[i]);
+        if (LOG_LEVEL_OPTION == option && i + 1 < argc)
+        {
+            if (!Logger::parseLevel(argv[++i], level))
+            {
+                std::cout << "Unknown log level " << argv[i] << "\n";
+                return false;
+            }
+        }
+        else if (LOG_FILE_OPTION == option && i + 1 < argc)
+        {
+            logFile = argv[++i];
+        }
+        else if (STATS_OPTION == option && i + 1 < argc)
+        {
+            statsPath = argv[++i];
+        }
+        else if (PROGRESS_OPTION == option && i + 1 < argc)
+        {
+            char* end = nullptr;
+            progress = std::strtod(argv[++i], &end);
+            if (end == argv[i] || '\0' != *end || !(0.0 <= progress))
+            {
+                std::cout << "Invalid progress interval " << argv[i] << "\n";
+                return false;
+            }
+        }
+        else
+        {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+    Logger::instance().init(logFile, level);
+    return true;
 }
 
 int main(int argc, char** argv)
 {
-    if (4 > argc)
+    std::string statsPath;
+    double progress = 0.0;
+    if (!parseCommonOptions(argc, argv, statsPath, progress))
+    {
+        printHelp();
+        return 1;
+    }
+
+    if (3 > argc || (4 > argc && LIST_MODE != std::string(argv[1]) && VERIFY_MODE != std::string(argv[1])))
     {
         printHelp();
-        return 0;
+        return 1;
     }
 
     FileScanner scanner;
     Compressor compressor;
     FileManager fileManager(compressor, scanner);
     std::string mode(argv[1]);
+
+    int result = 0;
+    const auto start = std::chrono::steady_clock::now();
+    Stats::startProgress(progress);
     if (PACK_MODE == mode)
     {
         fs::path inputFolder = argv[2];
         fs::path archiveFile = argv[3];
 
-        std::thread worker([&]()
-            {
-                std::cout << "Start packing\n";
-                fileManager.Pack(inputFolder, archiveFile);
-            });
+        PackOptions options;
+        if (!parsePackOptions(argc, argv, options))
+        {
+            printHelp();
+            return 1;
+        }
 
-        worker.join();
-        std::cout << "Packing Finished\n";
+        // stdout carries the archive when it is the target, messages then go to stderr
+        std::ostream& console = "-" == archiveFile ? std::cerr : std::cout;
+#if defined(_WIN32)
+        if ("-" == archiveFile)
+        {
+            _setmode(_fileno(stdout), _O_BINARY);
+        }
+#endif
+        console << "Start packing\n";
+        result = fileManager.Pack(inputFolder, archiveFile, options) ? 0 : 1;
+        console << (0 == result ? "Packing Finished\n" : "Packing Failed\n");
     }
     else if (UNPACK_MODE == mode)
     {
         fs::path archiveFile = argv[2];
         fs::path outputFolder = argv[3];
 
-        std::thread worker([&]()
-            {
-                std::cout << "Start unpacking\n";
-                fileManager.Unpack(archiveFile, outputFolder);
-            });
+        UnpackOptions options;
+        if (!parseUnpackOptions(argc, argv, 4, options, nullptr))
+        {
+            printHelp();
+            return 1;
+        }
+
+#if defined(_WIN32)
+        if ("-" == archiveFile)
+        {
+            _setmode(_fileno(stdin), _O_BINARY);
+        }
+#endif
+        std::cout << "Start unpacking\n";
+        result = fileManager.Unpack(archiveFile, outputFolder, options) ? 0 : 1;
+        std::cout << (0 == result ? "Unpacking Finished\n" : "Unpacking Failed\n");
+    }
+    else if (LIST_MODE == mode)
+    {
+        result = fileManager.List(argv[2]) ? 0 : 1;
+    }
+    else if (EXTRACT_MODE == mode && 5 <= argc)
+    {
+        fs::path archiveFile = argv[2];
+        fs::path outputFolder = argv[3];
 
-        worker.join();
-        std::cout << "Unpacking Finished\n";
+        UnpackOptions options;
+        std::vector<std::string> patterns;
+        if (!parseUnpackOptions(argc, argv, 4, options, &patterns) || patterns.empty())
+        {
+            printHelp();
+            return 1;
+        }
+
+        std::cout << "Start extracting\n";
+        result = fileManager.Extract(archiveFile, outputFolder, patterns, options) ? 0 : 1;
+        std::cout << (0 == result ? "Extracting Finished\n" : "Extracting Failed\n");
+    }
+    else if (VERIFY_MODE == mode)
+    {
+        UnpackOptions options;
+        if (!parseUnpackOptions(argc, argv, 3, options, nullptr))
+        {
+            printHelp();
+            return 1;
+        }
+
+        // a non zero exit code lets scheduled checks notice a damaged archive
+        result = fileManager.Verify(argv[2], options) ? 0 : 1;
+    }
+    else if (CAT_MODE == mode)
+    {
+        uint64_t offset = 0;
+        uint64_t length = UINT64_MAX;
+        if (!parseRange(argc, argv, offset, length))
+        {
+            printHelp();
+            return 1;
+        }
+
+#if defined(_WIN32)
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        result = fileManager.Cat(argv[2], argv[3], offset, length) ? 0 : 1;
     }
     else
     {
         std::cout << "Unknow Method";
+        result = 1;
+    }
+
+    Stats::stopProgress();
+    if (!statsPath.empty())
+    {
+        std::string report = Stats::toJson(mode, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        if ("-" == statsPath)
+        {
+            std::cerr << report;
+        }
+        else
+        {
+            std::ofstream statsFile(statsPath, std::ios::binary);
+            statsFile << report;
+        }
     }
+    return result;
 }
@@ -0,0 +1,572 @@
+#include "Blake3Hasher.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define BTTF_BLAKE3_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 is picked at run time, the rest of the build stays baseline x86-64
+#if defined(__x86_64__) || defined(_M_X64)
+#define BTTF_BLAKE3_AVX2
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define BTTF_TARGET_AVX2
+#else
+#define BTTF_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+	constexpr uint32_t IV[8] = { 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+	constexpr unsigned MSG_SCHEDULE[7][16] =
+	{
+		{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+		{ 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+		{ 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+		{ 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+		{ 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+		{ 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+		{ 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+	};
+
+	constexpr uint32_t CHUNK_START = 1 << 0;
+	constexpr uint32_t CHUNK_END = 1 << 1;
+	constexpr uint32_t PARENT = 1 << 2;
+	constexpr uint32_t ROOT = 1 << 3;
+
+	inline uint32_t rotr(uint32_t value, int count)
+	{
+		return (value >> count) | (value << (32 - count));
+	}
+
+	inline uint32_t load32(const uint8_t* bytes)
+	{
+		return static_cast<uint32_t>(bytes[0]) | static_cast<uint32_t>(bytes[1]) << 8 |
+			static_cast<uint32_t>(bytes[2]) << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+	}
+
+	inline void g(uint32_t* state, int a, int b, int c, int d, uint32_t mx, uint32_t my)
+	{
+		state[a] = state[a] + state[b] + mx;
+		state[d] = rotr(state[d] ^ state[a], 16);
+		state[c] = state[c] + state[d];
+		state[b] = rotr(state[b] ^ state[c], 12);
+		state[a] = state[a] + state[b] + my;
+		state[d] = rotr(state[d] ^ state[a], 8);
+		state[c] = state[c] + state[d];
+		state[b] = rotr(state[b] ^ state[c], 7);
+	}
+
+	// full 16 word output, the first 8 words are the chaining value
+	void compress(const uint32_t cv[8], const uint8_t block[Blake3Hasher::BLOCK_LEN], std::size_t blockLen, uint64_t counter, uint32_t flags, uint32_t out[16])
+	{
+		uint32_t m[16];
+		for (int i = 0; i < 16; i++)
+		{
+			m[i] = load32(block + 4 * i);
+		}
+
+		uint32_t state[16] =
+		{
+			cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+			IV[0], IV[1], IV[2], IV[3],
+			static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32), static_cast<uint32_t>(blockLen), flags,
+		};
+
+		for (const unsigned* s : MSG_SCHEDULE)
+		{
+			g(state, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+			g(state, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+			g(state, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+			g(state, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+			g(state, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+			g(state, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+			g(state, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+			g(state, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+		}
+
+		for (int i = 0; i < 8; i++)
+		{
+			out[i] = state[i] ^ state[i + 8];
+			out[i + 8] = state[i + 8] ^ cv[i];
+		}
+	}
+
+	void parentCv(const uint32_t left[8], const uint32_t right[8], uint32_t flags, uint32_t out[16])
+	{
+		uint8_t block[Blake3Hasher::BLOCK_LEN];
+		for (int i = 0; i < 8; i++)
+		{
+			for (int j = 0; j < 4; j++)
+			{
+				block[4 * i + j] = static_cast<uint8_t>(left[i] >> (8 * j));
+				block[32 + 4 * i + j] = static_cast<uint8_t>(right[i] >> (8 * j));
+			}
+		}
+		compress(IV, block, Blake3Hasher::BLOCK_LEN, 0, PARENT | flags, out);
+	}
+
+#if defined(BTTF_BLAKE3_SSE2)
+	template <int count>
+	inline __m128i rotr4(__m128i value)
+	{
+		return _mm_or_si128(_mm_srli_epi32(value, count), _mm_slli_epi32(value, 32 - count));
+	}
+
+	inline void g4(__m128i* v, int a, int b, int c, int d, __m128i mx, __m128i my)
+	{
+		v[a] = _mm_add_epi32(_mm_add_epi32(v[a], v[b]), mx);
+		v[d] = rotr4<16>(_mm_xor_si128(v[d], v[a]));
+		v[c] = _mm_add_epi32(v[c], v[d]);
+		v[b] = rotr4<12>(_mm_xor_si128(v[b], v[c]));
+		v[a] = _mm_add_epi32(_mm_add_epi32(v[a], v[b]), my);
+		v[d] = rotr4<8>(_mm_xor_si128(v[d], v[a]));
+		v[c] = _mm_add_epi32(v[c], v[d]);
+		v[b] = rotr4<7>(_mm_xor_si128(v[b], v[c]));
+	}
+#endif
+
+	// chaining values of LANES whole, non final chunks, every lane runs one chunk of the same shape
+	void hashChunks(const uint8_t* input, uint64_t counter, uint32_t cvs[Blake3Hasher::LANES][8])
+	{
+#if defined(BTTF_BLAKE3_SSE2)
+		static_assert(4 == Blake3Hasher::LANES, "SSE2 path hashes four chunks");
+
+		__m128i cv[8];
+		for (int i = 0; i < 8; i++)
+		{
+			cv[i] = _mm_set1_epi32(static_cast<int>(IV[i]));
+		}
+
+		const __m128i counterLow = _mm_set_epi32(static_cast<int>(counter + 3), static_cast<int>(counter + 2), static_cast<int>(counter + 1), static_cast<int>(counter));
+		const __m128i counterHigh = _mm_set_epi32(static_cast<int>((counter + 3) >> 32), static_cast<int>((counter + 2) >> 32), static_cast<int>((counter + 1) >> 32), static_cast<int>(counter >> 32));
+
+		for (std::size_t block = 0; block < Blake3Hasher::CHUNK_LEN / Blake3Hasher::BLOCK_LEN; block++)
+		{
+			// load four words of every lane and transpose them, so that m[i] holds word i of all lanes
+			__m128i m[16];
+			for (int i = 0; i < 16; i += 4)
+			{
+				const uint8_t* words = input + block * Blake3Hasher::BLOCK_LEN + 4 * i;
+				__m128i lane0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words));
+				__m128i lane1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + Blake3Hasher::CHUNK_LEN));
+				__m128i lane2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + 2 * Blake3Hasher::CHUNK_LEN));
+				__m128i lane3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + 3 * Blake3Hasher::CHUNK_LEN));
+
+				__m128i low01 = _mm_unpacklo_epi32(lane0, lane1);
+				__m128i high01 = _mm_unpackhi_epi32(lane0, lane1);
+				__m128i low23 = _mm_unpacklo_epi32(lane2, lane3);
+				__m128i high23 = _mm_unpackhi_epi32(lane2, lane3);
+
+				m[i] = _mm_unpacklo_epi64(low01, low23);
+				m[i + 1] = _mm_unpackhi_epi64(low01, low23);
+				m[i + 2] = _mm_unpacklo_epi64(high01, high23);
+				m[i + 3] = _mm_unpackhi_epi64(high01, high23);
+			}
+
+			uint32_t flags = (0 == block ? CHUNK_START : 0) | (Blake3Hasher::CHUNK_LEN / Blake3Hasher::BLOCK_LEN - 1 == block ? CHUNK_END : 0);
+			__m128i v[16] =
+			{
+				cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+				_mm_set1_epi32(static_cast<int>(IV[0])), _mm_set1_epi32(static_cast<int>(IV[1])), _mm_set1_epi32(static_cast<int>(IV[2])), _mm_set1_epi32(static_cast<int>(IV[3])),
+				counterLow, counterHigh, _mm_set1_epi32(static_cast<int>(Blake3Hasher::BLOCK_LEN)), _mm_set1_epi32(static_cast<int>(flags)),
+			};
+
+			for (const unsigned* s : MSG_SCHEDULE)
+			{
+				g4(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+				g4(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+				g4(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+				g4(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+				g4(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+				g4(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+				g4(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+				g4(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+			}
+
+			for (int i = 0; i < 8; i++)
+			{
+				cv[i] = _mm_xor_si128(v[i], v[i + 8]);
+			}
+		}
+
+		for (int i = 0; i < 8; i++)
+		{
+			alignas(16) uint32_t lanes[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes), cv[i]);
+			for (std::size_t lane = 0; lane < Blake3Hasher::LANES; lane++)
+			{
+				cvs[lane][i] = lanes[lane];
+			}
+		}
+#else
+		for (std::size_t lane = 0; lane < Blake3Hasher::LANES; lane++)
+		{
+			uint32_t cv[16];
+			std::memcpy(cv, IV, sizeof(IV));
+			for (std::size_t block = 0; block < Blake3Hasher::CHUNK_LEN / Blake3Hasher::BLOCK_LEN; block++)
+			{
+				uint32_t flags = (0 == block ? CHUNK_START : 0) | (Blake3Hasher::CHUNK_LEN / Blake3Hasher::BLOCK_LEN - 1 == block ? CHUNK_END : 0);
+				compress(cv, input + lane * Blake3Hasher::CHUNK_LEN + block * Blake3Hasher::BLOCK_LEN, Blake3Hasher::BLOCK_LEN, counter + lane, flags, cv);
+			}
+			std::memcpy(cvs[lane], cv, 8 * sizeof(uint32_t));
+		}
+#endif
+	}
+
+#if defined(BTTF_BLAKE3_AVX2)
+	// 16 and 8 bit rotations are byte shuffles, the others shifts
+	BTTF_TARGET_AVX2 inline __m256i rotr16x8(__m256i value)
+	{
+		return _mm256_shuffle_epi8(value, _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2, 13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+	}
+
+	BTTF_TARGET_AVX2 inline __m256i rotr8x8(__m256i value)
+	{
+		return _mm256_shuffle_epi8(value, _mm256_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1, 12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1));
+	}
+
+	template <int count>
+	BTTF_TARGET_AVX2 inline __m256i rotr8(__m256i value)
+	{
+		return _mm256_or_si256(_mm256_srli_epi32(value, count), _mm256_slli_epi32(value, 32 - count));
+	}
+
+	BTTF_TARGET_AVX2 inline void g8(__m256i* v, int a, int b, int c, int d, __m256i mx, __m256i my)
+	{
+		v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), mx);
+		v[d] = rotr16x8(_mm256_xor_si256(v[d], v[a]));
+		v[c] = _mm256_add_epi32(v[c], v[d]);
+		v[b] = rotr8<12>(_mm256_xor_si256(v[b], v[c]));
+		v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), my);
+		v[d] = rotr8x8(_mm256_xor_si256(v[d], v[a]));
+		v[c] = _mm256_add_epi32(v[c], v[d]);
+		v[b] = rotr8<7>(_mm256_xor_si256(v[b], v[c]));
+	}
+
+	// chaining values of WIDE_LANES inputs of the same shape, lane i starts stride bytes after lane i - 1. Chunks
+	// take 16 blocks and count up, parents one block with counter 0
+	BTTF_TARGET_AVX2 void hashWide(const uint8_t* input, std::size_t stride, std::size_t blocks, uint64_t counter, uint64_t counterStep, uint32_t flags, uint32_t startFlags, uint32_t endFlags, uint32_t* out)
+	{
+		static_assert(8 == Blake3Hasher::WIDE_LANES, "AVX2 path hashes eight lanes");
+
+		__m256i cv[8];
+		for (int i = 0; i < 8; i++)
+		{
+			cv[i] = _mm256_set1_epi32(static_cast<int>(IV[i]));
+		}
+
+		alignas(32) uint32_t low[8];
+		alignas(32) uint32_t high[8];
+		for (int lane = 0; lane < 8; lane++)
+		{
+			low[lane] = static_cast<uint32_t>(counter + lane * counterStep);
+			high[lane] = static_cast<uint32_t>((counter + lane * counterStep) >> 32);
+		}
+		const __m256i counterLow = _mm256_load_si256(reinterpret_cast<const __m256i*>(low));
+		const __m256i counterHigh = _mm256_load_si256(reinterpret_cast<const __m256i*>(high));
+
+		for (std::size_t block = 0; block < blocks; block++)
+		{
+			// load eight words of every lane and transpose the 8x8 matrix, so that m[i] holds word i of all lanes
+			__m256i m[16];
+			for (int i = 0; i < 16; i += 8)
+			{
+				const uint8_t* words = input + block * Blake3Hasher::BLOCK_LEN + 4 * i;
+				__m256i rows[8];
+				for (int lane = 0; lane < 8; lane++)
+				{
+					rows[lane] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + lane * stride));
+				}
+
+				__m256i pairs[8];
+				for (int lane = 0; lane < 8; lane += 2)
+				{
+					pairs[lane] = _mm256_unpacklo_epi32(rows[lane], rows[lane + 1]);
+					pairs[lane + 1] = _mm256_unpackhi_epi32(rows[lane], rows[lane + 1]);
+				}
+
+				// quads[k] holds word k (low half) and word k + 4 (high half) of four lanes
+				__m256i quads[8];
+				for (int half = 0; half < 8; half += 4)
+				{
+					quads[half] = _mm256_unpacklo_epi64(pairs[half], pairs[half + 2]);
+					quads[half + 1] = _mm256_unpackhi_epi64(pairs[half], pairs[half + 2]);
+					quads[half + 2] = _mm256_unpacklo_epi64(pairs[half + 1], pairs[half + 3]);
+					quads[half + 3] = _mm256_unpackhi_epi64(pairs[half + 1], pairs[half + 3]);
+				}
+
+				for (int k = 0; k < 4; k++)
+				{
+					m[i + k] = _mm256_permute2x128_si256(quads[k], quads[k + 4], 0x20);
+					m[i + k + 4] = _mm256_permute2x128_si256(quads[k], quads[k + 4], 0x31);
+				}
+			}
+
+			uint32_t blockFlags = flags | (0 == block ? startFlags : 0) | (blocks - 1 == block ? endFlags : 0);
+			__m256i v[16] =
+			{
+				cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+				_mm256_set1_epi32(static_cast<int>(IV[0])), _mm256_set1_epi32(static_cast<int>(IV[1])), _mm256_set1_epi32(static_cast<int>(IV[2])), _mm256_set1_epi32(static_cast<int>(IV[3])),
+				counterLow, counterHigh, _mm256_set1_epi32(static_cast<int>(Blake3Hasher::BLOCK_LEN)), _mm256_set1_epi32(static_cast<int>(blockFlags)),
+			};
+
+			for (const unsigned* s : MSG_SCHEDULE)
+			{
+				g8(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+				g8(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+				g8(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+				g8(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+				g8(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+				g8(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+				g8(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+				g8(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+			}
+
+			for (int i = 0; i < 8; i++)
+			{
+				cv[i] = _mm256_xor_si256(v[i], v[i + 8]);
+			}
+		}
+
+		// back to one chaining value per lane, the transpose is its own inverse
+		__m256i pairs[8];
+		for (int i = 0; i < 8; i += 2)
+		{
+			pairs[i] = _mm256_unpacklo_epi32(cv[i], cv[i + 1]);
+			pairs[i + 1] = _mm256_unpackhi_epi32(cv[i], cv[i + 1]);
+		}
+		__m256i quads[8];
+		for (int half = 0; half < 8; half += 4)
+		{
+			quads[half] = _mm256_unpacklo_epi64(pairs[half], pairs[half + 2]);
+			quads[half + 1] = _mm256_unpackhi_epi64(pairs[half], pairs[half + 2]);
+			quads[half + 2] = _mm256_unpacklo_epi64(pairs[half + 1], pairs[half + 3]);
+			quads[half + 3] = _mm256_unpackhi_epi64(pairs[half + 1], pairs[half + 3]);
+		}
+		for (int k = 0; k < 4; k++)
+		{
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 8 * k), _mm256_permute2x128_si256(quads[k], quads[k + 4], 0x20));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 8 * (k + 4)), _mm256_permute2x128_si256(quads[k], quads[k + 4], 0x31));
+		}
+	}
+
+	// chaining value of a complete subtree of count chunks (a power of two of at least WIDE_LANES), the chunks and
+	// then every level of parents are hashed eight at a time. Parent blocks are two adjacent chaining values, which
+	// on little endian x86 are already laid out as the block bytes
+	BTTF_TARGET_AVX2 void hashSubtreeWide(const uint8_t* input, uint64_t counter, std::size_t count, uint32_t* cvs, uint32_t out[8])
+	{
+		for (std::size_t chunk = 0; chunk < count; chunk += Blake3Hasher::WIDE_LANES)
+		{
+			hashWide(input + chunk * Blake3Hasher::CHUNK_LEN, Blake3Hasher::CHUNK_LEN, Blake3Hasher::CHUNK_LEN / Blake3Hasher::BLOCK_LEN,
+				counter + chunk, 1, 0, CHUNK_START, CHUNK_END, cvs + 8 * chunk);
+		}
+
+		for (; 1 < count; count /= 2)
+		{
+			std::size_t parents = count / 2;
+			std::size_t parent = 0;
+			for (; parent + Blake3Hasher::WIDE_LANES <= parents; parent += Blake3Hasher::WIDE_LANES)
+			{
+				hashWide(reinterpret_cast<const uint8_t*>(cvs + 16 * parent), Blake3Hasher::BLOCK_LEN, 1, 0, 0, PARENT, 0, 0, cvs + 8 * parent);
+			}
+			for (; parent < parents; parent++)
+			{
+				uint32_t cv[16];
+				parentCv(cvs + 16 * parent, cvs + 16 * parent + 8, 0, cv);
+				std::memcpy(cvs + 8 * parent, cv, 8 * sizeof(uint32_t));
+			}
+		}
+		std::memcpy(out, cvs, 8 * sizeof(uint32_t));
+	}
+
+	bool hasAvx2()
+	{
+#if defined(_MSC_VER)
+		// AVX2 needs the CPU flag and the OS saving the YMM registers
+		int info[4];
+		__cpuid(info, 1);
+		if (0 == (info[2] & (1 << 27)) || 0 == (info[2] & (1 << 28)) || 6 != (_xgetbv(0) & 6))
+		{
+			return false;
+		}
+		__cpuidex(info, 7, 0);
+		return 0 != (info[1] & (1 << 5));
+#else
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+#endif
+} // anonymous namespace
+
+/**
+* Name: Blake3Hasher::Blake3Hasher
+* Description: Constructor, starts with an empty first chunk
+*/
+Blake3Hasher::Blake3Hasher() :
+	m_cvStackLen(0)
+{
+	startChunk(0);
+}
+
+/**
+* Name: Blake3Hasher::startChunk
+* Description: Reset the chunk state for the next chunk
+* @Param counter - index of the chunk
+*/
+void Blake3Hasher::startChunk(uint64_t counter)
+{
+	std::memcpy(m_chunkCv, IV, sizeof(IV));
+	m_chunkCounter = counter;
+	std::memset(m_block, 0, sizeof(m_block));
+	m_blockLen = 0;
+	m_blocksCompressed = 0;
+}
+
+/**
+* Name: Blake3Hasher::pushChunk
+* Description: Add chaining value of a completed chunk or complete subtree, merging every completed pair of
+*              subtrees on the way
+* @Param chunkCv - chaining value of the chunk or subtree
+* @Param totalChunks - number of chunks completed so far, counted in units of the subtree size
+*/
+void Blake3Hasher::pushChunk(const uint32_t chunkCv[8], uint64_t totalChunks)
+{
+	uint32_t cv[16];
+	std::memcpy(cv, chunkCv, 8 * sizeof(uint32_t));
+
+	// every trailing zero bit of the chunk count closes one subtree
+	while (0 == (totalChunks & 1))
+	{
+		m_cvStackLen--;
+		parentCv(m_cvStack[m_cvStackLen], cv, 0, cv);
+		totalChunks >>= 1;
+	}
+
+	std::memcpy(m_cvStack[m_cvStackLen], cv, 8 * sizeof(uint32_t));
+	m_cvStackLen++;
+}
+
+/**
+* Name: Blake3Hasher::update
+* Description: Feed next part of the data to the digest
+* @Param data - pointer to data
+* @Param size - data size in bytes
+*/
+bool Blake3Hasher::update(const void* data, std::size_t size)
+{
+	const uint8_t* input = static_cast<const uint8_t*>(data);
+#if defined(BTTF_BLAKE3_AVX2)
+	static const bool avx2 = hasAvx2();
+#endif
+	while (0 < size)
+	{
+		// whole chunks followed by more input are never the root, they are hashed side by side
+#if defined(BTTF_BLAKE3_AVX2)
+		// with AVX2 the largest run of whole chunks which forms a complete subtree at the chunk counter is hashed
+		// as one, its parents are merged eight at a time as well
+		if (avx2 && 0 == m_blockLen && 0 == m_blocksCompressed && WIDE_LANES * CHUNK_LEN < size)
+		{
+			std::size_t count = SUBTREE_CHUNKS;
+			while (count * CHUNK_LEN >= size || 0 != (m_chunkCounter & (count - 1)))
+			{
+				count /= 2;
+			}
+
+			if (WIDE_LANES <= count)
+			{
+				uint32_t cv[8];
+				hashSubtreeWide(input, m_chunkCounter, count, &m_subtreeCvs[0][0], cv);
+				pushChunk(cv, (m_chunkCounter + count) / count);
+				startChunk(m_chunkCounter + count);
+
+				input += count * CHUNK_LEN;
+				size -= count * CHUNK_LEN;
+				continue;
+			}
+		}
+#endif
+		if (0 == m_blockLen && 0 == m_blocksCompressed && LANES * CHUNK_LEN < size)
+		{
+			uint32_t cvs[LANES][8];
+			hashChunks(input, m_chunkCounter, cvs);
+			for (std::size_t lane = 0; lane < LANES; lane++)
+			{
+				pushChunk(cvs[lane], m_chunkCounter + 1);
+				startChunk(m_chunkCounter + 1);
+			}
+
+			input += LANES * CHUNK_LEN;
+			size -= LANES * CHUNK_LEN;
+			continue;
+		}
+
+		// the last block of a chunk is compressed only once more input proves it is not the final one
+		if (BLOCK_LEN == m_blockLen)
+		{
+			if (CHUNK_LEN / BLOCK_LEN - 1 == m_blocksCompressed)
+			{
+				uint32_t out[16];
+				compress(m_chunkCv, m_block, BLOCK_LEN, m_chunkCounter, CHUNK_END | (0 == m_blocksCompressed ? CHUNK_START : 0), out);
+				pushChunk(out, m_chunkCounter + 1);
+				startChunk(m_chunkCounter + 1);
+				continue;
+			}
+			else
+			{
+				uint32_t out[16];
+				compress(m_chunkCv, m_block, BLOCK_LEN, m_chunkCounter, 0 == m_blocksCompressed ? CHUNK_START : 0, out);
+				std::memcpy(m_chunkCv, out, 8 * sizeof(uint32_t));
+				m_blocksCompressed++;
+				std::memset(m_block, 0, sizeof(m_block));
+				m_blockLen = 0;
+			}
+		}
+
+		std::size_t take = std::min(BLOCK_LEN - m_blockLen, size);
+		std::memcpy(m_block + m_blockLen, input, take);
+		m_blockLen += take;
+		input += take;
+		size -= take;
+	}
+	return true;
+}
+
+/**
+* Name: Blake3Hasher::finalDigest
+* Description: Finish digest
+*/
+Digest Blake3Hasher::finalDigest()
+{
+	uint32_t flags = CHUNK_END | (0 == m_blocksCompressed ? CHUNK_START : 0);
+	uint32_t out[16];
+
+	if (0 == m_cvStackLen)
+	{
+		compress(m_chunkCv, m_block, m_blockLen, m_chunkCounter, flags | ROOT, out);
+	}
+	else
+	{
+		compress(m_chunkCv, m_block, m_blockLen, m_chunkCounter, flags, out);
+		for (std::size_t i = m_cvStackLen; 0 < i; i--)
+		{
+			parentCv(m_cvStack[i - 1], out, 1 == i ? ROOT : 0, out);
+		}
+	}
+
+	Digest digest;
+	digest.size = 32;
+	for (int i = 0; i < 8; i++)
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			digest.bytes[4 * i + j] = static_cast<unsigned char>(out[i] >> (8 * j));
+		}
+	}
+	return digest;
+}
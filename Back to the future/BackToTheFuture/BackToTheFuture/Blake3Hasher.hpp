@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Hasher.hpp"
+
+/**
+* Name: Blake3Hasher
+* Description: BLAKE3 (hash mode, 32 byte output). Input is split into 1 KiB chunks whose chaining values
+*              are merged into a binary tree on a stack, as in the reference implementation. Runs of whole chunks
+*              are compressed eight at a time with AVX2 when the CPU has it, four at a time with SSE2 otherwise.
+*/
+class Blake3Hasher : public IHasher
+{
+public:
+	Blake3Hasher();
+	bool update(const void* data, std::size_t size) override;
+	Digest finalDigest() override;
+
+	static constexpr std::size_t BLOCK_LEN = 64;
+	static constexpr std::size_t CHUNK_LEN = 1024;
+	// chunks hashed side by side, WIDE_LANES with AVX2
+	static constexpr std::size_t LANES = 4;
+	static constexpr std::size_t WIDE_LANES = 8;
+	// largest subtree hashed as one with AVX2
+	static constexpr std::size_t SUBTREE_CHUNKS = 256;
+
+private:
+	void startChunk(uint64_t counter);
+	void pushChunk(const uint32_t chunkCv[8], uint64_t totalChunks);
+
+	// chunk in progress
+	uint32_t m_chunkCv[8];
+	uint64_t m_chunkCounter;
+	uint8_t m_block[BLOCK_LEN];
+	std::size_t m_blockLen;
+	std::size_t m_blocksCompressed;
+
+	// chaining values of completed subtrees, one per level
+	uint32_t m_cvStack[54][8];
+	std::size_t m_cvStackLen;
+
+	// chunk and parent chaining values of the subtree being hashed
+	uint32_t m_subtreeCvs[SUBTREE_CHUNKS][8];
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+* Name: ByteReader
+* Description: Bounds-checked little endian and varint reader over a memory span, a failed read sets ok() to false and returns 0.
+*              Positions are absolute archive offsets, the span starts at 'base'.
+*/
+class ByteReader
+{
+public:
+	ByteReader(const char* data, std::size_t size, uint64_t base = 0) :
+		m_data(reinterpret_cast<const unsigned char*>(data)), m_size(size), m_base(base) {}
+
+	bool ok() const { return m_ok; }
+	uint64_t position() const { return m_base + m_pos; }
+
+	void seek(uint64_t position)
+	{
+		if (position < m_base || position - m_base > m_size)
+		{
+			m_ok = false;
+			return;
+		}
+		m_pos = static_cast<std::size_t>(position - m_base);
+	}
+
+	const char* bytes(std::size_t count)
+	{
+		if (!m_ok || count > m_size - m_pos)
+		{
+			m_ok = false;
+			return nullptr;
+		}
+		const char* data = reinterpret_cast<const char*>(m_data + m_pos);
+		m_pos += count;
+		return data;
+	}
+
+	uint32_t u32() { return load<uint32_t>(); }
+	uint64_t u64() { return load<uint64_t>(); }
+
+	// LEB128, 7 bits per byte with the high bit set on all but the last byte
+	uint64_t varint()
+	{
+		uint64_t v = 0;
+		for (int shift = 0; m_ok && shift < 64 && m_pos < m_size; shift += 7)
+		{
+			unsigned char byte = m_data[m_pos++];
+			v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			if (0 == (byte & 0x80))
+			{
+				return v;
+			}
+		}
+		m_ok = false;
+		return 0;
+	}
+
+private:
+	template <typename T>
+	T load()
+	{
+		const unsigned char* p = reinterpret_cast<const unsigned char*>(bytes(sizeof(T)));
+		if (!p)
+		{
+			return 0;
+		}
+
+		T v = 0;
+		for (std::size_t i = 0; i < sizeof(T); i++)
+		{
+			v |= static_cast<T>(p[i]) << (8 * i);
+		}
+		return v;
+	}
+
+	const unsigned char* m_data;
+	std::size_t m_size;
+	uint64_t m_base;
+	std::size_t m_pos = 0;
+	bool m_ok = true;
+};
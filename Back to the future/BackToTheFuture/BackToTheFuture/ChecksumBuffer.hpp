@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <streambuf>
+
+#include "Crc32c.hpp"
+
+/**
+* Name: ChecksumBuffer
+* Description: Output buffer which keeps the CRC-32C and size of everything written to it and forwards it to the
+*              target, a null target only checks
+*/
+class ChecksumBuffer : public std::streambuf
+{
+public:
+	explicit ChecksumBuffer(std::streambuf* target) :
+		m_target(target), m_crc(0), m_size(0) {}
+
+	uint32_t crc() const { return m_crc; }
+	uint64_t size() const { return m_size; }
+
+protected:
+	std::streamsize xsputn(const char* data, std::streamsize count) override
+	{
+		if (m_target && count != m_target->sputn(data, count))
+		{
+			return 0;
+		}
+		m_crc = crc32c(m_crc, data, static_cast<std::size_t>(count));
+		m_size += static_cast<uint64_t>(count);
+		return count;
+	}
+
+	int_type overflow(int_type ch) override
+	{
+		if (traits_type::eq_int_type(ch, traits_type::eof()))
+		{
+			return traits_type::not_eof(ch);
+		}
+
+		char c = traits_type::to_char_type(ch);
+		return 1 == xsputn(&c, 1) ? ch : traits_type::eof();
+	}
+
+private:
+	std::streambuf* m_target;
+	uint32_t m_crc;
+	uint64_t m_size;
+};
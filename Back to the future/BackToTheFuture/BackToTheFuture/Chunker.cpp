@@ -0,0 +1,111 @@
+#include "Chunker.hpp"
+#include "Logger.hpp"
+
+#include <array>
+
+namespace
+{
+	constexpr std::size_t MAX_CHUNK_SIZE = 64 << 20;
+
+	// fixed seed, chunk boundaries are part of the archive and must be the same on every build
+	constexpr std::array<uint64_t, 256> makeGearTable()
+	{
+		std::array<uint64_t, 256> table{};
+		uint64_t state = 0x42544d41524344ULL;
+		for (std::size_t i = 0; i < table.size(); i++)
+		{
+			state += 0x9E3779B97F4A7C15ULL;
+			uint64_t z = state;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+			table[i] = z ^ (z >> 31);
+		}
+		return table;
+	}
+
+	constexpr std::array<uint64_t, 256> GEAR = makeGearTable();
+
+	// gear hash shifts left, so only the high bits depend on the whole 64 byte window
+	uint64_t highMask(unsigned bits)
+	{
+		return 0 == bits ? 0 : ~0ULL << (64 - bits);
+	}
+
+	unsigned log2Floor(std::size_t value)
+	{
+		unsigned bits = 0;
+		while (value >>= 1)
+		{
+			bits++;
+		}
+		return bits;
+	}
+} // anonymous namespace
+
+/**
+* Name: Chunker::Chunker
+* Description: Constructor, FastCDC with normalized chunking around the average size
+* @Param params - min, average and max chunk size
+*/
+Chunker::Chunker(const ChunkerParams& params) :
+	m_params(params)
+{
+	unsigned bits = log2Floor(params.avgSize);
+	m_maskS = highMask(bits + 1);
+	m_maskL = highMask(bits - 1);
+}
+
+/**
+* Name: Chunker::cut
+* Description: Find length of the next chunk, data must hold maxSize bytes unless it is the end of file
+* @Param data - data starting at the chunk begin
+* @Param size - available data size
+*/
+std::size_t Chunker::cut(const char* data, std::size_t size) const
+{
+	if (size <= m_params.minSize)
+	{
+		return size;
+	}
+
+	std::size_t end = std::min(size, m_params.maxSize);
+	std::size_t normal = std::min(end, m_params.avgSize);
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+
+	uint64_t fingerprint = 0;
+	std::size_t i = m_params.minSize;
+	for (; i < normal; i++)
+	{
+		fingerprint = (fingerprint << 1) + GEAR[bytes[i]];
+		if (0 == (fingerprint & m_maskS))
+		{
+			return i + 1;
+		}
+	}
+
+	for (; i < end; i++)
+	{
+		fingerprint = (fingerprint << 1) + GEAR[bytes[i]];
+		if (0 == (fingerprint & m_maskL))
+		{
+			return i + 1;
+		}
+	}
+
+	return end;
+}
+
+/**
+* Name: Chunker::validate
+* Description: Check that chunk sizes are usable
+* @Param params - min, average and max chunk size
+*/
+bool Chunker::validate(const ChunkerParams& params)
+{
+	if (64 > params.minSize || params.minSize >= params.avgSize || params.avgSize >= params.maxSize || MAX_CHUNK_SIZE < params.maxSize)
+	{
+		LOG(Error, "Invalid chunk sizes %zu:%zu:%zu.", params.minSize, params.avgSize, params.maxSize);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "Codec.hpp"
+#include "Hasher.hpp"
+
+struct ChunkerParams
+{
+	std::size_t minSize = 16 << 10;
+	std::size_t avgSize = 64 << 10;
+	std::size_t maxSize = 256 << 10;
+};
+
+struct ChunkInfo
+{
+	Digest digest;
+	uint64_t size;
+	uint64_t compressedSize;
+	CodecId codec;
+	// blob is primed with the archive dictionary
+	bool dictionary = false;
+	// CRC-32C of the uncompressed content
+	uint32_t crc = 0;
+	// every byte is zero, the blob is stored as a hole
+	bool zero = false;
+};
+
+class Chunker
+{
+public:
+	explicit Chunker(const ChunkerParams& params);
+	std::size_t cut(const char* data, std::size_t size) const;
+	const ChunkerParams& params() const { return m_params; }
+
+	static bool validate(const ChunkerParams& params);
+
+private:
+	const ChunkerParams m_params;
+	uint64_t m_maskS;
+	uint64_t m_maskL;
+};
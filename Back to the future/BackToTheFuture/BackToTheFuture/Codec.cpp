@@ -0,0 +1,150 @@
+#include "Codec.hpp"
+#include "Logger.hpp"
+#include "Lz4Codec.hpp"
+#include "ZlibCodec.hpp"
+#include "ZstdCodec.hpp"
+
+namespace
+{
+	/**
+	* Name: StoredCodec
+	* Description: Copies data as it is, used for incompressible blobs
+	*/
+	class StoredCodec : public ICodec
+	{
+	public:
+		CodecId id() const override { return CodecId::Stored; }
+		int defaultLevel() const override { return 0; }
+		int fastLevel() const override { return 0; }
+		int minLevel() const override { return 0; }
+		int maxLevel() const override { return 0; }
+
+		bool beginCompress(int, bool, bool) override { return true; }
+
+		int64_t compress(const char* data, std::size_t size, bool, std::ostream& ostream) override
+		{
+			ostream.write(data, static_cast<std::streamsize>(size));
+			return ostream ? static_cast<int64_t>(size) : -1;
+		}
+
+		bool beginDecompress(bool) override { return true; }
+
+		bool decompress(const char* data, std::size_t size, std::ostream& ostream) override
+		{
+			ostream.write(data, static_cast<std::streamsize>(size));
+			return static_cast<bool>(ostream);
+		}
+
+		bool finished() const override { return true; }
+	};
+} // anonymous namespace
+
+/**
+* Name: createCodec
+* Description: Create codec backend, nullptr when it is not built in
+* @Param id - codec id
+* @Param chunkSize - size of the codec output buffer
+*/
+std::unique_ptr<ICodec> createCodec(CodecId id, std::size_t chunkSize)
+{
+	switch (id)
+	{
+	case CodecId::Stored:
+		return std::make_unique<StoredCodec>();
+	case CodecId::Zlib:
+		return std::make_unique<ZlibCodec>(chunkSize);
+#if defined(BTTF_WITH_ZSTD)
+	case CodecId::Zstd:
+		return std::make_unique<ZstdCodec>(chunkSize);
+#endif
+#if defined(BTTF_WITH_LZ4)
+	case CodecId::Lz4:
+		return std::make_unique<Lz4Codec>(chunkSize);
+#endif
+	default:
+		LOG(Error, "Codec %u is not available in this build.", static_cast<uint32_t>(id));
+		return nullptr;
+	}
+}
+
+/**
+* Name: isCodecAvailable
+* Description: Check whether codec backend is built in
+* @Param id - codec id
+*/
+bool isCodecAvailable(CodecId id)
+{
+	switch (id)
+	{
+	case CodecId::Stored:
+	case CodecId::Zlib:
+		return true;
+#if defined(BTTF_WITH_ZSTD)
+	case CodecId::Zstd:
+		return true;
+#endif
+#if defined(BTTF_WITH_LZ4)
+	case CodecId::Lz4:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+/**
+* Name: codecSupportsDictionary
+* Description: Check whether codec backend is built in and can prime blobs with a shared dictionary
+* @Param id - codec id
+*/
+bool codecSupportsDictionary(CodecId id)
+{
+	return isCodecAvailable(id) && (CodecId::Zlib == id || CodecId::Zstd == id);
+}
+
+/**
+* Name: isCodecLevelValid
+* Description: Check whether the codec is built in and accepts the level, DEFAULT_LEVEL always fits
+* @Param params - codec and level
+*/
+bool isCodecLevelValid(const CodecParams& params)
+{
+	std::unique_ptr<ICodec> codec = isCodecAvailable(params.id) ? createCodec(params.id, 0) : nullptr;
+	return codec && (CodecParams::DEFAULT_LEVEL == params.level || (codec->minLevel() <= params.level && params.level <= codec->maxLevel()));
+}
+
+/**
+* Name: parseCodecName
+* Description: Map codec name used on the command line to codec id
+* @Param name - codec name
+* @Param id - output codec id
+*/
+bool parseCodecName(const std::string& name, CodecId& id)
+{
+	for (CodecId candidate : { CodecId::Stored, CodecId::Zlib, CodecId::Zstd, CodecId::Lz4 })
+	{
+		if (name == codecName(candidate))
+		{
+			id = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+* Name: codecName
+* Description: Codec name used on the command line
+* @Param id - codec id
+*/
+const char* codecName(CodecId id)
+{
+	switch (id)
+	{
+	case CodecId::Stored: return "store";
+	case CodecId::Zlib: return "zlib";
+	case CodecId::Zstd: return "zstd";
+	case CodecId::Lz4: return "lz4";
+	default: return "unknown";
+	}
+}
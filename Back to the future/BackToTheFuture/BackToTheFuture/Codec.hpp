@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+// blob encoding stored in the archive, values must never change
+enum class CodecId : uint32_t
+{
+	Stored = 0,
+	Zlib = 1,
+	Zstd = 2,
+	Lz4 = 3,
+};
+
+struct CodecParams
+{
+	CodecId id = CodecId::Zlib;
+	int level = DEFAULT_LEVEL;
+	bool longRange = false;
+
+	static constexpr int DEFAULT_LEVEL = -1000;
+};
+
+/**
+* Name: ICodec
+* Description: Streaming compression backend. One blob is produced by beginCompress followed by compress calls,
+*              the last one with 'last' set; it is read back by beginDecompress followed by decompress calls.
+*              Codecs which support it can prime every blob with a dictionary shared by the whole archive.
+*/
+class ICodec
+{
+public:
+	virtual ~ICodec() = default;
+
+	virtual CodecId id() const = 0;
+	virtual int defaultLevel() const = 0;
+	virtual int fastLevel() const = 0;
+	virtual int minLevel() const = 0;
+	virtual int maxLevel() const = 0;
+
+	virtual bool setDictionary(const char*, std::size_t) { return false; }
+	virtual bool hasDictionary() const { return false; }
+
+	virtual bool beginCompress(int level, bool longRange, bool dictionary) = 0;
+	virtual int64_t compress(const char* data, std::size_t size, bool last, std::ostream& ostream) = 0;
+
+	virtual bool beginDecompress(bool dictionary) = 0;
+	virtual bool decompress(const char* data, std::size_t size, std::ostream& ostream) = 0;
+	virtual bool finished() const = 0;
+};
+
+std::unique_ptr<ICodec> createCodec(CodecId id, std::size_t chunkSize);
+bool isCodecAvailable(CodecId id);
+bool codecSupportsDictionary(CodecId id);
+bool isCodecLevelValid(const CodecParams& params);
+bool parseCodecName(const std::string& name, CodecId& id);
+const char* codecName(CodecId id);
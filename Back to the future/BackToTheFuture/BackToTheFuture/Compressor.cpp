@@ -1,7 +1,28 @@
 #include "Compressor.hpp"
+#include "AsyncFile.hpp"
+#include "Crc32c.hpp"
+#include "Hasher.hpp"
 #include "Logger.hpp"
+#include "Stats.hpp"
 
-#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	// bits per byte of order-0 entropy, compressed media and archives are above 7.9
+	constexpr double STORE_ENTROPY = 7.9;
+	constexpr double FAST_ENTROPY = 7.5;
+	// files of a solid block are announced to the kernel this many files ahead
+	constexpr std::size_t PREFETCH_FILES = 8;
+
+	// every byte is zero, stops at the first other byte
+	bool isZero(const char* data, std::size_t size)
+	{
+		return 0 < size && '\0' == data[0] && 0 == std::memcmp(data, data + 1, size - 1);
+	}
+} // anonymous namespace
 
 /**
 * Name: Compressor::Compressor
@@ -9,144 +30,575 @@
 * @Param chunkSize - chunk size
 */
 Compressor::Compressor(std::size_t chunkSize) :
-	m_CHUNK(chunkSize), inBuffer(chunkSize), outBuffer(chunkSize) {}
+	m_CHUNK(chunkSize), inBuffer(chunkSize), m_entropyCheck(true), m_hash(HashId::Sha256), m_dictionaryLimit(0), m_directIo(false), m_failed(false) {}
+
+/**
+* Name: Compressor::setCodec
+* Description: Select codec and level used for new blobs, fails when the codec is not built in or the level is out of its range
+* @Param params - codec, level (DEFAULT_LEVEL picks the codec default) and long range mode
+*/
+bool Compressor::setCodec(const CodecParams& params)
+{
+	ICodec* codec = getCodec(params.id);
+	if (!codec)
+	{
+		return false;
+	}
+
+	if (!isCodecLevelValid(params))
+	{
+		LOG(Error, "Invalid %s level %d, the codec takes %d to %d.", codecName(params.id), params.level, codec->minLevel(), codec->maxLevel());
+		return false;
+	}
+
+	m_codecParams = params;
+	if (CodecParams::DEFAULT_LEVEL == m_codecParams.level)
+	{
+		m_codecParams.level = codec->defaultLevel();
+	}
+	return true;
+}
+
+/**
+* Name: Compressor::setDictionary
+* Description: Set dictionary shared by the blobs of an archive, codecs which cannot use it ignore it
+* @Param dictionary - dictionary content, empty disables it
+* @Param blobLimit - largest blob primed with the dictionary
+*/
+void Compressor::setDictionary(const std::vector<char>& dictionary, uint64_t blobLimit)
+{
+	m_dictionary = dictionary;
+	m_dictionaryLimit = dictionary.empty() ? 0 : blobLimit;
+	for (std::unique_ptr<ICodec>& codec : m_codecs)
+	{
+		if (codec && !m_dictionary.empty())
+		{
+			codec->setDictionary(m_dictionary.data(), m_dictionary.size());
+		}
+	}
+}
+
+/**
+* Name: Compressor::getCodec
+* Description: Codec backend owned by this compressor, nullptr when it is not built in
+* @Param id - codec id
+*/
+ICodec* Compressor::getCodec(CodecId id)
+{
+	std::size_t slot = static_cast<std::size_t>(id);
+	if (slot >= m_codecs.size())
+	{
+		LOG(Error, "Unknown codec %u.", static_cast<uint32_t>(id));
+		return nullptr;
+	}
+
+	if (!m_codecs[slot])
+	{
+		m_codecs[slot] = createCodec(id, m_CHUNK);
+		if (m_codecs[slot] && !m_dictionary.empty())
+		{
+			m_codecs[slot]->setDictionary(m_dictionary.data(), m_dictionary.size());
+		}
+	}
+	return m_codecs[slot].get();
+}
 
 /**
 * Name: Compressor::compressFileToStream
-* Description: Compress file, chunk by chunk, to stream using zlib
+* Description: Compress file range, chunk by chunk, to stream as one blob using selected codec, returns false on failure.
+*              Incompressible data is stored as it is, a range of zeros only is flagged in the chunk.
 * @Param path - absolute path to file
 * @Param ostream - output stream
+* @Param chunk - output digest, size, compressed size and encoding of the range
+* @Param offset - first byte of the range
+* @Param length - range length, the range ends earlier at the end of the file
 */
-uint64_t Compressor::compressFileToStream(const fs::path& path, std::ostream& ostream)
+bool Compressor::compressFileToStream(const fs::path& path, std::ostream& ostream, ChunkInfo& chunk, uint64_t offset, uint64_t length)
 {
 	LOG(Info, "Entry.");
 
-	std::ifstream inFile(path, std::ios::binary);
+	InputFile inFile(path, m_directIo);
 	if (!inFile)
 	{
 		LOG(Error, "Cannot open file %s.", path.string().c_str());
-		return 0;
+		return false;
 	}
 
-	z_stream zStream{};
+	if (0 != offset && !inFile.seekg(static_cast<std::streamoff>(offset)))
+	{
+		LOG(Error, "Seekg failed %s.", path.string().c_str());
+		return false;
+	}
 
-	if (Z_OK != deflateInit(&zStream, Z_BEST_COMPRESSION))
+	std::unique_ptr<IHasher> hasher = createHasher(m_hash);
+	if (!hasher)
 	{
-		LOG(Error, "deflateInit failed.");
-		return 0;
+		return false;
 	}
 
-	auto deflateaGuard = std::unique_ptr<z_stream, decltype(&deflateEnd)>(
-		&zStream,
-		&deflateEnd
-	);
+	uint64_t remaining = length;
+	std::streamsize readBytes = readChunk(inFile, *hasher, remaining);
+	if (0 > readBytes)
+	{
+		LOG(Error, "Read error %s.", path.string().c_str());
+		return false;
+	}
 
-	uint64_t totalOut = 0;
-	int flush = Z_NO_FLUSH;
+	// the first chunk decides for the whole range
+	int level = m_codecParams.level;
+	chunk.codec = selectCodec(inBuffer.data(), static_cast<std::size_t>(readBytes), level);
+	chunk.size = 0;
+	chunk.compressedSize = 0;
+	chunk.crc = 0;
+	chunk.zero = isZero(inBuffer.data(), static_cast<std::size_t>(readBytes));
+
+	ICodec* backend = getCodec(chunk.codec);
+	if (!backend)
+	{
+		m_failed = true;
+		return false;
+	}
 
-	while (inFile)
+	// only blobs which are small as a whole gain from the dictionary
+	bool whole = inFile.eof() || remaining == static_cast<uint64_t>(readBytes);
+	chunk.dictionary = whole && static_cast<uint64_t>(readBytes) <= m_dictionaryLimit && backend->hasDictionary();
+	if (!backend->beginCompress(level, m_codecParams.longRange, chunk.dictionary))
 	{
-		inFile.read(reinterpret_cast<char*>(inBuffer.data()), m_CHUNK);
-		std::streamsize readBytes = inFile.gcount();
-		if (0 >= readBytes)
+		m_failed = true;
+		return false;
+	}
+
+	while (true)
+	{
+		chunk.size += static_cast<uint64_t>(readBytes);
+		remaining -= static_cast<uint64_t>(readBytes);
+
+		bool last = inFile.eof() || 0 == remaining;
+		int64_t written = encode(*backend, inBuffer.data(), static_cast<std::size_t>(readBytes), last, chunk.crc, ostream);
+		if (0 > written)
+		{
+			m_failed = true;
+			return false;
+		}
+		chunk.compressedSize += static_cast<uint64_t>(written);
+
+		if (last)
 		{
 			break;
 		}
 
-		flush = inFile.eof() ? Z_FINISH : Z_NO_FLUSH;
+		readBytes = readChunk(inFile, *hasher, remaining);
+		if (0 > readBytes)
+		{
+			LOG(Error, "Read error %s.", path.string().c_str());
+			return false;
+		}
+		chunk.zero = chunk.zero && (0 == readBytes || isZero(inBuffer.data(), static_cast<std::size_t>(readBytes)));
+	}
+
+	chunk.digest = hasher->finalDigest();
+
+	LOG(Info, "Exit.");
+	return !chunk.digest.empty();
+}
+
+/**
+* Name: Compressor::compressFilesToStream
+* Description: Compress files one after another as a single blob (solid block), so small files share the codec
+*              setup and window. Unreadable files get an empty digest and no bytes in the block.
+* @Param paths - absolute paths to files
+* @Param ostream - output stream
+* @Param block - output digest, size, compressed size and encoding of the whole block
+* @Param members - output digest and size of every file, in the order of paths
+*/
+bool Compressor::compressFilesToStream(const std::vector<fs::path>& paths, std::ostream& ostream, ChunkInfo& block, std::vector<ChunkInfo>& members)
+{
+	LOG(Info, "Entry.");
+
+	std::unique_ptr<IHasher> blockHasher = createHasher(m_hash);
+	if (!blockHasher)
+	{
+		return false;
+	}
 
-		zStream.next_in = reinterpret_cast<Bytef*>(inBuffer.data());
-		zStream.avail_in = static_cast<uInt>(readBytes);
+	ICodec* backend = nullptr;
+	std::size_t buffered = 0;
+	block.size = 0;
+	block.compressedSize = 0;
+	block.crc = 0;
 
-		do
+	// files are gathered in inBuffer, the first full buffer decides the codec for the whole block
+	auto flush = [&](bool last)
 		{
-			zStream.next_out = reinterpret_cast<Bytef*>(outBuffer.data());
-			zStream.avail_out = static_cast<uInt>(m_CHUNK);
+			if (!backend)
+			{
+				int level = m_codecParams.level;
+				block.codec = selectCodec(inBuffer.data(), buffered, level);
+				backend = getCodec(block.codec);
+				if (!backend || !backend->beginCompress(level, m_codecParams.longRange, false))
+				{
+					m_failed = true;
+					return false;
+				}
+			}
 
-			if (Z_STREAM_ERROR == deflate(&zStream, flush))
+			hash(*blockHasher, inBuffer.data(), buffered);
+			int64_t written = encode(*backend, inBuffer.data(), buffered, last, block.crc, ostream);
+			if (0 > written)
 			{
-				LOG(Error, "Deflate error.");
-				return 0;
+				m_failed = true;
+				return false;
 			}
 
-			uInt have = static_cast<uInt>(m_CHUNK) - zStream.avail_out;
-			ostream.write(reinterpret_cast<char*>(outBuffer.data()), have);
-			totalOut += have;
-		} while (0 == zStream.avail_out);
+			block.size += buffered;
+			block.compressedSize += static_cast<uint64_t>(written);
+			buffered = 0;
+			return true;
+		};
+
+	// small files are read one after another, the kernel reads the next ones meanwhile
+	for (std::size_t i = 0; i < paths.size() && i < PREFETCH_FILES; i++)
+	{
+		prefetchFile(paths[i]);
 	}
 
+	for (std::size_t i = 0; i < paths.size(); i++)
+	{
+		const fs::path& path = paths[i];
+		if (i + PREFETCH_FILES < paths.size())
+		{
+			prefetchFile(paths[i + PREFETCH_FILES]);
+		}
+
+		members.push_back(ChunkInfo{ Digest(), 0, 0, CodecId::Stored });
+		ChunkInfo& member = members.back();
+
+		InputFile inFile(path);
+		std::unique_ptr<IHasher> fileHasher = createHasher(m_hash);
+		if (!inFile || !fileHasher)
+		{
+			LOG(Error, "Cannot open file %s.", path.string().c_str());
+			continue;
+		}
+
+		while (inFile)
+		{
+			if (m_CHUNK == buffered && !flush(false))
+			{
+				return false;
+			}
+
+			std::size_t readBytes = read(inFile, inBuffer.data() + buffered, m_CHUNK - buffered);
+			if (inFile.bad())
+			{
+				LOG(Error, "Read error %s.", path.string().c_str());
+				return false;
+			}
+
+			hash(*fileHasher, inBuffer.data() + buffered, readBytes);
+			buffered += readBytes;
+			member.size += readBytes;
+		}
+		member.digest = fileHasher->finalDigest();
+	}
+
+	if (!flush(true))
+	{
+		return false;
+	}
+
+	for (ChunkInfo& member : members)
+	{
+		member.codec = block.codec;
+	}
+	block.digest = blockHasher->finalDigest();
+
 	LOG(Info, "Exit.");
-	return totalOut;
+	return !block.digest.empty();
 }
 
 /**
-* Name: Compressor::decompresStreamToFile
-* Description: decompres file stream to file
-* @Param path - absolute path to file
-* @Param ostream - output stream
+* Name: Compressor::readChunk
+* Description: Read next chunk of the file into inBuffer, returns number of bytes or -1 on read error
+* @Param inFile - input file
+* @Param hasher - digest fed with the chunk
+* @Param limit - maximum number of bytes to read
 */
-void Compressor::decompresStreamToFile(std::istream& istream, uint64_t compressedSize, const fs::path& outPath)
+std::streamsize Compressor::readChunk(std::istream& inFile, IHasher& hasher, uint64_t limit)
 {
-	LOG(Info, "Entry.");
-
-	z_stream zStream{};
-	if (Z_OK != inflateInit(&zStream))
+	std::size_t readBytes = read(inFile, inBuffer.data(), static_cast<std::size_t>(std::min<uint64_t>(m_CHUNK, limit)));
+	if (inFile.bad())
 	{
-		LOG(Error, "InflateInit failed.");
-		return;
+		return -1;
 	}
 
-	auto inflateGuard = std::unique_ptr<z_stream, decltype(&inflateEnd)>(
-		&zStream,
-		&inflateEnd
-	);
+	hash(hasher, inBuffer.data(), readBytes);
+	return static_cast<std::streamsize>(readBytes);
+}
 
-	std::ofstream outFile(outPath, std::ios::binary);
-	if (!outFile)
+/**
+* Name: Compressor::read
+* Description: Read up to size bytes, counts the bytes and the time waited for them
+* @Param inFile - input file
+* @Param data - destination
+* @Param size - maximum number of bytes
+*/
+std::size_t Compressor::read(std::istream& inFile, char* data, std::size_t size)
+{
+	Stats::Timer timer(Stat::ReadNanos);
+	inFile.read(data, static_cast<std::streamsize>(size));
+	std::size_t readBytes = static_cast<std::size_t>(inFile.gcount());
+	Stats::add(Stat::ReadBytes, readBytes);
+	return readBytes;
+}
+
+/**
+* Name: Compressor::hash
+* Description: Feed data to a digest, counts the bytes and the time
+* @Param hasher - digest
+* @Param data - data
+* @Param size - data size
+*/
+void Compressor::hash(IHasher& hasher, const char* data, std::size_t size)
+{
+	if (0 == size)
 	{
-		LOG(Error, "Cannot create output file %s.", outPath.string().c_str());
 		return;
 	}
+	Stats::Timer timer(Stat::HashNanos);
+	hasher.update(data, size);
+	Stats::add(Stat::HashBytes, size);
+}
 
-	uint64_t remaining = compressedSize;
+/**
+* Name: Compressor::encode
+* Description: Compress data with the codec and add it to the blob checksum, counts the bytes in and out and the time
+* @Param backend - codec with a started stream
+* @Param data - data
+* @Param size - data size
+* @Param last - data ends the stream
+* @Param crc - running CRC-32C of the blob
+* @Param ostream - output stream
+*/
+int64_t Compressor::encode(ICodec& backend, const char* data, std::size_t size, bool last, uint32_t& crc, std::ostream& ostream)
+{
+	Stats::Timer timer(Stat::CompressNanos);
+	crc = crc32c(crc, data, size);
+	int64_t written = backend.compress(data, size, last, ostream);
+	if (0 <= written)
+	{
+		Stats::add(Stat::CompressIn, size);
+		Stats::add(Stat::CompressOut, static_cast<uint64_t>(written));
+	}
+	return written;
+}
 
-	while (0 < remaining)
+/**
+* Name: Compressor::selectCodec
+* Description: Pick blob encoding from the byte entropy of a data sample. Already compressed data (media,
+*              archives) is stored, nearly random data gets the fastest level of the codec, everything else the selected one.
+* @Param data - data sample
+* @Param size - sample size
+* @Param level - output codec level
+*/
+CodecId Compressor::selectCodec(const char* data, std::size_t size, int& level)
+{
+	level = m_codecParams.level;
+	if (!m_entropyCheck || 0 == size || CodecId::Stored == m_codecParams.id)
 	{
-		int toRead = static_cast<int>(std::min<uint64_t>(m_CHUNK, remaining));
+		return m_codecParams.id;
+	}
 
-		istream.read(reinterpret_cast<char*>(inBuffer.data()), toRead);
-		int got = static_cast<int>(istream.gcount());
-		if (0 >= got)
+	uint64_t histogram[256] = {};
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+	for (std::size_t i = 0; i < size; i++)
+	{
+		histogram[bytes[i]]++;
+	}
+
+	double entropy = 0.0;
+	for (uint64_t count : histogram)
+	{
+		if (0 != count)
 		{
-			LOG(Error, "Unexpected EOF.");
-			return;
+			double p = static_cast<double>(count) / static_cast<double>(size);
+			entropy -= p * std::log2(p);
 		}
+	}
 
-		remaining -= got;
+	// bits per byte
+	if (STORE_ENTROPY <= entropy)
+	{
+		return CodecId::Stored;
+	}
 
-		zStream.next_in = reinterpret_cast<Bytef*>(inBuffer.data());
-		zStream.avail_in = got;
+	if (FAST_ENTROPY <= entropy)
+	{
+		level = std::min(level, getCodec(m_codecParams.id)->fastLevel());
+	}
+	return m_codecParams.id;
+}
 
-		do
+/**
+* Name: Compressor::compressChunksToStream
+* Description: Split file into content defined chunks and compress each one as independent stream
+* @Param path - absolute path to file
+* @Param chunker - chunk boundary finder
+* @Param ostream - output stream, receives compressed chunks one after another
+* @Param fileHasher - digest of the whole file
+* @Param chunks - output list of chunks with their digests and sizes
+*/
+bool Compressor::compressChunksToStream(const fs::path& path, const Chunker& chunker, std::ostream& ostream, IHasher& fileHasher, std::vector<ChunkInfo>& chunks)
+{
+	LOG(Info, "Entry.");
+
+	InputFile inFile(path, m_directIo);
+	if (!inFile)
+	{
+		LOG(Error, "Cannot open file %s.", path.string().c_str());
+		return false;
+	}
+
+	const std::size_t maxSize = chunker.params().maxSize;
+	std::vector<char> window(2 * maxSize);
+	std::size_t begin = 0;
+	std::size_t end = 0;
+
+	while (true)
+	{
+		// keep at least maxSize bytes ahead, so the chunker never cuts early in the middle of the file
+		if (inFile && end - begin < maxSize)
 		{
-			zStream.next_out = reinterpret_cast<Bytef*>(outBuffer.data());
-			zStream.avail_out = static_cast<uInt>(m_CHUNK);
+			std::copy(window.begin() + begin, window.begin() + end, window.begin());
+			end -= begin;
+			begin = 0;
 
-			int ret = inflate(&zStream, Z_NO_FLUSH);
-			if (0 > ret)
+			std::size_t readBytes = read(inFile, window.data() + end, window.size() - end);
+			if (inFile.bad())
 			{
-				LOG(Error, "Inflate error.");
-				return;
+				LOG(Error, "Read error %s.", path.string().c_str());
+				return false;
 			}
 
-			uInt have = static_cast<uInt>(m_CHUNK) - zStream.avail_out;
-			if (0 < have)
-			{
-				outFile.write(reinterpret_cast<char*>(outBuffer.data()), have);
-			}
+			hash(fileHasher, window.data() + end, readBytes);
+			end += readBytes;
+		}
+
+		if (begin == end)
+		{
+			break;
+		}
+
+		std::size_t length = chunker.cut(window.data() + begin, end - begin);
+
+		std::unique_ptr<IHasher> chunkHasher = createHasher(m_hash);
+		if (!chunkHasher)
+		{
+			return false;
+		}
+		hash(*chunkHasher, window.data() + begin, length);
+
+		int level = m_codecParams.level;
+		CodecId codec = selectCodec(window.data() + begin, length, level);
+
+		ICodec* backend = getCodec(codec);
+		bool dictionary = backend && length <= m_dictionaryLimit && backend->hasDictionary();
+		if (!backend || !backend->beginCompress(level, m_codecParams.longRange, dictionary))
+		{
+			m_failed = true;
+			return false;
+		}
+
+		uint32_t crc = 0;
+		int64_t compressedSize = encode(*backend, window.data() + begin, length, true, crc, ostream);
+		if (0 > compressedSize)
+		{
+			m_failed = true;
+			return false;
+		}
 
-		} while (0 == zStream.avail_out);
+		chunks.push_back(ChunkInfo{ chunkHasher->finalDigest(), length, static_cast<uint64_t>(compressedSize), codec, dictionary, crc });
+		begin += length;
 	}
 
 	LOG(Info, "Exit.");
+	return true;
+}
+
+/**
+* Name: Compressor::decompressStreamToStream
+* Description: decompres one blob and append it to the output stream
+* @Param istream - input stream positioned at compressed data
+* @Param compressedSize - compressed data size
+* @Param codec - blob encoding
+* @Param dictionary - blob is primed with the archive dictionary
+* @Param ostream - output stream
+*/
+bool Compressor::decompressStreamToStream(std::istream& istream, uint64_t compressedSize, CodecId codec, bool dictionary, std::ostream& ostream)
+{
+	ICodec* backend = getCodec(codec);
+	if (!backend || !backend->beginDecompress(dictionary))
+	{
+		return false;
+	}
+
+	uint64_t remaining = compressedSize;
+	while (0 < remaining)
+	{
+		istream.read(inBuffer.data(), static_cast<std::streamsize>(std::min<uint64_t>(m_CHUNK, remaining)));
+		std::streamsize got = istream.gcount();
+		if (0 >= got)
+		{
+			LOG(Error, "Unexpected EOF.");
+			return false;
+		}
+		remaining -= static_cast<uint64_t>(got);
+		Stats::add(Stat::DecompressIn, static_cast<uint64_t>(got));
+
+		Stats::Timer timer(Stat::DecompressNanos);
+		if (!backend->decompress(inBuffer.data(), static_cast<std::size_t>(got), ostream))
+		{
+			return false;
+		}
+	}
+
+	// a frame cut short inflates without an error, only its end is missing
+	if (!backend->finished())
+	{
+		LOG(Error, "Truncated %s blob.", codecName(codec));
+		return false;
+	}
+	return static_cast<bool>(ostream);
+}
+
+/**
+* Name: Compressor::decompressBufferToStream
+* Description: decompres one blob straight from memory (e.g. mapped archive) and append it to the output stream
+* @Param data - compressed data
+* @Param compressedSize - compressed data size
+* @Param codec - blob encoding
+* @Param dictionary - blob is primed with the archive dictionary
+* @Param ostream - output stream
+*/
+bool Compressor::decompressBufferToStream(const char* data, uint64_t compressedSize, CodecId codec, bool dictionary, std::ostream& ostream)
+{
+	ICodec* backend = getCodec(codec);
+	if (!backend || !backend->beginDecompress(dictionary))
+	{
+		return false;
+	}
+
+	Stats::Timer timer(Stat::DecompressNanos);
+	Stats::add(Stat::DecompressIn, compressedSize);
+	if (!backend->decompress(data, static_cast<std::size_t>(compressedSize), ostream))
+	{
+		return false;
+	}
+
+	if (!backend->finished())
+	{
+		LOG(Error, "Truncated %s blob.", codecName(codec));
+		return false;
+	}
+	return true;
 }
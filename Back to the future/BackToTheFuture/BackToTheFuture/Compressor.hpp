@@ -1,9 +1,16 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <filesystem>
-#include <fstream>
+#include <istream>
+#include <memory>
+#include <ostream>
 #include <vector>
-#include <zlib.h>
+
+#include "Chunker.hpp"
+#include "Codec.hpp"
+#include "Hasher.hpp"
 
 namespace fs = std::filesystem;
 
@@ -11,11 +18,41 @@ class Compressor
 {
 public:
 	explicit Compressor(std::size_t chunkSize = 1 << 20);
-	uint64_t compressFileToStream(const fs::path& path, std::ostream& ostream);
-	void decompresStreamToFile(std::istream& istream, uint64_t compressedSize, const fs::path& outPath);
+	bool compressFileToStream(const fs::path& path, std::ostream& ostream, ChunkInfo& chunk, uint64_t offset = 0, uint64_t length = UINT64_MAX);
+	bool compressFilesToStream(const std::vector<fs::path>& paths, std::ostream& ostream, ChunkInfo& block, std::vector<ChunkInfo>& members);
+	bool compressChunksToStream(const fs::path& path, const Chunker& chunker, std::ostream& ostream, IHasher& fileHasher, std::vector<ChunkInfo>& chunks);
+	bool decompressStreamToStream(std::istream& istream, uint64_t compressedSize, CodecId codec, bool dictionary, std::ostream& ostream);
+	bool decompressBufferToStream(const char* data, uint64_t compressedSize, CodecId codec, bool dictionary, std::ostream& ostream);
+	std::size_t chunkSize() const { return m_CHUNK; }
+	void setEntropyCheck(bool enabled) { m_entropyCheck = enabled; }
+	bool setCodec(const CodecParams& params);
+	// a codec or its output failed, unlike an unreadable input this fails the whole archive
+	bool failed() const { return m_failed; }
+	const CodecParams& codec() const { return m_codecParams; }
+	void setHash(HashId hash) { m_hash = hash; }
+	HashId hash() const { return m_hash; }
+	void setDictionary(const std::vector<char>& dictionary, uint64_t blobLimit);
+	void setDirectIo(bool enabled) { m_directIo = enabled; }
 
 private:
+	std::streamsize readChunk(std::istream& inFile, IHasher& hasher, uint64_t limit);
+	static std::size_t read(std::istream& inFile, char* data, std::size_t size);
+	static void hash(IHasher& hasher, const char* data, std::size_t size);
+	static int64_t encode(ICodec& backend, const char* data, std::size_t size, bool last, uint32_t& crc, std::ostream& ostream);
+	CodecId selectCodec(const char* data, std::size_t size, int& level);
+	ICodec* getCodec(CodecId id);
+
 	const std::size_t m_CHUNK;
 	std::vector<char> inBuffer;
-	std::vector<char> outBuffer;
+	bool m_entropyCheck;
+	CodecParams m_codecParams;
+	HashId m_hash;
+	// blobs up to the limit which fit in one chunk use the dictionary
+	std::vector<char> m_dictionary;
+	uint64_t m_dictionaryLimit;
+	// very large inputs bypass the page cache
+	bool m_directIo;
+	bool m_failed;
+	// created on first use, indexed by codec id
+	std::array<std::unique_ptr<ICodec>, 4> m_codecs;
 };
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <streambuf>
+
+/**
+* Name: CountingBuffer
+* Description: Output buffer which forwards everything to the target and counts it, so archive offsets are known
+*              without tellp, which pipes and stdout do not support
+*/
+class CountingBuffer : public std::streambuf
+{
+public:
+	explicit CountingBuffer(std::streambuf* target) :
+		m_target(target), m_position(0) {}
+
+	uint64_t position() const { return m_position; }
+
+protected:
+	std::streamsize xsputn(const char* data, std::streamsize count) override
+	{
+		std::streamsize written = m_target->sputn(data, count);
+		m_position += static_cast<uint64_t>(0 < written ? written : 0);
+		return written;
+	}
+
+	int_type overflow(int_type ch) override
+	{
+		if (traits_type::eq_int_type(ch, traits_type::eof()))
+		{
+			return traits_type::not_eof(ch);
+		}
+
+		char c = traits_type::to_char_type(ch);
+		return 1 == xsputn(&c, 1) ? ch : traits_type::eof();
+	}
+
+	int sync() override
+	{
+		return m_target->pubsync();
+	}
+
+private:
+	std::streambuf* m_target;
+	uint64_t m_position;
+};
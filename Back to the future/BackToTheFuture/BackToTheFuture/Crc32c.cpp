@@ -0,0 +1,222 @@
+#include "Crc32c.hpp"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define BTTF_CRC32C_SSE42
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define BTTF_CRC32C_ARM
+#include <arm_acle.h>
+#endif
+
+namespace
+{
+	// reflected Castagnoli polynomial
+	constexpr uint32_t POLYNOMIAL = 0x82F63B78;
+
+	using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+	// table k advances the crc of a byte followed by k zero bytes, so eight bytes are folded per step
+	Tables makeTables()
+	{
+		Tables tables{};
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; bit++)
+			{
+				crc = (crc >> 1) ^ (0 != (crc & 1) ? POLYNOMIAL : 0);
+			}
+			tables[0][i] = crc;
+		}
+
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			for (std::size_t k = 1; k < tables.size(); k++)
+			{
+				tables[k][i] = (tables[k - 1][i] >> 8) ^ tables[0][tables[k - 1][i] & 0xFF];
+			}
+		}
+		return tables;
+	}
+
+	uint32_t crc32cTable(uint32_t crc, const unsigned char* data, std::size_t size)
+	{
+		static const Tables tables = makeTables();
+
+		for (; 8 <= size; data += 8, size -= 8)
+		{
+			uint32_t low;
+			uint32_t high;
+			std::memcpy(&low, data, 4);
+			std::memcpy(&high, data + 4, 4);
+			low ^= crc;
+			crc = tables[7][low & 0xFF] ^ tables[6][(low >> 8) & 0xFF] ^ tables[5][(low >> 16) & 0xFF] ^ tables[4][low >> 24] ^
+				tables[3][high & 0xFF] ^ tables[2][(high >> 8) & 0xFF] ^ tables[1][(high >> 16) & 0xFF] ^ tables[0][high >> 24];
+		}
+
+		for (; 0 < size; data++, size--)
+		{
+			crc = (crc >> 8) ^ tables[0][(crc ^ *data) & 0xFF];
+		}
+		return crc;
+	}
+
+#if defined(BTTF_CRC32C_SSE42)
+	// the crc32 instruction has a latency of three cycles, so three independent streams of this many bytes
+	// keep it busy and are joined by shifting the earlier crcs over the later streams
+	constexpr std::size_t LONG_STREAM = 8192;
+	constexpr std::size_t SHORT_STREAM = 256;
+
+	// product of two polynomials modulo the crc polynomial, bit 31 is x^0 in the reflected order
+	uint32_t multiplyModP(uint32_t a, uint32_t b)
+	{
+		uint32_t product = 0;
+		for (uint32_t mask = 1u << 31; 0 != mask; mask >>= 1)
+		{
+			if (0 != (a & mask))
+			{
+				product ^= b;
+			}
+			b = (b >> 1) ^ (0 != (b & 1) ? POLYNOMIAL : 0);
+		}
+		return product;
+	}
+
+	// table k shifts byte k of a crc over 'bytes' zero bytes
+	using ShiftTable = std::array<std::array<uint32_t, 256>, 4>;
+
+	ShiftTable makeShiftTable(std::size_t bytes)
+	{
+		uint32_t power = 1u << 31;
+		for (std::size_t bit = 0; bit < 8 * bytes; bit++)
+		{
+			power = (power >> 1) ^ (0 != (power & 1) ? POLYNOMIAL : 0);
+		}
+
+		ShiftTable table{};
+		for (uint32_t k = 0; k < table.size(); k++)
+		{
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				table[k][i] = multiplyModP(power, i << (8 * k));
+			}
+		}
+		return table;
+	}
+
+	inline uint32_t shift(const ShiftTable& table, uint32_t crc)
+	{
+		return table[0][crc & 0xFF] ^ table[1][(crc >> 8) & 0xFF] ^ table[2][(crc >> 16) & 0xFF] ^ table[3][crc >> 24];
+	}
+
+#if !defined(_MSC_VER)
+	__attribute__((target("sse4.2")))
+#endif
+	uint64_t crc32cStreams(uint64_t crc, const unsigned char*& data, std::size_t& size, std::size_t stream, const ShiftTable& table)
+	{
+		for (; 3 * stream <= size; data += 3 * stream, size -= 3 * stream)
+		{
+			uint64_t crc1 = 0;
+			uint64_t crc2 = 0;
+			for (std::size_t i = 0; i < stream; i += 8)
+			{
+				uint64_t words[3];
+				std::memcpy(&words[0], data + i, 8);
+				std::memcpy(&words[1], data + stream + i, 8);
+				std::memcpy(&words[2], data + 2 * stream + i, 8);
+				crc = _mm_crc32_u64(crc, words[0]);
+				crc1 = _mm_crc32_u64(crc1, words[1]);
+				crc2 = _mm_crc32_u64(crc2, words[2]);
+			}
+			crc = shift(table, static_cast<uint32_t>(crc)) ^ crc1;
+			crc = shift(table, static_cast<uint32_t>(crc)) ^ crc2;
+		}
+		return crc;
+	}
+
+#if !defined(_MSC_VER)
+	__attribute__((target("sse4.2")))
+#endif
+	uint32_t crc32cHardware(uint32_t crc, const unsigned char* data, std::size_t size)
+	{
+		static const ShiftTable longShift = makeShiftTable(LONG_STREAM);
+		static const ShiftTable shortShift = makeShiftTable(SHORT_STREAM);
+
+		uint64_t crc64 = crc;
+		crc64 = crc32cStreams(crc64, data, size, LONG_STREAM, longShift);
+		crc64 = crc32cStreams(crc64, data, size, SHORT_STREAM, shortShift);
+		for (; 8 <= size; data += 8, size -= 8)
+		{
+			uint64_t word;
+			std::memcpy(&word, data, 8);
+			crc64 = _mm_crc32_u64(crc64, word);
+		}
+
+		crc = static_cast<uint32_t>(crc64);
+		for (; 0 < size; data++, size--)
+		{
+			crc = _mm_crc32_u8(crc, *data);
+		}
+		return crc;
+	}
+
+	bool hasHardware()
+	{
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		return 0 != (info[2] & (1 << 20));
+#else
+		return __builtin_cpu_supports("sse4.2");
+#endif
+	}
+#elif defined(BTTF_CRC32C_ARM)
+	uint32_t crc32cHardware(uint32_t crc, const unsigned char* data, std::size_t size)
+	{
+		for (; 8 <= size; data += 8, size -= 8)
+		{
+			uint64_t word;
+			std::memcpy(&word, data, 8);
+			crc = __crc32cd(crc, word);
+		}
+
+		for (; 0 < size; data++, size--)
+		{
+			crc = __crc32cb(crc, *data);
+		}
+		return crc;
+	}
+
+	bool hasHardware()
+	{
+		return true;
+	}
+#endif
+} // anonymous namespace
+
+/**
+* Name: crc32c
+* Description: CRC-32C of data appended to a running crc, crc32c(crc32c(0, a), b) equals the crc of a followed by b
+* @Param crc - crc of the preceding data, 0 to start
+* @Param data - data
+* @Param size - data size
+*/
+uint32_t crc32c(uint32_t crc, const void* data, std::size_t size)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	crc = ~crc;
+#if defined(BTTF_CRC32C_SSE42) || defined(BTTF_CRC32C_ARM)
+	static const bool hardware = hasHardware();
+	if (hardware)
+	{
+		return ~crc32cHardware(crc, bytes, size);
+	}
+#endif
+	return ~crc32cTable(crc, bytes, size);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli) of data appended to a running crc, start with 0. Uses the SSE4.2 crc32 instruction on three
+// interleaved streams or the ARMv8 one when the CPU has it, and a slice-by-8 table otherwise
+uint32_t crc32c(uint32_t crc, const void* data, std::size_t size);
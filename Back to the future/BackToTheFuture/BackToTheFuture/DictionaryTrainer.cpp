@@ -0,0 +1,149 @@
+#include "DictionaryTrainer.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <utility>
+
+#if defined(BTTF_WITH_ZSTD)
+#include <zdict.h>
+#endif
+
+namespace
+{
+	// content is scored by 8 byte grams, segments of 64 bytes are the unit copied into the dictionary
+	constexpr std::size_t GRAM = 8;
+	constexpr std::size_t SEGMENT = 64;
+	constexpr int TABLE_BITS = 20;
+
+	inline std::size_t gramHash(const char* data)
+	{
+		uint64_t gram;
+		std::memcpy(&gram, data, sizeof(gram));
+		return static_cast<std::size_t>((gram * 0x9E3779B97F4A7C15ULL) >> (64 - TABLE_BITS));
+	}
+
+	/**
+	* Name: trainRaw
+	* Description: Greedy cover of the grams shared by most samples. Every segment is scored by the number of samples
+	*              containing each of its grams, the best segment is taken and its grams stop counting, until the
+	*              dictionary is full. The best segments end up last, closest to the data.
+	*/
+	bool trainRaw(const std::vector<char>& samples, const std::vector<std::size_t>& sampleSizes, std::size_t capacity, std::vector<char>& dictionary)
+	{
+		// number of samples containing each gram, a sample counts once
+		std::vector<uint32_t> frequency(std::size_t(1) << TABLE_BITS, 0);
+		std::vector<uint32_t> lastSample(frequency.size(), UINT32_MAX);
+		std::vector<std::size_t> segments;
+
+		std::size_t offset = 0;
+		for (std::size_t sample = 0; sample < sampleSizes.size(); sample++)
+		{
+			std::size_t size = sampleSizes[sample];
+			for (std::size_t pos = 0; pos + GRAM <= size; pos++)
+			{
+				std::size_t hash = gramHash(samples.data() + offset + pos);
+				if (lastSample[hash] != sample)
+				{
+					lastSample[hash] = static_cast<uint32_t>(sample);
+					frequency[hash]++;
+				}
+			}
+
+			for (std::size_t pos = 0; pos + SEGMENT <= size; pos += SEGMENT)
+			{
+				segments.push_back(offset + pos);
+			}
+			offset += size;
+		}
+
+		// grams of a single sample do not help other blobs
+		auto score = [&](std::size_t segment)
+			{
+				uint64_t total = 0;
+				for (std::size_t pos = segment; pos + GRAM <= segment + SEGMENT; pos++)
+				{
+					uint32_t count = frequency[gramHash(samples.data() + pos)];
+					total += 1 < count ? count : 0;
+				}
+				return total;
+			};
+
+		std::priority_queue<std::pair<uint64_t, std::size_t>> candidates;
+		for (std::size_t segment : segments)
+		{
+			candidates.emplace(score(segment), segment);
+		}
+
+		// scores only drop, a candidate whose fresh score still beats the next one is the best
+		std::vector<std::size_t> selected;
+		while (!candidates.empty() && (selected.size() + 1) * SEGMENT <= capacity)
+		{
+			std::size_t segment = candidates.top().second;
+			candidates.pop();
+
+			uint64_t current = score(segment);
+			if (0 == current)
+			{
+				continue;
+			}
+			if (!candidates.empty() && current < candidates.top().first)
+			{
+				candidates.emplace(current, segment);
+				continue;
+			}
+
+			selected.push_back(segment);
+			for (std::size_t pos = segment; pos + GRAM <= segment + SEGMENT; pos++)
+			{
+				frequency[gramHash(samples.data() + pos)] = 0;
+			}
+		}
+
+		dictionary.clear();
+		for (auto it = selected.rbegin(); it != selected.rend(); ++it)
+		{
+			dictionary.insert(dictionary.end(), samples.begin() + *it, samples.begin() + *it + SEGMENT);
+		}
+		return !dictionary.empty();
+	}
+} // anonymous namespace
+
+/**
+* Name: trainDictionary
+* Description: Build a dictionary for small blobs from samples laid out one after another
+* @Param codec - codec the dictionary is built for
+* @Param samples - sample contents, back to back
+* @Param sampleSizes - size of every sample
+* @Param capacity - largest dictionary size
+* @Param dictionary - output dictionary
+*/
+bool trainDictionary(CodecId codec, const std::vector<char>& samples, const std::vector<std::size_t>& sampleSizes, std::size_t capacity, std::vector<char>& dictionary)
+{
+	LOG(Info, "Entry.");
+
+#if defined(BTTF_WITH_ZSTD)
+	if (CodecId::Zstd == codec)
+	{
+		dictionary.resize(capacity);
+		std::size_t size = ZDICT_trainFromBuffer(dictionary.data(), capacity, samples.data(), sampleSizes.data(), static_cast<unsigned>(sampleSizes.size()));
+		if (ZDICT_isError(size))
+		{
+			LOG(Warn, "Dictionary training failed: %s.", ZDICT_getErrorName(size));
+			dictionary.clear();
+			return false;
+		}
+		dictionary.resize(size);
+		return true;
+	}
+#endif
+
+	// deflate reaches back 32 KiB at most
+	if (CodecId::Zlib == codec)
+	{
+		capacity = std::min<std::size_t>(capacity, 32 << 10);
+	}
+	return trainRaw(samples, sampleSizes, capacity, dictionary);
+}
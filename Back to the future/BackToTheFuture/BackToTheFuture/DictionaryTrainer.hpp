@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "Codec.hpp"
+
+/**
+* Name: trainDictionary
+* Description: Build a dictionary for small blobs from samples laid out one after another. zstd gets a trained
+*              zstd dictionary, other codecs raw content made of the segments most samples have in common.
+* @Param codec - codec the dictionary is built for
+* @Param samples - sample contents, back to back
+* @Param sampleSizes - size of every sample
+* @Param capacity - largest dictionary size
+* @Param dictionary - output dictionary
+*/
+bool trainDictionary(CodecId codec, const std::vector<char>& samples, const std::vector<std::size_t>& sampleSizes, std::size_t capacity, std::vector<char>& dictionary);
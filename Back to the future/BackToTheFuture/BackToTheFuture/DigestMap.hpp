@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "Hasher.hpp"
+
+/**
+* Name: DigestMap
+* Description: Flat open addressing map keyed by binary digests. Digests are uniform already, so their first bytes
+*              are the hash. Slots hold a hash tag and the index of the entry, entries are stored densely, so probing
+*              touches one small array and there is no allocation per key.
+*/
+template <typename T>
+class DigestMap
+{
+public:
+	explicit DigestMap(std::size_t expected = 0)
+	{
+		reserve(expected);
+	}
+
+	void reserve(std::size_t count)
+	{
+		std::size_t capacity = 16;
+		while (capacity < count + count / 2)
+		{
+			capacity <<= 1;
+		}
+		if (capacity > m_slots.size())
+		{
+			rehash(capacity);
+		}
+		m_entries.reserve(count);
+	}
+
+	// stores the value when the digest is new, returns the value stored for the digest and whether it was inserted
+	std::pair<T*, bool> emplace(const Digest& key, const T& value)
+	{
+		if (3 * m_slots.size() < 4 * (m_entries.size() + 1))
+		{
+			rehash(2 * m_slots.size());
+		}
+
+		const uint64_t hash = hashOf(key);
+		std::size_t slot = probe(key, hash);
+		if (0 != m_slots[slot])
+		{
+			return { &m_entries[entryOf(m_slots[slot])].value, false };
+		}
+
+		m_entries.push_back(Entry{ key, value });
+		m_slots[slot] = (hash & TAG_MASK) | m_entries.size();
+		return { &m_entries.back().value, true };
+	}
+
+	const T* find(const Digest& key) const
+	{
+		std::size_t slot = probe(key, hashOf(key));
+		return 0 != m_slots[slot] ? &m_entries[entryOf(m_slots[slot])].value : nullptr;
+	}
+
+	std::size_t size() const { return m_entries.size(); }
+
+private:
+	// upper half of a slot is the hash tag, lower half the entry index + 1, 0 is an empty slot
+	static constexpr uint64_t TAG_MASK = 0xFFFFFFFF00000000ULL;
+
+	struct Entry
+	{
+		Digest key;
+		T value;
+	};
+
+	static uint64_t hashOf(const Digest& key)
+	{
+		// every hash gives at least 16 bytes
+		uint64_t hash;
+		std::memcpy(&hash, key.bytes, sizeof(hash));
+		return hash;
+	}
+
+	static std::size_t entryOf(uint64_t slot)
+	{
+		return static_cast<std::size_t>(slot & ~TAG_MASK) - 1;
+	}
+
+	std::size_t probe(const Digest& key, uint64_t hash) const
+	{
+		const std::size_t mask = m_slots.size() - 1;
+		for (std::size_t slot = static_cast<std::size_t>(hash) & mask; ; slot = (slot + 1) & mask)
+		{
+			uint64_t value = m_slots[slot];
+			if (0 == value || ((value & TAG_MASK) == (hash & TAG_MASK) && m_entries[entryOf(value)].key == key))
+			{
+				return slot;
+			}
+		}
+	}
+
+	void rehash(std::size_t capacity)
+	{
+		m_slots.assign(capacity, 0);
+		const std::size_t mask = capacity - 1;
+		for (std::size_t entry = 0; entry < m_entries.size(); entry++)
+		{
+			uint64_t hash = hashOf(m_entries[entry].key);
+			std::size_t slot = static_cast<std::size_t>(hash) & mask;
+			while (0 != m_slots[slot])
+			{
+				slot = (slot + 1) & mask;
+			}
+			m_slots[slot] = (hash & TAG_MASK) | (entry + 1);
+		}
+	}
+
+	std::vector<uint64_t> m_slots;
+	std::vector<Entry> m_entries;
+};
@@ -0,0 +1,148 @@
+#include "FileClone.hpp"
+#include "Logger.hpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#if defined(__linux__)
+#include <linux/fs.h>
+#endif
+#endif
+
+namespace
+{
+#if !defined(_WIN32)
+	// buffer of the copy through user space
+	constexpr std::size_t COPY_BUFFER_SIZE = 1 << 20;
+
+	// copies the rest of source to target, returns false when the kernel cannot copy between the two files
+	bool copyRange(int source, int target, uint64_t size)
+	{
+#if defined(__linux__)
+		uint64_t copied = 0;
+		while (copied < size)
+		{
+			ssize_t done = copy_file_range(source, nullptr, target, nullptr, static_cast<std::size_t>(size - copied), 0);
+			if (0 > done && EINTR == errno)
+			{
+				continue;
+			}
+			if (0 >= done)
+			{
+				// nothing copied yet, so the caller can start over with another method
+				return 0 == copied ? false : 0 == done;
+			}
+			copied += static_cast<uint64_t>(done);
+		}
+		return true;
+#else
+		(void)source;
+		(void)target;
+		(void)size;
+		return false;
+#endif
+	}
+
+	bool copyBuffered(int source, int target)
+	{
+		std::vector<char> buffer(COPY_BUFFER_SIZE);
+		while (true)
+		{
+			ssize_t got = ::read(source, buffer.data(), buffer.size());
+			if (0 > got && EINTR == errno)
+			{
+				continue;
+			}
+			if (0 >= got)
+			{
+				return 0 == got;
+			}
+			for (ssize_t written = 0; written < got;)
+			{
+				ssize_t done = ::write(target, buffer.data() + written, static_cast<std::size_t>(got - written));
+				if (0 > done && EINTR == errno)
+				{
+					continue;
+				}
+				if (0 > done)
+				{
+					return false;
+				}
+				written += done;
+			}
+		}
+	}
+#endif
+} // anonymous namespace
+
+/**
+* Name: cloneFile
+* Description: Create target as a copy of source. A reflink is tried first, so on btrfs, XFS and ReFS the copy
+*              shares the blocks of the source and costs a metadata update only. Otherwise the kernel copies the
+*              bytes, and where it cannot either they go through a buffer. An existing target is replaced.
+* @Param source - absolute path to the file to copy
+* @Param target - absolute path to the copy
+* @Param method - output how the copy was made
+*/
+bool cloneFile(const fs::path& source, const fs::path& target, CloneMethod& method)
+{
+#if defined(_WIN32)
+	// CopyFile clones blocks on ReFS and Dev Drive volumes by itself
+	method = CloneMethod::KernelCopy;
+	if (!CopyFileW(source.c_str(), target.c_str(), FALSE))
+	{
+		LOG(Error, "Cannot copy %s to %s, error %lu.", source.string().c_str(), target.string().c_str(), GetLastError());
+		return false;
+	}
+	return true;
+#else
+	int in = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+	if (0 > in)
+	{
+		LOG(Error, "Cannot open %s.", source.string().c_str());
+		return false;
+	}
+	int out = ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (0 > out)
+	{
+		LOG(Error, "Cannot create output file %s.", target.string().c_str());
+		::close(in);
+		return false;
+	}
+
+	struct stat st;
+	bool done = 0 == fstat(in, &st);
+#if defined(FICLONE)
+	if (done && 0 == ioctl(out, FICLONE, in))
+	{
+		method = CloneMethod::Reflink;
+	}
+	else
+#endif
+	if (done && copyRange(in, out, static_cast<uint64_t>(st.st_size)))
+	{
+		method = CloneMethod::KernelCopy;
+	}
+	else if (done)
+	{
+		method = CloneMethod::Copy;
+		done = 0 == ftruncate(out, 0) && 0 == lseek(in, 0, SEEK_SET) && 0 == lseek(out, 0, SEEK_SET) && copyBuffered(in, out);
+	}
+
+	::close(in);
+	done = 0 == ::close(out) && done;
+	if (!done)
+	{
+		LOG(Error, "Cannot copy %s to %s.", source.string().c_str(), target.string().c_str());
+	}
+	return done;
+#endif
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+// how a copy of a file was made, from cheapest to most expensive
+enum class CloneMethod
+{
+	// the copy shares the extents of the source (FICLONE, block cloning)
+	Reflink,
+	// the kernel copied the bytes (copy_file_range, CopyFile)
+	KernelCopy,
+	// the bytes went through a buffer of this process
+	Copy,
+};
+
+bool cloneFile(const fs::path& source, const fs::path& target, CloneMethod& method);
@@ -1,15 +1,156 @@
 ﻿#include "FileManager.hpp"
+#include "AsyncFile.hpp"
+#include "ChecksumBuffer.hpp"
+#include "CountingBuffer.hpp"
+#include "DictionaryTrainer.hpp"
+#include "DigestMap.hpp"
+#include "FileClone.hpp"
+#include "Hasher.hpp"
+#include "ByteReader.hpp"
 #include "Logger.hpp"
+#include "OrderedQueue.hpp"
+#include "RangeBuffer.hpp"
+#include "ScanCache.hpp"
+#include "SparseFile.hpp"
+#include "SpillBuffer.hpp"
+#include "Stats.hpp"
+#include "StreamReader.hpp"
+#include "WorkerPool.hpp"
 
 #include <openssl/evp.h>
-#include <zlib.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
 #include <unordered_map>
 
 namespace
 {
     constexpr char MAGIC[4] = { 'T','M','A','R' };
-    constexpr uint32_t VERSION = 2;
+    constexpr uint32_t VERSION = 12;
+    // archives of the first format, before the footer, are still read: magic, version, blob and file counts, then
+    // blobs (SHA-256, sizes, zlib data) and fixed size file records. Only the first half of each SHA-256 was written
+    constexpr uint32_t LEGACY_VERSION = 2;
+    constexpr std::size_t LEGACY_HEADER_SIZE = 4 + 4 + 4 + 4;
+    constexpr std::size_t LEGACY_BLOB_HEADER = 32 + 8 + 8;
+    constexpr std::size_t LEGACY_FILE_RECORD = 4 + 32 + 8 + 4 + 8;
+    constexpr std::size_t LEGACY_DIGEST_BYTES = 16;
+    constexpr std::size_t HEADER_SIZE = 4 + 4 + 4;
+    constexpr std::size_t FOOTER_SIZE = 8 + 8 + 4 + 4 + 4;
+    // archive path which stands for stdout when packing and stdin when unpacking
+    const fs::path STDIO_PATH = "-";
+    // split files are restored in parts of about this size on separate workers
+    constexpr uint64_t RESTORE_SEGMENT_SIZE = 4 << 20;
+    // files up to this size go into solid blocks in solid mode
+    constexpr uint64_t SOLID_FILE_LIMIT = 64 << 10;
+    // blobs up to this size use the trained dictionary, which is trained on about 100 times its size of samples
+    constexpr uint64_t DICTIONARY_BLOB_LIMIT = 64 << 10;
+    constexpr std::size_t DICTIONARY_SAMPLE_FACTOR = 100;
+    // smallest encoded file record and blob index entry besides the digest, bounds the counts in the header
+    constexpr uint64_t MIN_FILE_RECORD = 6;
+    constexpr uint64_t MIN_BLOB_RECORD = 6;
+    // pack takes the scanned files in batches of this many, at most two further batches wait for it
+    constexpr std::size_t SCAN_BATCH_FILES = 32768;
+    constexpr std::size_t SCAN_QUEUE_BATCHES = 2;
+    // holes of split files from this size on are skipped instead of read, zero blobs are written from this buffer
+    constexpr uint64_t MIN_HOLE = 64 << 10;
+    const char ZERO_BYTES[64 << 10] = {};
+    // compressed blobs in flight share this much memory, each up to a block, the rest goes to spill files.
+    // The blob the archive writer waits for keeps up to one block of the larger size at most in memory instead
+    constexpr uint64_t IN_FLIGHT_MEMORY = 256 << 20;
+    constexpr uint64_t MAX_HEAD_BLOB_MEMORY = 64 << 20;
+
+    // signed deltas as varints, small steps in both directions stay one byte
+    inline uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+    inline int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+    // records of the blob area, in the order a single forward pass restores them. Blobs, members and references
+    // between a file record and its end record are the content of that file, blobs outside are the dictionary
+    // or a solid block whose member records follow
+    enum class Record : uint8_t
+    {
+        // blob area ends, the tables follow
+        End = 0,
+        // digest, original size, compressed size, codec, flags, crc and the compressed data
+        Blob,
+        // solid block, offset and size of a member blob inside the inflated block
+        Member,
+        // index of an earlier blob with the same content
+        Reference,
+        // path, readonly flag and time of the file whose content follows
+        File,
+        // 0 and size and digest of the file just written, or 1 when it was skipped
+        FileEnd,
+    };
+
+    /**
+    * Name: BackgroundScan
+    * Description: Runs the scanner on a thread of its own, so pack compresses the first batches while later
+    *              directories are still being read. An empty batch marks the end of the scan, failed() tells
+    *              after it whether the scan could not run, a missing or unreadable root for example.
+    */
+    class BackgroundScan
+    {
+    public:
+        BackgroundScan(FileScanner& scanner, const fs::path& root, std::size_t threads, std::size_t batchFiles) :
+            m_batches(SCAN_QUEUE_BATCHES)
+        {
+            m_thread = std::thread([this, &scanner, root, threads, batchFiles]()
+                {
+                    bool scanned = scanner.scanBatches(root, threads, batchFiles, [this](ScanBatch&& batch)
+                        {
+                            push(std::move(batch));
+                            return !m_cancelled;
+                        });
+                    m_failed = !scanned && !m_cancelled;
+                    push(ScanBatch());
+                });
+        }
+
+        ~BackgroundScan()
+        {
+            // a pack which stops early drains the queue, so the scan thread is not left waiting on it
+            m_cancelled = true;
+            while (!m_finished)
+            {
+                next();
+            }
+            m_thread.join();
+        }
+
+        BackgroundScan(const BackgroundScan&) = delete;
+        BackgroundScan& operator=(const BackgroundScan&) = delete;
+
+        ScanBatch next()
+        {
+            ScanBatch batch = m_batches.pop();
+            m_finished = batch.empty();
+            return batch;
+        }
+
+        bool failed() const { return m_failed; }
+
+    private:
+        void push(ScanBatch&& batch)
+        {
+            m_batches.reserve(m_pushed);
+            m_batches.push(m_pushed++, std::move(batch));
+        }
+
+        OrderedQueue<ScanBatch> m_batches;
+        std::size_t m_pushed = 0;
+        std::atomic<bool> m_cancelled{ false };
+        std::atomic<bool> m_failed{ false };
+        bool m_finished = false;
+        std::thread m_thread;
+    };
 } // anonymous namespace
 
 
@@ -23,74 +164,848 @@ FileManager::FileManager(Compressor& compresor, FileScanner& scanner) :
 
 /**
 * Name: FileManager::Pack
-* Description: Pack files from the root directory into an archive
+* Description: Pack files from the root directory into an archive. Files arrive from the scanner in batches and each
+*              batch is compressed while the next one is scanned, so memory follows the batch, not the tree.
 * @Param root - absolute path to root directory
 * @Param archivePath - absolute path to the output archive location
+* @Param options - pack options
 */
-void FileManager::Pack(const fs::path& root, const fs::path& archivePath)
+bool FileManager::Pack(const fs::path& root, const fs::path& archivePath, const PackOptions& options)
 {
     LOG(Info, "Entry.");
 
-    auto files = m_scanner.scanFiles(root);
+    WorkerPool pool(options.threads);
+    BackgroundScan scan(m_scanner, root, pool.size(), SCAN_BATCH_FILES);
+    ScanBatch batch = scan.next();
+
+    if (scan.failed())
+    {
+        return false;
+    }
 
-    if (files.empty())
+    // an empty tree still gets an archive, with an empty file table
+    if (batch.empty())
     {
         LOG(Info, "No file to compress.");
-        return;
     }
 
-    std::ofstream ofStream(archivePath, std::ios::binary);
-    if (!ofStream)
+    // one compressor per worker and one for the writer, which compresses stale duplicates while the workers run
+    std::vector<Compressor> compressors;
+    compressors.reserve(pool.size() + 1);
+    for (std::size_t i = 0; i <= pool.size(); i++)
     {
-        LOG(Error, "Cannot create archive.");
-        return;
+        compressors.emplace_back(m_compressor.chunkSize());
+        compressors.back().setEntropyCheck(options.entropyCheck);
+        compressors.back().setHash(options.hash);
+        compressors.back().setDirectIo(options.directIo);
+        if (!isCodecAvailable(options.codec.id))
+        {
+            LOG(Error, "Codec %s is not available in this build.", codecName(options.codec.id));
+            return false;
+        }
+        if (!compressors.back().setCodec(options.codec))
+        {
+            return false;
+        }
     }
 
-    std::unordered_map<std::string, fs::path> uniqueFiles;
-    for (FileMetadata& file : files)
+    if (!isHashAvailable(options.hash))
+    {
+        LOG(Error, "Hash %s is not available in this build.", hashName(options.hash));
+        return false;
+    }
+    const std::size_t digestBytes = digestSize(options.hash);
+
+    // the archive is written strictly forward, so it can go to stdout as well
+    const bool toStdout = STDIO_PATH == archivePath;
+    std::unique_ptr<OutputFile> archiveFile;
+    if (!toStdout)
     {
-        uniqueFiles[file.sha256] = fs::absolute(root / file.path);
+        archiveFile = std::make_unique<OutputFile>(archivePath);
+        if (!*archiveFile)
+        {
+            LOG(Error, "Cannot create archive.");
+            return false;
+        }
     }
+    CountingBuffer archive(toStdout ? std::cout.rdbuf() : archiveFile->rdbuf());
+    std::ostream ofStream(&archive);
+
+    // a pack which fails leaves no archive behind, a truncated one would only look damaged later
+    auto discardArchive = [&]()
+        {
+            if (archiveFile)
+            {
+                archiveFile->close();
+                std::error_code error;
+                fs::remove(archivePath, error);
+            }
+        };
 
+    // blob and file counts are known after the fused hash and compress pass, they go into the footer
     ofStream.write(MAGIC, 4);
     write_u32(ofStream, VERSION);
-    write_u32(ofStream, static_cast<uint32_t>(uniqueFiles.size()));
-    write_u32(ofStream, static_cast<uint32_t>(files.size()));
+    write_u32(ofStream, static_cast<uint32_t>(options.hash));
+
+    struct CompressedSegment
+    {
+        Digest digest;
+        std::vector<ChunkInfo> chunks;
+        std::unique_ptr<SpillBuffer> data;
+        // whole block of a solid segment, chunks are then its member files
+        ChunkInfo block;
+    };
+
+    // files above the block size are split into independent blocks, so a single huge file is compressed on all workers
+    // and can be inflated in parallel or from the middle later, every block is a blob of its own
+    struct Segment
+    {
+        std::size_t file;
+        uint64_t offset;
+        uint64_t length;
+        // range inside a hole of a sparse file, it is all zeros and not read
+        bool hole = false;
+    };
+
+    // files of the current batch
+    std::vector<FileMetadata> files;
+
+    const uint64_t blockSize = options.chunking ? 0 : options.blockSize;
+    auto splitFile = [&](std::size_t file, std::vector<Segment>& segments)
+        {
+            if (0 == blockSize || files[file].size <= blockSize)
+            {
+                segments.push_back(Segment{ file, 0, UINT64_MAX });
+                return;
+            }
+
+            // holes of sparse files are split like data, so their blocks share one zero blob and are never read
+            std::vector<Extent> extents;
+            if (findDataExtents(root / files[file].path, files[file].size, MIN_HOLE, extents))
+            {
+                uint64_t position = 0;
+                auto addRange = [&](uint64_t end, bool hole)
+                    {
+                        for (; position < end; position += std::min(blockSize, end - position))
+                        {
+                            segments.push_back(Segment{ file, position, std::min(blockSize, end - position), hole });
+                        }
+                    };
+                for (const Extent& extent : extents)
+                {
+                    addRange(extent.offset, true);
+                    addRange(extent.offset + extent.length, false);
+                }
+                addRange(files[file].size, true);
+                return;
+            }
+
+            uint64_t count = (files[file].size + blockSize - 1) / blockSize;
+            for (uint64_t block = 0; block < count; block++)
+            {
+                // the last block takes whatever the file has left
+                segments.push_back(Segment{ file, block * blockSize, block + 1 < count ? blockSize : UINT64_MAX });
+            }
+        };
+
+    // digests of unchanged files come from the scan cache, later copies of the same content are not read at all.
+    // digest kind tells plain digest of the content (0) from the digest of the block digests of a split file
+    ScanCache cache(options.cachePath.empty() ? ScanCache::defaultPath(root) : options.cachePath);
+    if (CacheMode::Off != options.cache)
+    {
+        cache.load();
+    }
+
+    // every in-flight blob keeps at least two chunks and at most a block in memory, the rest waits in a spill file
+    // next to the archive. The blob the writer waits for goes to the archive right after it is done, so it may
+    // hold a whole block in any case
+    const std::size_t inFlightSegments = 2 * pool.size();
+    const uint64_t blockMemory = std::max(blockSize, options.solidBlockSize) + m_compressor.chunkSize();
+    const std::size_t memoryLimit = static_cast<std::size_t>(std::max<uint64_t>(2 * m_compressor.chunkSize(), std::min(blockMemory, IN_FLIGHT_MEMORY / inFlightSegments)));
+    const std::size_t headMemoryLimit = static_cast<std::size_t>(std::min(blockMemory, MAX_HEAD_BLOB_MEMORY));
+    const Chunker chunker(options.chunker);
+
+    // spill files sit next to the archive, or in the temp directory when the archive goes to stdout
+    fs::path spillBase = archivePath;
+    if (toStdout)
+    {
+        spillBase = fs::temp_directory_path() / ("bttf-" + std::to_string(std::random_device()()));
+    }
+
+    // queue of the batch in flight, segments compressed outside of it are written right away
+    OrderedQueue<CompressedSegment>* inFlight = nullptr;
+    auto startSegment = [&](std::size_t spillIndex)
+        {
+            CompressedSegment compressed;
+            fs::path spillPath = spillBase;
+            spillPath += ".spill" + std::to_string(spillIndex);
+            OrderedQueue<CompressedSegment>* queue = inFlight;
+            compressed.data = std::make_unique<SpillBuffer>(memoryLimit, spillPath, headMemoryLimit,
+                [queue, spillIndex]() { return !queue || queue->isNext(spillIndex); });
+            return compressed;
+        };
+
+    // holes are not read, the digest of their zeros is computed once per length
+    std::unordered_map<uint64_t, Digest> zeroDigests;
+    std::mutex zeroDigestMutex;
+    auto zeroDigest = [&](uint64_t length)
+        {
+            std::lock_guard<std::mutex> lk(zeroDigestMutex);
+            auto [digest, inserted] = zeroDigests.emplace(length, Digest());
+            if (inserted)
+            {
+                std::unique_ptr<IHasher> hasher = createHasher(options.hash);
+                for (uint64_t remaining = length; 0 < remaining;)
+                {
+                    std::size_t size = static_cast<std::size_t>(std::min<uint64_t>(sizeof(ZERO_BYTES), remaining));
+                    hasher->update(ZERO_BYTES, size);
+                    remaining -= size;
+                }
+                digest->second = hasher->finalDigest();
+            }
+            return digest->second;
+        };
+
+    // a codec which fails once fails for every blob, the pack stops instead of skipping all the files
+    std::atomic<bool> codecFailed(false);
+
+    auto compressSegment = [&](const Segment& segment, Compressor& compressor, std::size_t spillIndex)
+        {
+            CompressedSegment compressed = startSegment(spillIndex);
+            if (codecFailed)
+            {
+                return compressed;
+            }
+            if (segment.hole)
+            {
+                ChunkInfo chunk;
+                chunk.digest = zeroDigest(segment.length);
+                chunk.size = segment.length;
+                chunk.compressedSize = 0;
+                chunk.codec = CodecId::Stored;
+                chunk.zero = true;
+                compressed.digest = chunk.digest;
+                compressed.chunks.push_back(std::move(chunk));
+                return compressed;
+            }
+            std::ostream compressedData(compressed.data.get());
+
+            const fs::path path = root / files[segment.file].path;
+            if (options.chunking)
+            {
+                std::unique_ptr<IHasher> hasher = createHasher(options.hash);
+                if (compressor.compressChunksToStream(path, chunker, compressedData, *hasher, compressed.chunks) && compressedData)
+                {
+                    compressed.digest = hasher->finalDigest();
+                }
+            }
+            else
+            {
+                // whole segment is a single chunk
+                ChunkInfo chunk;
+                if (compressor.compressFileToStream(path, compressedData, chunk, segment.offset, segment.length) && compressedData)
+                {
+                    compressed.digest = chunk.digest;
+                    compressed.chunks.push_back(std::move(chunk));
+                }
+            }
+            codecFailed = codecFailed || compressor.failed();
+            return compressed;
+        };
+
+    auto compressSolidBlock = [&](const std::vector<std::size_t>& members, Compressor& compressor, std::size_t spillIndex)
+        {
+            CompressedSegment compressed = startSegment(spillIndex);
+            if (codecFailed)
+            {
+                return compressed;
+            }
+            std::ostream compressedData(compressed.data.get());
 
-    //bloobs: SHA, orginal size, compressed size, data
-    for (auto& [sha, path] : uniqueFiles)
+            std::vector<fs::path> paths;
+            paths.reserve(members.size());
+            for (std::size_t member : members)
+            {
+                paths.push_back(root / files[member].path);
+            }
+
+            if (compressor.compressFilesToStream(paths, compressedData, compressed.block, compressed.chunks) && compressedData)
+            {
+                compressed.digest = compressed.block.digest;
+            }
+            codecFailed = codecFailed || compressor.failed();
+            return compressed;
+        };
+
+    //bloobs: digest, orginal size, compressed size, codec, data
+    //blobs keep the order of the first chunk using them, so the archive does not depend on thread count
+    DigestMap<uint32_t> blobIndex;
+    std::vector<BlobEntry> blobEntries;
+    std::vector<char> copyBuffer(m_compressor.chunkSize());
+    uint64_t countedBytes = 0;
+    auto writeBlobHeader = [&](const Digest& digest, uint64_t size, uint64_t compressedSize, CodecId codec, uint32_t flags, uint32_t crc)
+        {
+            ofStream.put(static_cast<char>(Record::Blob));
+            ofStream.write(reinterpret_cast<const char*>(digest.bytes), static_cast<std::streamsize>(digestBytes));
+
+            write_u64(ofStream, size);
+            write_u64(ofStream, compressedSize);
+            write_u32(ofStream, static_cast<uint32_t>(codec));
+            write_varint(ofStream, flags);
+            write_u32(ofStream, crc);
+            blobEntries.push_back(BlobEntry{ size, compressedSize, archive.position(), codec, BlobEntry::NO_SOLID_BLOCK, flags, crc });
+        };
+
+    auto writeBlob = [&](const ChunkInfo& chunk, CompressedSegment& compressed)
+        {
+            Stats::Timer timer(Stat::WriteNanos);
+            uint64_t start = archive.position();
+            writeBlobHeader(chunk.digest, chunk.size, chunk.compressedSize, chunk.codec, chunk.dictionary ? BlobEntry::USES_DICTIONARY : 0, chunk.crc);
+            compressed.data->consume(chunk.compressedSize, &ofStream, copyBuffer);
+            Stats::add(Stat::WriteBytes, archive.position() - start);
+            countedBytes += archive.position() - start;
+        };
+
+    // a file record opens the content of a file for readers of the stream, its end record closes it
+    auto beginFile = [&](const FileMetadata& file)
+        {
+            ofStream.put(static_cast<char>(Record::File));
+            write_varint(ofStream, file.path.size());
+            ofStream.write(file.path.data(), static_cast<std::streamsize>(file.path.size()));
+            write_varint(ofStream, file.readonly ? 1 : 0);
+            write_varint(ofStream, zigzag(file.time));
+        };
+
+    auto endFile = [&](const FileMetadata& file)
+        {
+            ofStream.put(static_cast<char>(Record::FileEnd));
+            write_varint(ofStream, file.digest.empty() ? 1 : 0);
+            if (!file.digest.empty())
+            {
+                write_varint(ofStream, file.size);
+                ofStream.write(reinterpret_cast<const char*>(file.digest.bytes), static_cast<std::streamsize>(digestBytes));
+            }
+        };
+
+    auto writeReference = [&](uint32_t blob)
+        {
+            ofStream.put(static_cast<char>(Record::Reference));
+            write_varint(ofStream, blob);
+        };
+
+    auto writeChunks = [&](CompressedSegment& compressed, FileMetadata& file)
+        {
+            for (const ChunkInfo& chunk : compressed.chunks)
+            {
+                file.size += chunk.size;
+
+                auto [blob, inserted] = blobIndex.emplace(chunk.digest, static_cast<uint32_t>(blobEntries.size()));
+                file.blobs.push_back(*blob);
+                if (chunk.zero)
+                {
+                    Stats::add(Stat::HoleBytes, chunk.size);
+                }
+                if (!inserted)
+                {
+                    Stats::add(Stat::DedupBlobs, 1);
+                    Stats::add(Stat::DedupBytes, chunk.size);
+                    compressed.data->consume(chunk.compressedSize, nullptr, copyBuffer);
+                    writeReference(*blob);
+                    continue;
+                }
+
+                // zeros only, the blob keeps its size and digest but no data
+                if (chunk.zero)
+                {
+                    compressed.data->consume(chunk.compressedSize, nullptr, copyBuffer);
+                    writeBlobHeader(chunk.digest, chunk.size, 0, CodecId::Stored, BlobEntry::ZEROS, 0);
+                    continue;
+                }
+                writeBlob(chunk, compressed);
+            }
+        };
+
+    // a solid block is a blob of its own, its files become member blobs pointing into the inflated block
+    auto writeSolidBlock = [&](CompressedSegment& compressed, const std::vector<std::size_t>& members)
+        {
+            if (compressed.digest.empty())
+            {
+                for (std::size_t member : members)
+                {
+                    if (!codecFailed)
+                    {
+                        LOG(Error, "Skipping unreadable file %s.", files[member].path.c_str());
+                    }
+                    files[member].digest.clear();
+                }
+                return;
+            }
+
+            uint32_t block = static_cast<uint32_t>(blobEntries.size());
+            writeBlob(compressed.block, compressed);
+
+            uint64_t offset = 0;
+            for (std::size_t i = 0; i < members.size(); i++)
+            {
+                const ChunkInfo& member = compressed.chunks[i];
+                FileMetadata& file = files[members[i]];
+                file.digest = member.digest;
+                file.size = member.size;
+                file.blobs.clear();
+
+                uint64_t memberOffset = offset;
+                offset += member.size;
+                if (file.digest.empty())
+                {
+                    LOG(Error, "Skipping unreadable file %s.", file.path.c_str());
+                    continue;
+                }
+
+                beginFile(file);
+                auto [blob, inserted] = blobIndex.emplace(member.digest, static_cast<uint32_t>(blobEntries.size()));
+                if (inserted)
+                {
+                    blobEntries.push_back(BlobEntry{ member.size, 0, memberOffset, member.codec, block });
+                    ofStream.put(static_cast<char>(Record::Member));
+                    write_varint(ofStream, block);
+                    write_varint(ofStream, memberOffset);
+                    write_varint(ofStream, member.size);
+                }
+                else
+                {
+                    Stats::add(Stat::DedupBlobs, 1);
+                    Stats::add(Stat::DedupBytes, member.size);
+                    writeReference(*blob);
+                }
+                file.blobs.push_back(*blob);
+                endFile(file);
+                Stats::add(Stat::FilesDone, 1);
+            }
+        };
+
+    // segments of one file, popped from the queue or compressed on the spot, become its blobs and digest
+    auto writeFile = [&](FileMetadata& file, std::size_t count, const std::function<CompressedSegment()>& next)
+        {
+            file.size = 0;
+            file.blobs.clear();
+            beginFile(file);
+
+            // digest of a split file is the digest of its block digests, blocks are hashed in parallel
+            std::unique_ptr<IHasher> blockDigests = createHasher(options.hash);
+            bool readable = true;
+            for (std::size_t block = 0; block < count; block++)
+            {
+                CompressedSegment compressed = next();
+                readable = readable && !compressed.digest.empty();
+                if (!readable)
+                {
+                    continue;
+                }
+
+                if (1 == count)
+                {
+                    file.digest = compressed.digest;
+                }
+                else
+                {
+                    blockDigests->update(compressed.digest.bytes, compressed.digest.size);
+                }
+                writeChunks(compressed, file);
+            }
+
+            if (!readable)
+            {
+                if (!codecFailed)
+                {
+                    LOG(Error, "Skipping unreadable file %s.", file.path.c_str());
+                }
+                file.digest.clear();
+                endFile(file);
+                return;
+            }
+
+            if (1 < count)
+            {
+                file.digest = blockDigests->finalDigest();
+            }
+            endFile(file);
+            Stats::add(Stat::FilesDone, 1);
+        };
+
+    // file table: path front coded against the previous path (shared prefix length, suffix), digest, varint size
+    // and readonly flag, time and blob indices as deltas to the previous ones, which the scan order keeps small.
+    // It is built batch by batch in a spill buffer and copied behind the blob area at the end
+    fs::path tablePath = spillBase;
+    tablePath += ".table";
+    SpillBuffer table(memoryLimit, tablePath);
+    std::ostream tableStream(&table);
+    std::string previousPath;
+    int64_t previousTime = 0;
+    int64_t nextBlob = 0;
+    uint64_t fileCount = 0;
+    uint64_t filesTotal = 0;
+
+    // files whose content an earlier batch stored as a single blob only reference it, see STORED_EARLIER
+    constexpr std::size_t NO_DUPLICATE = SIZE_MAX;
+    constexpr std::size_t STORED_EARLIER = SIZE_MAX - 1;
+    m_scanner.setHash(options.hash);
+    bool firstBatch = true;
+    while (!batch.empty())
     {
-        char shaBin[32];
-        hexToBinSHA(shaBin, sha);
-        ofStream.write(shaBin, 32);
+        files.clear();
+        files.reserve(batch.records.size());
+        for (const ScanRecord& record : batch.records)
+        {
+            files.push_back(batch.metadata(record));
+        }
+        batch = ScanBatch();
+        filesTotal += files.size();
+        Stats::setFilesTotal(filesTotal);
+
+        // known digests are trusted before compression: cached ones, and in solid mode fresh digests of small files
+        std::vector<uint64_t> digestKinds(files.size());
+        std::vector<Digest> cachedDigests(files.size());
+        std::vector<Digest> knownDigests(files.size());
+        std::vector<bool> solid(files.size(), false);
+        std::vector<std::size_t> unhashed;
+        for (std::size_t i = 0; i < files.size(); i++)
+        {
+            solid[i] = 0 != options.solidBlockSize && files[i].size <= SOLID_FILE_LIMIT;
+            digestKinds[i] = !solid[i] && 0 != blockSize && files[i].size > blockSize ? blockSize : 0;
+            if (CacheMode::Off != options.cache && cache.lookup(files[i], options.hash, digestKinds[i], cachedDigests[i]) && CacheMode::Use == options.cache)
+            {
+                knownDigests[i] = cachedDigests[i];
+            }
+            else if (solid[i])
+            {
+                unhashed.push_back(i);
+            }
+        }
+
+        // small files are hashed up front, so every content enters a solid block only once
+        pool.run(unhashed.size(), [&](std::size_t index, std::size_t)
+            {
+                knownDigests[unhashed[index]] = m_scanner.hashFile(root / files[unhashed[index]].path);
+            });
+
+        // a copy matches digest, digest kind and size. The digest of a split file is a digest of block digests, which
+        // a small file holding those block digests shares, so the digest alone does not identify content
+        std::vector<std::size_t> duplicateOf(files.size(), NO_DUPLICATE);
+        DigestMap<std::size_t> firstWithDigest(files.size());
+        for (std::size_t i = 0; i < files.size(); i++)
+        {
+            if (knownDigests[i].empty())
+            {
+                continue;
+            }
+
+            // whole content stored as one blob by an earlier batch, the file is not read at all
+            if (0 == digestKinds[i])
+            {
+                const uint32_t* stored = blobIndex.find(knownDigests[i]);
+                if (stored && blobEntries[*stored].origSize == files[i].size)
+                {
+                    duplicateOf[i] = STORED_EARLIER;
+                    continue;
+                }
+            }
+
+            auto [first, inserted] = firstWithDigest.emplace(knownDigests[i], i);
+            if (!inserted && digestKinds[*first] == digestKinds[i] && files[*first].size == files[i].size)
+            {
+                duplicateOf[i] = *first;
+            }
+        }
+
+        std::vector<Segment> segments;
+        std::vector<std::size_t> segmentCounts(files.size(), 0);
+        for (std::size_t i = 0; i < files.size(); i++)
+        {
+            if (NO_DUPLICATE == duplicateOf[i] && !solid[i])
+            {
+                std::size_t first = segments.size();
+                splitFile(i, segments);
+                segmentCounts[i] = segments.size() - first;
+            }
+        }
+
+        // small files are ordered by extension, then by path, so similar content shares a block and its window
+        std::vector<std::size_t> solidFiles;
+        std::vector<std::string> extensions(files.size());
+        for (std::size_t i = 0; i < files.size(); i++)
+        {
+            if (solid[i] && NO_DUPLICATE == duplicateOf[i])
+            {
+                solidFiles.push_back(i);
+                extensions[i] = fs::path(files[i].path).extension().string();
+            }
+        }
+        std::stable_sort(solidFiles.begin(), solidFiles.end(), [&](std::size_t lhs, std::size_t rhs) { return extensions[lhs] < extensions[rhs]; });
+
+        std::vector<std::vector<std::size_t>> solidBlocks;
+        uint64_t solidSize = options.solidBlockSize;
+        for (std::size_t i : solidFiles)
+        {
+            if (options.solidBlockSize <= solidSize)
+            {
+                solidBlocks.emplace_back();
+                solidSize = 0;
+            }
+            solidBlocks.back().push_back(i);
+            solidSize += files[i].size;
+        }
+
+        // dictionary for small blobs, trained on a sample of the small files of the first batch which are not in
+        // solid blocks. It is the first blob, stored as it is
+        if (firstBatch && 0 != options.dictionarySize)
+        {
+            std::vector<std::size_t> candidates;
+            for (std::size_t i = 0; i < files.size(); i++)
+            {
+                if (NO_DUPLICATE == duplicateOf[i] && !solid[i] && 0 < files[i].size && files[i].size <= DICTIONARY_BLOB_LIMIT)
+                {
+                    candidates.push_back(i);
+                }
+            }
+
+            std::vector<char> dictionary;
+            if (sampleDictionary(root, files, candidates, options, dictionary))
+            {
+                for (Compressor& compressor : compressors)
+                {
+                    compressor.setDictionary(dictionary, DICTIONARY_BLOB_LIMIT);
+                }
+
+                std::unique_ptr<IHasher> hasher = createHasher(options.hash);
+                hasher->update(dictionary.data(), dictionary.size());
+
+                writeBlobHeader(hasher->finalDigest(), dictionary.size(), dictionary.size(), CodecId::Stored, BlobEntry::IS_DICTIONARY, crc32c(0, dictionary.data(), dictionary.size()));
+                ofStream.write(dictionary.data(), static_cast<std::streamsize>(dictionary.size()));
+            }
+        }
+        firstBatch = false;
+
+        // every segment is read once, hashed and compressed speculatively, duplicates are dropped by the writer.
+        // solid blocks follow the segments of the other files
+        OrderedQueue<CompressedSegment> compressedSegments(inFlightSegments);
+        inFlight = &compressedSegments;
+        pool.start(segments.size() + solidBlocks.size(), [&](std::size_t index, std::size_t worker)
+            {
+                // the segment this worker takes next round is announced to the kernel now
+                std::size_t ahead = index + pool.size();
+                if (ahead < segments.size() && !segments[ahead].hole)
+                {
+                    const Segment& next = segments[ahead];
+                    prefetchFile(root / files[next.file].path, next.offset, UINT64_MAX != next.length ? next.length : 0);
+                }
+
+                compressedSegments.reserve(index);
+                compressedSegments.push(index, index < segments.size() ?
+                    compressSegment(segments[index], compressors[worker], index) :
+                    compressSolidBlock(solidBlocks[index - segments.size()], compressors[worker], index));
+            });
+
+        // a copy shares the blobs of the first file with the same known digest, unless that one changed meanwhile.
+        // Its records come at the same place as those of a copy found only by compressing it, so the archive does not
+        // depend on the scan cache
+        auto writeDuplicate = [&](std::size_t i)
+            {
+                FileMetadata& file = files[i];
+                if (STORED_EARLIER == duplicateOf[i])
+                {
+                    const uint32_t stored = *blobIndex.find(knownDigests[i]);
+                    file.digest = knownDigests[i];
+                    file.blobs.assign(1, stored);
+                    file.size = static_cast<std::size_t>(blobEntries[stored].origSize);
+                }
+                else if (files[duplicateOf[i]].digest == knownDigests[i] && files[duplicateOf[i]].size == files[i].size)
+                {
+                    const FileMetadata& original = files[duplicateOf[i]];
+                    file.digest = original.digest;
+                    file.blobs = original.blobs;
+                    file.size = original.size;
+                }
+                else
+                {
+                    // rare case of a stale cache entry or a file changed during pack, it is compressed here after all
+                    std::vector<Segment> fileSegments;
+                    if (solid[i])
+                    {
+                        fileSegments.push_back(Segment{ i, 0, UINT64_MAX });
+                    }
+                    else
+                    {
+                        splitFile(i, fileSegments);
+                    }
+
+                    std::size_t next = 0;
+                    writeFile(file, fileSegments.size(), [&]() { return compressSegment(fileSegments[next++], compressors.back(), segments.size() + solidBlocks.size()); });
+                    return;
+                }
+
+                beginFile(file);
+                for (uint32_t blob : file.blobs)
+                {
+                    writeReference(blob);
+                }
+                endFile(file);
+                Stats::add(Stat::DedupFiles, 1);
+                Stats::add(Stat::DedupBytes, file.size);
+                Stats::add(Stat::FilesDone, 1);
+            };
+
+        // files outside of solid blocks are written in table order, their copies refer to an earlier file
+        for (std::size_t i = 0; i < files.size(); i++)
+        {
+            if (NO_DUPLICATE == duplicateOf[i] && !solid[i])
+            {
+                writeFile(files[i], segmentCounts[i], [&]() { return compressedSegments.pop(); });
+            }
+            else if (NO_DUPLICATE != duplicateOf[i] && (!solid[i] || STORED_EARLIER == duplicateOf[i]))
+            {
+                writeDuplicate(i);
+            }
+        }
 
-        uint64_t originalSize = fs::file_size(path);
-        write_u64(ofStream, originalSize);
+        for (const std::vector<std::size_t>& members : solidBlocks)
+        {
+            CompressedSegment compressed = compressedSegments.pop();
+            writeSolidBlock(compressed, members);
+        }
+
+        pool.wait();
+        inFlight = nullptr;
+
+        // copies of small files follow the solid blocks holding their content
+        for (std::size_t i = 0; i < files.size(); i++)
+        {
+            if (solid[i] && NO_DUPLICATE != duplicateOf[i] && STORED_EARLIER != duplicateOf[i])
+            {
+                writeDuplicate(i);
+            }
+        }
+
+        if (codecFailed)
+        {
+            LOG(Error, "Cannot compress with %s, the archive is not written.", codecName(options.codec.id));
+            discardArchive();
+            return false;
+        }
+
+        // a full disk or a closed pipe stops the pack at the end of the batch
+        if (!ofStream)
+        {
+            LOG(Error, "Cannot write archive.");
+            discardArchive();
+            return false;
+        }
+
+        for (std::size_t i = 0; i < files.size(); i++)
+        {
+            if (!cachedDigests[i].empty() && !files[i].digest.empty() && cachedDigests[i] != files[i].digest)
+            {
+                LOG(Warn, "Scan cache entry out of date: %s", files[i].path.c_str());
+            }
+
+            if (CacheMode::Off != options.cache)
+            {
+                cache.store(files[i], options.hash, digestKinds[i]);
+            }
+        }
 
-        std::stringstream compressedData;
-        uint64_t compressedSize = m_compressor.compressFileToStream(path, compressedData);
-        write_u64(ofStream, compressedSize);
+        files.erase(std::remove_if(files.begin(), files.end(), [](const FileMetadata& file) { return file.digest.empty(); }), files.end());
 
-        ofStream << compressedData.rdbuf();
+        for (auto& file : files)
+        {
+            std::size_t prefix = 0;
+            std::size_t limit = std::min(previousPath.size(), file.path.size());
+            while (prefix < limit && previousPath[prefix] == file.path[prefix])
+            {
+                prefix++;
+            }
+            write_varint(tableStream, prefix);
+            write_varint(tableStream, file.path.size() - prefix);
+            tableStream.write(file.path.data() + prefix, static_cast<std::streamsize>(file.path.size() - prefix));
+            previousPath = file.path;
+
+            tableStream.write(reinterpret_cast<const char*>(file.digest.bytes), static_cast<std::streamsize>(digestBytes));
+
+            write_varint(tableStream, file.size);
+            write_varint(tableStream, file.readonly ? 1 : 0);
+            write_varint(tableStream, zigzag(file.time - previousTime));
+            previousTime = file.time;
+
+            write_varint(tableStream, file.blobs.size());
+            for (uint32_t blob : file.blobs)
+            {
+                write_varint(tableStream, zigzag(static_cast<int64_t>(blob) - nextBlob));
+                nextBlob = static_cast<int64_t>(blob) + 1;
+            }
+        }
+        fileCount += files.size();
+
+        batch = scan.next();
+    }
+
+    if (CacheMode::Off != options.cache)
+    {
+        cache.save();
+    }
+
+    ofStream.put(static_cast<char>(Record::End));
+    uint64_t fileTableOffset = archive.position();
+    if (!tableStream || !table.consume(table.size(), &ofStream, copyBuffer))
+    {
+        LOG(Error, "Cannot write file table.");
+        discardArchive();
+        return false;
     }
 
-    for (auto& file : files)
+    // blob index and footer, readers jump straight to the tables without walking the blobs.
+    // Offsets are deltas to the previous blob, solid block 0 means none and n the blob n - 1, blobs which are not
+    // members end with their crc.
+    uint64_t blobIndexOffset = archive.position();
+    uint64_t previousOffset = 0;
+    for (const BlobEntry& blob : blobEntries)
     {
-        uint32_t pathLength = static_cast<uint32_t>(file.path.size());
-        write_u32(ofStream, pathLength);
-        ofStream.write(file.path.data(), pathLength);
+        write_varint(ofStream, zigzag(static_cast<int64_t>(blob.offset - previousOffset)));
+        previousOffset = blob.offset;
+        write_varint(ofStream, blob.origSize);
+        write_varint(ofStream, blob.compSize);
+        write_varint(ofStream, static_cast<uint32_t>(blob.codec));
+        write_varint(ofStream, BlobEntry::NO_SOLID_BLOCK != blob.solidBlock ? uint64_t(blob.solidBlock) + 1 : 0);
+        write_varint(ofStream, blob.flags);
+        if (BlobEntry::NO_SOLID_BLOCK == blob.solidBlock)
+        {
+            write_u32(ofStream, blob.crc);
+        }
+    }
 
-        char shaBin[32];
-        hexToBinSHA(shaBin, file.sha256);
-        ofStream.write(shaBin, 32);
+    write_u64(ofStream, fileTableOffset);
+    write_u64(ofStream, blobIndexOffset);
+    write_u32(ofStream, static_cast<uint32_t>(blobEntries.size()));
+    write_u32(ofStream, static_cast<uint32_t>(fileCount));
+    ofStream.write(MAGIC, 4);
 
-        write_u64(ofStream, file.size);
-        write_u32(ofStream, file.readonly ? 1 : 0);
-        write_u64(ofStream, file.time);
+    // blobs counted their bytes as they were written, records and tables are the rest
+    Stats::add(Stat::WriteBytes, archive.position() - countedBytes);
+    {
+        Stats::Timer timer(Stat::WriteNanos);
+        ofStream.flush();
+        if (archiveFile)
+        {
+            archiveFile->close();
+        }
     }
 
-    ofStream.close();
+    if (!ofStream || (archiveFile && !*archiveFile))
+    {
+        LOG(Error, "Cannot write archive.");
+        discardArchive();
+        return false;
+    }
     LOG(Info, "Exit.");
+    return true;
 }
 
 /**
@@ -98,151 +1013,1684 @@ void FileManager::Pack(const fs::path& root, const fs::path& archivePath)
 * Description: Unpackl files from the archive into an directory
 * @Param archivePath - absolute path to the archive
 * @Param destRoot - absolute path to the root directory
+* @Param options - unpack options
 */
-void FileManager::Unpack(const fs::path& archivePath, const fs::path& destRoot)
+bool FileManager::Unpack(const fs::path& archivePath, const fs::path& destRoot, const UnpackOptions& options)
 {
     LOG(Info, "Entry.");
 
-    std::ifstream ifstream(archivePath, std::ios::binary);
-    if (!ifstream)
+    if (STDIO_PATH == archivePath)
     {
-        LOG(Error, "Cannot open archive.");
-        return;
+        if (!unpackStream(std::cin, destRoot))
+        {
+            return false;
+        }
+        LOG(Info, "Exit.");
+        return true;
+    }
+
+    MappedFile mapping;
+    std::vector<BlobEntry> blobs;
+    std::vector<FileMetadata> files;
+    if (!openArchive(archivePath, mapping, blobs, files))
+    {
+        return false;
+    }
+
+    std::vector<const FileMetadata*> selected;
+    selected.reserve(files.size());
+    for (const FileMetadata& file : files)
+    {
+        selected.push_back(&file);
+    }
+
+    if (!restoreFiles(archivePath, mapping, blobs, selected, destRoot, options))
+    {
+        return false;
     }
 
+    LOG(Info, "Exit.");
+    return true;
+}
+
+/**
+* Name: FileManager::unpackStream
+* Description: Restore an archive in one forward pass over its blob area, e.g. from stdin. Files are written as
+*              their records arrive, content seen before is copied back from the file it was restored into, so
+*              memory holds at most the dictionary and one inflated solid block.
+* @Param istream - archive stream positioned at the header
+* @Param destRoot - absolute path to the root directory
+*/
+bool FileManager::unpackStream(std::istream& istream, const fs::path& destRoot)
+{
+    StreamReader reader(istream);
     char magic[4];
-    ifstream.read(magic, 4);
-    if (memcmp(magic, MAGIC, 4) != 0)
+    if (!reader.bytes(magic, 4) || memcmp(magic, MAGIC, 4) != 0)
     {
         LOG(Error, "Invalid archive magic.");
-        return;
+        return false;
     }
 
-    uint32_t version = read_u32(ifstream);
-    uint32_t numBlobs = read_u32(ifstream);
-    uint32_t numFiles = read_u32(ifstream);
+    uint32_t version = reader.u32();
+    if (LEGACY_VERSION == version)
+    {
+        LOG(Error, "Archives of version %u have no stream layout, unpack them from a file.", version);
+        return false;
+    }
+    if (VERSION != version)
+    {
+        LOG(Error, "Unsupported archive version %u.", version);
+        return false;
+    }
 
-    struct Blob
+    uint32_t hash = reader.u32();
+    std::size_t digestBytes = digestSize(static_cast<HashId>(hash));
+    if (0 == digestBytes)
     {
-        uint64_t origSize;
-        uint64_t compSize;
-        std::streampos pos;
-    };
+        LOG(Error, "Unknown archive hash %u.", hash);
+        return false;
+    }
 
-    std::unordered_map<std::string, Blob> blobMap(numBlobs);
+    // the output directory exists afterwards even when the archive holds no file
+    if (!createDirectories(destRoot))
+    {
+        return false;
+    }
 
-    //read blobs
-    for (uint32_t i = 0; i < numBlobs; i++)
+    // where the content of every blob can be read back: restored file, offset and size.
+    // The dictionary and solid blocks are not part of a file, members point into the block in memory
+    constexpr std::size_t NO_FILE = SIZE_MAX;
+    struct BlobLocation
     {
-        std::ostringstream shaHex;
-        binToHexSHA(ifstream, shaHex);
+        std::size_t file;
+        uint64_t offset;
+        uint64_t size;
+        // blob of zeros, skipped in the output file
+        bool zero = false;
+    };
+    std::vector<BlobLocation> locations;
+    std::vector<fs::path> restored;
+    // files which were skipped while packing keep their content under a temporary name until the end
+    std::vector<fs::path> skipped;
 
-        uint64_t origSize = read_u64(ifstream);
-        uint64_t compSize = read_u64(ifstream);
-        std::streampos pos = ifstream.tellg();
+    Compressor compressor(m_compressor.chunkSize());
+    std::vector<char> dictionary;
+    std::string solidData;
+    std::size_t solidBlock = NO_FILE;
 
-        ifstream.seekg(static_cast<std::streamoff>(compSize), std::ios::cur);
-        if (!ifstream)
+    std::unique_ptr<OutputFile> outFile;
+    FileMetadata file{};
+    uint64_t written = 0;
+    bool sparse = false;
+    // the last restored file is not complete until its end record was handled
+    bool incomplete = false;
+    std::vector<char> copyBuffer(m_compressor.chunkSize());
+
+    // zeros are seeked over, the file is extended to its size when it is closed
+    auto skipZeros = [&](uint64_t size)
         {
-            LOG(Error, "Corrupted archive while skipping blob data.");
-            return;
-        }
+            if (!sparse)
+            {
+                markSparse(restored.back());
+                sparse = true;
+            }
+            written += size;
+            Stats::add(Stat::HoleBytes, size);
+            return static_cast<bool>(outFile->seekp(static_cast<std::streamoff>(written)));
+        };
 
-        blobMap.emplace(shaHex.str(), Blob{ origSize, compSize, pos });
-    }
+    // copies content restored earlier, the file being written is flushed first in case it is the source
+    auto copyBlob = [&](const BlobLocation& location)
+        {
+            outFile->flush();
+            std::ifstream source(restored[location.file], std::ios::binary);
+            source.seekg(static_cast<std::streamoff>(location.offset));
+            for (uint64_t remaining = location.size; 0 < remaining;)
+            {
+                std::size_t size = static_cast<std::size_t>(std::min<uint64_t>(copyBuffer.size(), remaining));
+                if (!source.read(copyBuffer.data(), static_cast<std::streamsize>(size)) || !outFile->write(copyBuffer.data(), static_cast<std::streamsize>(size)))
+                {
+                    return false;
+                }
+                remaining -= size;
+            }
+            return true;
+        };
 
-    // Read metaddata and create files
-    for (uint32_t i = 0; i < numFiles; i++)
+    bool ok = true;
+    bool end = false;
+    while (ok && !end)
     {
-        uint32_t pathLen = read_u32(ifstream);
-        std::string relpath(pathLen, '\0');
-        if (!ifstream.read(&relpath[0], pathLen))
+        Record record = static_cast<Record>(reader.u8());
+        if (!reader.ok())
         {
-            LOG(Error, "Corrupted archive while reading path.");
-            return;
+            LOG(Error, "Unexpected end of archive stream.");
+            ok = false;
+            break;
         }
 
-        std::ostringstream shaHex;
-        binToHexSHA(ifstream, shaHex);
+        switch (record)
+        {
+        case Record::End:
+            end = true;
+            break;
+
+        case Record::Blob:
+            {
+                reader.skip(digestBytes);
+                uint64_t size = reader.u64();
+                uint64_t compressedSize = reader.u64();
+                CodecId codec = static_cast<CodecId>(reader.u32());
+                uint32_t flags = static_cast<uint32_t>(reader.varint());
+                uint32_t crc = reader.u32();
+                if (!reader.ok() || !isCodecAvailable(codec))
+                {
+                    LOG(Error, "Corrupted archive or unavailable codec in blob %zu.", locations.size());
+                    ok = false;
+                    break;
+                }
 
-        uint64_t size = read_u64(ifstream);
-        uint32_t readonly = read_u32(ifstream);
-        uint64_t mtime = read_u64(ifstream);
+                if (0 != (flags & BlobEntry::ZEROS))
+                {
+                    if (!outFile || 0 != compressedSize)
+                    {
+                        LOG(Error, "Zero blob %zu outside of a file.", locations.size());
+                        ok = false;
+                        break;
+                    }
+                    locations.push_back(BlobLocation{ restored.size() - 1, written, size, true });
+                    ok = skipZeros(size);
+                    break;
+                }
 
-        auto it = blobMap.find(shaHex.str());
-        if (it == blobMap.end())
-        {
-            LOG(Error, "Missing blob for file: %s", relpath.c_str());
-            return;
+                // content of the open file, or the dictionary or a solid block kept in memory until its members are written
+                Stats::add(Stat::DecompressOut, size);
+                std::stringbuf data;
+                ChecksumBuffer checksum(outFile ? outFile->rdbuf() : &data);
+                std::ostream ostream(&checksum);
+                ok = compressor.decompressStreamToStream(istream, compressedSize, codec, 0 != (flags & BlobEntry::USES_DICTIONARY), ostream);
+                if (ok && (checksum.size() != size || checksum.crc() != crc))
+                {
+                    LOG(Error, "Checksum mismatch in blob %zu.", locations.size());
+                    ok = false;
+                }
+
+                if (outFile)
+                {
+                    locations.push_back(BlobLocation{ restored.size() - 1, written, size });
+                    written += size;
+                    break;
+                }
+
+                locations.push_back(BlobLocation{ NO_FILE, 0, size });
+                if (0 != (flags & BlobEntry::IS_DICTIONARY))
+                {
+                    const std::string content = data.str();
+                    dictionary.assign(content.begin(), content.end());
+                    compressor.setDictionary(dictionary, 0);
+                }
+                else
+                {
+                    solidData = data.str();
+                    solidBlock = locations.size() - 1;
+                }
+                break;
+            }
+
+        case Record::Member:
+            {
+                uint64_t block = reader.varint();
+                uint64_t offset = reader.varint();
+                uint64_t size = reader.varint();
+                if (!reader.ok() || !outFile || block != solidBlock || offset > solidData.size() || size > solidData.size() - offset)
+                {
+                    LOG(Error, "Member blob outside of its solid block.");
+                    ok = false;
+                    break;
+                }
+
+                locations.push_back(BlobLocation{ restored.size() - 1, written, size });
+                ok = static_cast<bool>(outFile->write(solidData.data() + offset, static_cast<std::streamsize>(size)));
+                written += size;
+                break;
+            }
+
+        case Record::Reference:
+            {
+                uint64_t blob = reader.varint();
+                if (!reader.ok() || !outFile || blob >= locations.size() || NO_FILE == locations[blob].file)
+                {
+                    LOG(Error, "Reference to a missing blob.");
+                    ok = false;
+                    break;
+                }
+
+                if (locations[blob].zero)
+                {
+                    ok = skipZeros(locations[blob].size);
+                    break;
+                }
+
+                // members of solid blocks are read back from the file they were restored into as well
+                ok = copyBlob(locations[blob]);
+                written += locations[blob].size;
+                break;
+            }
+
+        case Record::File:
+            {
+                uint64_t length = reader.varint();
+                if (!reader.ok() || outFile || length > UINT16_MAX)
+                {
+                    LOG(Error, "Corrupted archive while reading path.");
+                    ok = false;
+                    break;
+                }
+                file.path.resize(static_cast<std::size_t>(length));
+                reader.bytes(file.path.data(), file.path.size());
+                file.readonly = 0 != (reader.varint() & 1);
+                file.time = unzigzag(reader.varint());
+                if (!reader.ok())
+                {
+                    LOG(Error, "Corrupted archive while reading path.");
+                    ok = false;
+                    break;
+                }
+                if (!isSafePath(file.path))
+                {
+                    LOG(Error, "Archive path %s leaves the output directory.", file.path.c_str());
+                    ok = false;
+                    break;
+                }
+
+                fs::path outPath = destRoot / file.path;
+                if (!createDirectories(outPath.parent_path()))
+                {
+                    ok = false;
+                    break;
+                }
+                outFile = std::make_unique<OutputFile>(outPath);
+                if (!*outFile)
+                {
+                    LOG(Error, "Cannot create output file %s.", outPath.string().c_str());
+                    ok = false;
+                    break;
+                }
+                restored.push_back(outPath);
+                written = 0;
+                sparse = false;
+                incomplete = true;
+                break;
+            }
+
+        case Record::FileEnd:
+            {
+                bool skip = 0 != reader.varint();
+                uint64_t size = skip ? written : reader.varint();
+                if (!skip)
+                {
+                    reader.skip(digestBytes);
+                }
+                if (!reader.ok() || !outFile)
+                {
+                    LOG(Error, "Corrupted archive while reading file end.");
+                    ok = false;
+                    break;
+                }
+
+                {
+                    Stats::Timer timer(Stat::WriteNanos);
+                    outFile->close();
+                }
+                ok = static_cast<bool>(*outFile) && size == written;
+                outFile.reset();
+                if (ok && sparse)
+                {
+                    std::error_code error;
+                    fs::resize_file(restored.back(), written, error);
+                    ok = !error;
+                }
+                Stats::add(Stat::WriteBytes, written);
+                if (!ok)
+                {
+                    LOG(Error, "Cannot restore file %s.", file.path.c_str());
+                    break;
+                }
+
+                incomplete = false;
+                if (skip)
+                {
+                    fs::path temporary = restored.back();
+                    temporary += ".skipped";
+                    std::error_code error;
+                    fs::rename(restored.back(), temporary, error);
+                    if (error)
+                    {
+                        LOG(Error, "Cannot rename %s: %s", restored.back().string().c_str(), error.message().c_str());
+                        ok = false;
+                    }
+                    else
+                    {
+                        restored.back() = temporary;
+                    }
+                    skipped.push_back(restored.back());
+                    break;
+                }
+                ok = restoreMetadata(file, restored.back());
+                Stats::add(Stat::FilesDone, 1);
+                break;
+            }
+
+        default:
+            LOG(Error, "Unknown archive record %u.", static_cast<uint32_t>(record));
+            ok = false;
+            break;
         }
 
-        const Blob& blob = it->second;
+        ok = ok && reader.ok();
+    }
 
-        // save metadata pos
-        std::streampos metadataPos = ifstream.tellg();
+    for (const fs::path& path : skipped)
+    {
+        std::error_code error;
+        fs::remove(path, error);
+    }
 
-        // go to blobs
-        ifstream.clear();
-        ifstream.seekg(blob.pos);
-        if (!ifstream)
+    if (!ok)
+    {
+        if (incomplete)
         {
-            LOG(Error, "Seekg failed for blob: %s", relpath.c_str());
-            return;
+            outFile.reset();
+            std::error_code error;
+            fs::remove(restored.back(), error);
+            LOG(Error, "Removed partially restored file %s.", file.path.c_str());
         }
+        LOG(Error, "Cannot restore archive stream.");
+        return false;
+    }
+
+    // the tables repeat what the records said, they are read to the end so the writer never sees a closed pipe
+    istream.ignore(std::numeric_limits<std::streamsize>::max());
+    return true;
+}
 
-        fs::path outPath = destRoot / relpath;
-        fs::create_directories(outPath.parent_path());
+/**
+* Name: FileManager::Extract
+* Description: Extract files matching any of the glob patterns, reads only the tables and the blobs they need
+* @Param archivePath - absolute path to the archive
+* @Param destRoot - absolute path to the root directory
+* @Param patterns - glob patterns matched against archive paths
+* @Param options - unpack options
+*/
+bool FileManager::Extract(const fs::path& archivePath, const fs::path& destRoot, const std::vector<std::string>& patterns, const UnpackOptions& options)
+{
+    LOG(Info, "Entry.");
 
-        m_compressor.decompresStreamToFile(ifstream, blob.compSize, outPath);
-        // back to metadata
-        ifstream.clear();
-        ifstream.seekg(metadataPos);
+    MappedFile mapping;
+    std::vector<BlobEntry> blobs;
+    std::vector<FileMetadata> files;
+    if (!openArchive(archivePath, mapping, blobs, files))
+    {
+        return false;
+    }
 
-        if (readonly)
+    std::vector<const FileMetadata*> selected;
+    for (const FileMetadata& file : files)
+    {
+        if (std::any_of(patterns.begin(), patterns.end(), [&](const std::string& pattern) { return globMatch(pattern.c_str(), file.path.c_str()); }))
         {
-            auto perms = fs::status(outPath).permissions();
-            fs::permissions(outPath, perms & ~fs::perms::owner_write);
+            selected.push_back(&file);
         }
+    }
 
-        auto ftime = fs::file_time_type::clock::time_point(std::chrono::seconds(mtime));
-        fs::last_write_time(outPath, ftime);
+    if (!restoreFiles(archivePath, mapping, blobs, selected, destRoot, options))
+    {
+        return false;
     }
 
     LOG(Info, "Exit.");
+    return true;
 }
 
 /**
-* Name: FileManager::binToHexSHA
-* Description: Reads and convers bin to hex SHA
-* @Param ifstream - file stream with binary SHA
-* @param shaHex - string stream with hex SHA
+* Name: FileManager::List
+* Description: Print files stored in the archive, reads only the footer and the file table
+* @Param archivePath - absolute path to the archive
 */
-void FileManager::binToHexSHA(std::ifstream& ifstream, std::ostringstream& shaHex)
+bool FileManager::List(const fs::path& archivePath)
 {
-    unsigned char shaBin[32];
-    if (!ifstream.read(reinterpret_cast<char*>(shaBin), 32))
+    LOG(Info, "Entry.");
+
+    MappedFile mapping;
+    std::vector<BlobEntry> blobs;
+    std::vector<FileMetadata> files;
+    if (!openArchive(archivePath, mapping, blobs, files))
     {
-        LOG(Error, "Corrupted archive while reading file SHA.");
-        return;
+        return false;
     }
 
-    shaHex << std::hex << std::setfill('0');
-    for (int j = 0; j < 32; j++)
+    for (const FileMetadata& file : files)
     {
-        shaHex << std::setw(2) << static_cast<int>(shaBin[j]);
+        std::cout << file.size << "\t" << file.path << "\n";
     }
+
+    LOG(Info, "Exit.");
+    return true;
 }
 
 /**
-* Name: FileManager::hexToBinSHA
-* Description: Convers hex to bin SHA
-* @Param shaBin - output shaBin
-* @Param shaHex - string containing hex SHA
+* Name: FileManager::Cat
+* Description: Write a byte range of one archived file to stdout. Blobs before the range are skipped without
+*              inflating them, so reading from the middle of a split file touches only the blocks it needs.
+* @Param archivePath - absolute path to the archive
+* @Param path - file path inside the archive
+* @Param offset - first byte of the range
+* @Param length - range length
 */
-void FileManager::hexToBinSHA(char* shaBin, const std::string& shaHex)
+bool FileManager::Cat(const fs::path& archivePath, const std::string& path, uint64_t offset, uint64_t length)
 {
-    for (int i = 0; i < 32; i += 2)
+    LOG(Info, "Entry.");
+
+    MappedFile mapping;
+    std::vector<BlobEntry> blobs;
+    std::vector<FileMetadata> files;
+    if (!openArchive(archivePath, mapping, blobs, files))
+    {
+        return false;
+    }
+
+    auto file = std::find_if(files.begin(), files.end(), [&](const FileMetadata& entry) { return entry.path == path; });
+    if (files.end() == file)
+    {
+        LOG(Error, "File %s not found in the archive.", path.c_str());
+        return false;
+    }
+
+    std::ifstream ifstream;
+    if (!mapping.isOpen())
+    {
+        ifstream.open(archivePath, std::ios::binary);
+        if (!ifstream)
+        {
+            LOG(Error, "Cannot open archive.");
+            return false;
+        }
+    }
+
+    Compressor compressor(m_compressor.chunkSize());
+    std::vector<char> dictionary;
+    if (!loadDictionary(mapping, ifstream, compressor, blobs, dictionary))
     {
-        shaBin[i / 2] = static_cast<char>(std::stoi(shaHex.substr(i, 2), nullptr, 16));
+        return false;
     }
+    compressor.setDictionary(dictionary, 0);
+
+    RangeBuffer range(std::cout.rdbuf(), 0, length);
+    std::ostream ostream(&range);
+
+    uint64_t blobStart = 0;
+    for (std::size_t i = 0; i < file->blobs.size() && !range.full(); i++)
+    {
+        const BlobEntry& blob = blobs[file->blobs[i]];
+        if (blobStart + blob.origSize <= offset)
+        {
+            blobStart += blob.origSize;
+            continue;
+        }
+
+        range.skip(offset > blobStart ? offset - blobStart : 0);
+        if (!inflateBlobs(mapping, ifstream, compressor, blobs, file->blobs.data() + i, 1, ostream))
+        {
+            LOG(Error, "Cannot decompress blob: %s", file->path.c_str());
+            return false;
+        }
+        blobStart += blob.origSize;
+    }
+    if (!std::cout.flush())
+    {
+        LOG(Error, "Cannot write %s to stdout.", file->path.c_str());
+        return false;
+    }
+
+    LOG(Info, "Exit.");
+    return true;
+}
+
+/**
+* Name: FileManager::Verify
+* Description: Inflate every stored blob on a worker pool and check its size and crc, nothing is written.
+*              Members of solid blocks are covered by their block, so each blob is inflated once.
+* @Param archivePath - absolute path to the archive
+* @Param options - unpack options, worker threads
+*/
+bool FileManager::Verify(const fs::path& archivePath, const UnpackOptions& options)
+{
+    LOG(Info, "Entry.");
+
+    MappedFile mapping;
+    std::vector<BlobEntry> blobs;
+    std::vector<FileMetadata> files;
+    if (!openArchive(archivePath, mapping, blobs, files))
+    {
+        return false;
+    }
+
+    // zero blobs store nothing which could be damaged
+    std::vector<uint32_t> stored;
+    for (uint32_t i = 0; i < blobs.size(); i++)
+    {
+        if (BlobEntry::NO_SOLID_BLOCK == blobs[i].solidBlock && 0 == (blobs[i].flags & BlobEntry::ZEROS))
+        {
+            stored.push_back(i);
+        }
+    }
+
+    WorkerPool pool(options.threads);
+    std::vector<std::ifstream> streams(pool.size());
+    std::vector<Compressor> compressors;
+    compressors.reserve(pool.size());
+    for (std::size_t i = 0; i < pool.size(); i++)
+    {
+        if (!mapping.isOpen())
+        {
+            streams[i].open(archivePath, std::ios::binary);
+            if (!streams[i])
+            {
+                LOG(Error, "Cannot open archive.");
+                return false;
+            }
+        }
+        compressors.emplace_back(m_compressor.chunkSize());
+    }
+
+    std::vector<char> dictionary;
+    if (!loadDictionary(mapping, streams[0], compressors[0], blobs, dictionary))
+    {
+        return false;
+    }
+    for (Compressor& compressor : compressors)
+    {
+        compressor.setDictionary(dictionary, 0);
+    }
+
+    std::atomic<std::size_t> corrupted{ 0 };
+    std::atomic<uint64_t> verifiedBytes{ 0 };
+    pool.run(stored.size(), [&](std::size_t index, std::size_t worker)
+        {
+            // an empty range drops everything, only the checksum sees the data
+            RangeBuffer discard(nullptr, 0, 0);
+            std::ostream sink(&discard);
+            if (!inflateBlobs(mapping, streams[worker], compressors[worker], blobs, &stored[index], 1, sink))
+            {
+                LOG(Error, "Blob %u is corrupted.", stored[index]);
+                corrupted++;
+                return;
+            }
+            verifiedBytes += blobs[stored[index]].origSize;
+        });
+
+    std::cout << "Verified " << stored.size() - corrupted << " of " << stored.size() << " blobs, "
+        << verifiedBytes << " bytes of " << files.size() << " files\n";
+    if (0 != corrupted)
+    {
+        LOG(Error, "Archive has %zu corrupted blobs.", corrupted.load());
+        return false;
+    }
+
+    LOG(Info, "Exit.");
+    return true;
+}
+
+/**
+* Name: FileManager::openArchive
+* Description: Open archive, check header and read blob index and file table through the footer.
+*              Mappable archives are parsed in place, other inputs read only the header and the tables.
+* @Param archivePath - absolute path to the archive
+* @Param mapping - output archive mapping, stays closed when the archive cannot be mapped
+* @Param blobs - output blob index
+* @Param files - output file table
+*/
+bool FileManager::openArchive(const fs::path& archivePath, MappedFile& mapping, std::vector<BlobEntry>& blobs, std::vector<FileMetadata>& files)
+{
+    std::ifstream ifstream(archivePath, std::ios::binary | std::ios::ate);
+    if (!ifstream)
+    {
+        LOG(Error, "Cannot open archive.");
+        return false;
+    }
+
+    uint64_t archiveSize = static_cast<uint64_t>(ifstream.tellg());
+    char header[HEADER_SIZE] = {};
+    ifstream.seekg(0);
+    ifstream.read(header, HEADER_SIZE);
+
+    // version 2 archives have no footer, their tables are found by walking the blobs
+    if (ifstream && 0 == memcmp(header, MAGIC, 4) && LEGACY_VERSION == ByteReader(header + 4, 4).u32())
+    {
+        mapping.open(archivePath);
+        return readLegacyTables(ifstream, archiveSize, blobs, files);
+    }
+
+    if (mapping.open(archivePath))
+    {
+        ByteReader headerReader(mapping.data(), static_cast<std::size_t>(mapping.size()));
+        ByteReader reader(mapping.data(), static_cast<std::size_t>(mapping.size()));
+        return readTables(headerReader, reader, mapping.size(), blobs, files);
+    }
+
+    if (HEADER_SIZE + FOOTER_SIZE > archiveSize)
+    {
+        LOG(Error, "Archive too small.");
+        return false;
+    }
+
+    char footer[FOOTER_SIZE];
+    ifstream.seekg(static_cast<std::streamoff>(archiveSize - FOOTER_SIZE));
+    ifstream.read(footer, FOOTER_SIZE);
+
+    uint64_t fileTableOffset = ByteReader(footer, FOOTER_SIZE).u64();
+    if (!ifstream || fileTableOffset < HEADER_SIZE || fileTableOffset > archiveSize - FOOTER_SIZE)
+    {
+        LOG(Error, "Invalid archive footer.");
+        return false;
+    }
+
+    // header and everything from the file table to the end, blob data stays on disk
+    std::vector<char> tables(HEADER_SIZE + static_cast<std::size_t>(archiveSize - fileTableOffset));
+    std::copy(header, header + HEADER_SIZE, tables.begin());
+    ifstream.seekg(static_cast<std::streamoff>(fileTableOffset));
+    if (!ifstream.read(tables.data() + HEADER_SIZE, static_cast<std::streamsize>(tables.size() - HEADER_SIZE)))
+    {
+        LOG(Error, "Corrupted archive while reading tables.");
+        return false;
+    }
+
+    ByteReader headerReader(tables.data(), HEADER_SIZE);
+    ByteReader tablesReader(tables.data() + HEADER_SIZE, tables.size() - HEADER_SIZE, fileTableOffset);
+    return readTables(headerReader, tablesReader, archiveSize, blobs, files);
+}
+
+/**
+* Name: FileManager::readTables
+* Description: Parse header, footer, blob index and file table
+* @Param headerReader - reader positioned at the archive header
+* @Param reader - reader covering the file table, blob index and footer
+* @Param archiveSize - archive size
+* @Param blobs - output blob index
+* @Param files - output file table
+*/
+bool FileManager::readTables(ByteReader& headerReader, ByteReader& reader, uint64_t archiveSize, std::vector<BlobEntry>& blobs, std::vector<FileMetadata>& files)
+{
+    const char* magic = headerReader.bytes(4);
+    if (!magic || memcmp(magic, MAGIC, 4) != 0)
+    {
+        LOG(Error, "Invalid archive magic.");
+        return false;
+    }
+
+    uint32_t version = headerReader.u32();
+    if (VERSION != version)
+    {
+        LOG(Error, "Unsupported archive version %u.", version);
+        return false;
+    }
+
+    uint32_t hash = headerReader.u32();
+    std::size_t digestBytes = digestSize(static_cast<HashId>(hash));
+    if (0 == digestBytes)
+    {
+        LOG(Error, "Unknown archive hash %u.", hash);
+        return false;
+    }
+
+    reader.seek(archiveSize - FOOTER_SIZE);
+    uint64_t fileTableOffset = reader.u64();
+    uint64_t blobIndexOffset = reader.u64();
+    uint32_t numBlobs = reader.u32();
+    uint32_t numFiles = reader.u32();
+    magic = reader.bytes(4);
+    if (!magic || memcmp(magic, MAGIC, 4) != 0 || fileTableOffset > blobIndexOffset || blobIndexOffset > archiveSize - FOOTER_SIZE)
+    {
+        LOG(Error, "Invalid archive footer.");
+        return false;
+    }
+
+    // counts are checked against the table sizes before anything is allocated for them
+    if (numFiles > (blobIndexOffset - fileTableOffset) / (MIN_FILE_RECORD + digestBytes) ||
+        numBlobs > (archiveSize - FOOTER_SIZE - blobIndexOffset) / MIN_BLOB_RECORD)
+    {
+        LOG(Error, "Invalid archive table sizes.");
+        return false;
+    }
+
+    reader.seek(blobIndexOffset);
+    blobs.resize(numBlobs);
+    uint64_t previousOffset = 0;
+    for (BlobEntry& blob : blobs)
+    {
+        blob.offset = previousOffset + static_cast<uint64_t>(unzigzag(reader.varint()));
+        previousOffset = blob.offset;
+        blob.origSize = reader.varint();
+        blob.compSize = reader.varint();
+        blob.codec = static_cast<CodecId>(reader.varint());
+        uint64_t solidBlock = reader.varint();
+        blob.solidBlock = 0 != solidBlock && solidBlock <= numBlobs ? static_cast<uint32_t>(solidBlock - 1) : BlobEntry::NO_SOLID_BLOCK;
+        blob.flags = static_cast<uint32_t>(reader.varint());
+        blob.crc = BlobEntry::NO_SOLID_BLOCK == blob.solidBlock ? reader.u32() : 0;
+        if (!reader.ok() || solidBlock > numBlobs)
+        {
+            LOG(Error, "Corrupted archive while reading blob index.");
+            return false;
+        }
+
+        if (!isCodecAvailable(blob.codec))
+        {
+            LOG(Error, "Blob codec %u is not available in this build.", static_cast<uint32_t>(blob.codec));
+            return false;
+        }
+
+        if (BlobEntry::NO_SOLID_BLOCK == blob.solidBlock && (blob.offset > fileTableOffset || blob.compSize > fileTableOffset - blob.offset))
+        {
+            LOG(Error, "Blob outside of the archive.");
+            return false;
+        }
+    }
+
+    // members of a solid block must lie inside a standalone block blob, blobs primed with the dictionary need one
+    std::size_t dictionaries = 0;
+    bool usesDictionary = false;
+    for (const BlobEntry& blob : blobs)
+    {
+        dictionaries += 0 != (blob.flags & BlobEntry::IS_DICTIONARY) ? 1 : 0;
+        usesDictionary = usesDictionary || 0 != (blob.flags & BlobEntry::USES_DICTIONARY);
+        if (BlobEntry::NO_SOLID_BLOCK == blob.solidBlock)
+        {
+            continue;
+        }
+
+        if (blob.solidBlock >= blobs.size() || BlobEntry::NO_SOLID_BLOCK != blobs[blob.solidBlock].solidBlock ||
+            blob.offset > blobs[blob.solidBlock].origSize || blob.origSize > blobs[blob.solidBlock].origSize - blob.offset)
+        {
+            LOG(Error, "Blob outside of its solid block.");
+            return false;
+        }
+    }
+
+    if (1 < dictionaries || (usesDictionary && 0 == dictionaries))
+    {
+        LOG(Error, "Invalid archive dictionary.");
+        return false;
+    }
+
+    reader.seek(fileTableOffset);
+    files.resize(numFiles);
+    const std::string* previousPath = nullptr;
+    int64_t previousTime = 0;
+    int64_t nextBlob = 0;
+    for (FileMetadata& file : files)
+    {
+        uint64_t prefix = reader.varint();
+        uint64_t suffixLen = reader.varint();
+        const char* suffix = reader.bytes(static_cast<std::size_t>(suffixLen));
+        if (!suffix || prefix > (previousPath ? previousPath->size() : 0))
+        {
+            LOG(Error, "Corrupted archive while reading path.");
+            return false;
+        }
+        file.path.reserve(static_cast<std::size_t>(prefix + suffixLen));
+        if (previousPath)
+        {
+            file.path.assign(*previousPath, 0, static_cast<std::size_t>(prefix));
+        }
+        file.path.append(suffix, static_cast<std::size_t>(suffixLen));
+        previousPath = &file.path;
+        if (!isSafePath(file.path))
+        {
+            LOG(Error, "Archive path %s leaves the output directory.", file.path.c_str());
+            return false;
+        }
+
+        const char* digest = reader.bytes(digestBytes);
+        if (digest)
+        {
+            file.digest.assign(digest, digestBytes);
+        }
+
+        file.size = static_cast<std::size_t>(reader.varint());
+        file.readonly = 0 != (reader.varint() & 1);
+        file.time = previousTime + unzigzag(reader.varint());
+        previousTime = file.time;
+
+        // a file may repeat a blob (zero blocks, repeated blocks), each reference takes at least a byte of the table
+        uint64_t blobCount = reader.varint();
+        if (!reader.ok() || blobCount > blobIndexOffset - std::min(blobIndexOffset, reader.position()))
+        {
+            LOG(Error, "Corrupted archive while reading file table.");
+            return false;
+        }
+
+        file.blobs.resize(static_cast<std::size_t>(blobCount));
+        for (uint32_t& blob : file.blobs)
+        {
+            int64_t index = nextBlob + unzigzag(reader.varint());
+            if (0 > index || static_cast<uint64_t>(index) >= blobs.size())
+            {
+                LOG(Error, "Missing blob for file: %s", file.path.c_str());
+                return false;
+            }
+            blob = static_cast<uint32_t>(index);
+            nextBlob = index + 1;
+        }
+    }
+
+    if (!reader.ok())
+    {
+        LOG(Error, "Corrupted archive while reading file table.");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+* Name: FileManager::readLegacyTables
+* Description: Read blob headers and the file table of a version 2 archive. Blobs are zlib streams without a crc,
+*              files find their blob by the half SHA-256 the format stored.
+* @Param istream - archive stream
+* @Param archiveSize - archive size
+* @Param blobs - output blob index
+* @Param files - output file table
+*/
+bool FileManager::readLegacyTables(std::istream& istream, uint64_t archiveSize, std::vector<BlobEntry>& blobs, std::vector<FileMetadata>& files)
+{
+    char header[LEGACY_HEADER_SIZE];
+    istream.clear();
+    istream.seekg(0);
+    if (!istream.read(header, LEGACY_HEADER_SIZE))
+    {
+        LOG(Error, "Archive too small.");
+        return false;
+    }
+
+    ByteReader headerReader(header, LEGACY_HEADER_SIZE);
+    headerReader.seek(8);
+    uint32_t numBlobs = headerReader.u32();
+    uint32_t numFiles = headerReader.u32();
+    uint64_t tableSize = archiveSize - LEGACY_HEADER_SIZE;
+    if (numBlobs > tableSize / LEGACY_BLOB_HEADER || numFiles > tableSize / LEGACY_FILE_RECORD)
+    {
+        LOG(Error, "Invalid archive table sizes.");
+        return false;
+    }
+
+    std::unordered_map<std::string, uint32_t> blobOf(numBlobs);
+    blobs.resize(numBlobs);
+    uint64_t position = LEGACY_HEADER_SIZE;
+    for (uint32_t i = 0; i < numBlobs; i++)
+    {
+        char blobHeader[LEGACY_BLOB_HEADER];
+        istream.seekg(static_cast<std::streamoff>(position));
+        if (!istream.read(blobHeader, LEGACY_BLOB_HEADER))
+        {
+            LOG(Error, "Corrupted archive while reading blob header.");
+            return false;
+        }
+
+        ByteReader reader(blobHeader, LEGACY_BLOB_HEADER);
+        std::string digest(reader.bytes(LEGACY_DIGEST_BYTES), LEGACY_DIGEST_BYTES);
+        reader.seek(32);
+        BlobEntry& blob = blobs[i];
+        blob.origSize = reader.u64();
+        blob.compSize = reader.u64();
+        blob.offset = position + LEGACY_BLOB_HEADER;
+        blob.codec = CodecId::Zlib;
+        // empty files were stored without a zlib stream
+        blob.flags = 0 == blob.compSize ? BlobEntry::ZEROS : BlobEntry::NO_CRC;
+        if (blob.compSize > archiveSize - blob.offset || (0 == blob.compSize && 0 != blob.origSize))
+        {
+            LOG(Error, "Blob outside of the archive.");
+            return false;
+        }
+        position = blob.offset + blob.compSize;
+        blobOf.emplace(std::move(digest), i);
+    }
+
+    istream.seekg(static_cast<std::streamoff>(position));
+    files.resize(numFiles);
+    for (FileMetadata& file : files)
+    {
+        char length[4];
+        if (!istream.read(length, 4))
+        {
+            LOG(Error, "Corrupted archive while reading path.");
+            return false;
+        }
+
+        uint32_t pathLength = ByteReader(length, 4).u32();
+        if (pathLength > archiveSize - position)
+        {
+            LOG(Error, "Corrupted archive while reading path.");
+            return false;
+        }
+        file.path.resize(pathLength);
+        char record[LEGACY_FILE_RECORD - 4];
+        if (!istream.read(&file.path[0], pathLength) || !istream.read(record, sizeof(record)))
+        {
+            LOG(Error, "Corrupted archive while reading file table.");
+            return false;
+        }
+        if (!isSafePath(file.path))
+        {
+            LOG(Error, "Archive path %s leaves the output directory.", file.path.c_str());
+            return false;
+        }
+        position += LEGACY_FILE_RECORD + pathLength;
+
+        ByteReader reader(record, sizeof(record));
+        std::string digest(reader.bytes(LEGACY_DIGEST_BYTES), LEGACY_DIGEST_BYTES);
+        reader.seek(32);
+        file.size = static_cast<std::size_t>(reader.u64());
+        file.readonly = 0 != reader.u32();
+        file.time = static_cast<int64_t>(reader.u64());
+
+        auto blob = blobOf.find(digest);
+        if (blobOf.end() == blob || blobs[blob->second].origSize != file.size)
+        {
+            LOG(Error, "Missing blob for file: %s", file.path.c_str());
+            return false;
+        }
+        file.digest.assign(digest.data(), digest.size());
+        file.blobs.assign(1, blob->second);
+    }
+
+    return true;
+}
+
+/**
+* Name: FileManager::restoreFiles
+* Description: Restore files on a worker pool, workers share the mapping or open their own archive stream
+* @Param archivePath - absolute path to the archive
+* @Param mapping - archive mapping, closed when the archive is not mappable
+* @Param blobs - blob index
+* @Param files - file table entries to restore
+* @Param destRoot - absolute path to the root directory
+* @Param options - unpack options
+*/
+bool FileManager::restoreFiles(const fs::path& archivePath, const MappedFile& mapping, const std::vector<BlobEntry>& blobs, const std::vector<const FileMetadata*>& files, const fs::path& destRoot, const UnpackOptions& options)
+{
+    // directories first, so workers never race on creating the same parent, the output directory even when no file
+    // is restored
+    if (!createDirectories(destRoot))
+    {
+        return false;
+    }
+
+    fs::path lastParent;
+    for (const FileMetadata* file : files)
+    {
+        fs::path parent = (destRoot / file->path).parent_path();
+        if (parent != lastParent)
+        {
+            if (!createDirectories(parent))
+            {
+                return false;
+            }
+            lastParent = parent;
+        }
+    }
+
+    // files with the content of an earlier one are not inflated again, they are copied from it once it is restored.
+    // Sparse files are inflated, a copy of them would not keep the holes everywhere.
+    const std::size_t NOT_A_COPY = files.size();
+    std::vector<std::size_t> copyOf(files.size(), NOT_A_COPY);
+    std::vector<std::size_t> copies;
+    {
+        DigestMap<std::size_t> firstOf(files.size());
+        for (std::size_t i = 0; i < files.size(); i++)
+        {
+            const FileMetadata& file = *files[i];
+            bool sparse = std::any_of(file.blobs.begin(), file.blobs.end(), [&](uint32_t blob) { return 0 != (blobs[blob].flags & BlobEntry::ZEROS); });
+            if (0 == file.size || sparse)
+            {
+                continue;
+            }
+
+            auto [first, inserted] = firstOf.emplace(file.digest, i);
+            if (!inserted && files[*first]->size == file.size)
+            {
+                copyOf[i] = *first;
+                copies.push_back(i);
+            }
+        }
+    }
+
+    // split files are restored block range by block range on all workers, their output is created up front
+    struct RestoreSegment
+    {
+        std::size_t file;
+        std::size_t firstBlob;
+        std::size_t blobCount;
+        uint64_t offset;
+    };
+
+    // files stored as a member of a solid block are restored together, so the block is inflated once
+    struct SolidRestore
+    {
+        uint32_t block;
+        std::vector<std::size_t> files;
+    };
+
+    std::vector<RestoreSegment> segments;
+    std::vector<SolidRestore> solidGroups;
+    std::unordered_map<uint32_t, std::size_t> solidGroupOf;
+    std::vector<std::atomic<std::size_t>> pendingSegments(files.size());
+
+    // outputs which were created but not completed are removed when the restore fails, so no damaged file stays
+    std::vector<std::atomic<bool>> started(files.size());
+    std::vector<std::atomic<bool>> completed(files.size());
+    auto discardPartial = [&]()
+        {
+            for (std::size_t i = 0; i < files.size(); i++)
+            {
+                if (started[i] && !completed[i])
+                {
+                    std::error_code error;
+                    fs::remove(destRoot / files[i]->path, error);
+                    LOG(Error, "Removed partially restored file %s.", files[i]->path.c_str());
+                }
+            }
+        };
+    // split files and files with zero blobs are created at their size first, zero blobs then stay holes
+    std::vector<bool> presized(files.size(), false);
+    for (std::size_t i = 0; i < files.size(); i++)
+    {
+        const FileMetadata& file = *files[i];
+        if (NOT_A_COPY != copyOf[i])
+        {
+            continue;
+        }
+
+        if (1 == file.blobs.size() && BlobEntry::NO_SOLID_BLOCK != blobs[file.blobs[0]].solidBlock)
+        {
+            uint32_t block = blobs[file.blobs[0]].solidBlock;
+            auto [it, inserted] = solidGroupOf.emplace(block, solidGroups.size());
+            if (inserted)
+            {
+                solidGroups.push_back(SolidRestore{ block, {} });
+            }
+            solidGroups[it->second].files.push_back(i);
+            continue;
+        }
+
+        std::size_t first = segments.size();
+
+        RestoreSegment segment{ i, 0, 0, 0 };
+        uint64_t segmentSize = 0;
+        for (std::size_t blob = 0; blob < file.blobs.size(); blob++)
+        {
+            segmentSize += blobs[file.blobs[blob]].origSize;
+            segment.blobCount++;
+            if (RESTORE_SEGMENT_SIZE <= segmentSize && blob + 1 < file.blobs.size())
+            {
+                segments.push_back(segment);
+                segment = RestoreSegment{ i, blob + 1, 0, segment.offset + segmentSize };
+                segmentSize = 0;
+            }
+        }
+        segments.push_back(segment);
+        pendingSegments[i] = segments.size() - first;
+
+        bool sparse = std::any_of(file.blobs.begin(), file.blobs.end(), [&](uint32_t blob) { return 0 != (blobs[blob].flags & BlobEntry::ZEROS); });
+        presized[i] = 1 < pendingSegments[i] || sparse;
+        if (presized[i])
+        {
+            fs::path outPath = destRoot / file.path;
+            started[i] = true;
+            OutputFile outFile(outPath);
+            if (!outFile)
+            {
+                LOG(Error, "Cannot create output file %s.", outPath.string().c_str());
+                discardPartial();
+                return false;
+            }
+            outFile.close();
+            if (sparse)
+            {
+                markSparse(outPath);
+            }
+            std::error_code error;
+            fs::resize_file(outPath, file.size, error);
+            if (error)
+            {
+                LOG(Error, "Cannot resize output file %s: %s", outPath.string().c_str(), error.message().c_str());
+                discardPartial();
+                return false;
+            }
+        }
+    }
+
+    Stats::setFilesTotal(files.size());
+    WorkerPool pool(options.threads);
+    std::vector<std::ifstream> streams(pool.size());
+    std::vector<Compressor> compressors;
+    compressors.reserve(pool.size());
+    for (std::size_t i = 0; i < pool.size(); i++)
+    {
+        if (!mapping.isOpen())
+        {
+            streams[i].open(archivePath, std::ios::binary);
+            if (!streams[i])
+            {
+                LOG(Error, "Cannot open archive.");
+                discardPartial();
+                return false;
+            }
+        }
+        compressors.emplace_back(m_compressor.chunkSize());
+    }
+
+    // the dictionary is inflated once and shared by all workers, decompression needs no blob limit
+    std::vector<char> dictionary;
+    if (!loadDictionary(mapping, streams[0], compressors[0], blobs, dictionary))
+    {
+        discardPartial();
+        return false;
+    }
+    for (Compressor& compressor : compressors)
+    {
+        compressor.setDictionary(dictionary, 0);
+    }
+
+    auto restoreSolidGroup = [&](const SolidRestore& group, std::size_t worker)
+        {
+            std::stringbuf blockData;
+            std::ostream blockStream(&blockData);
+            if (!inflateBlobs(mapping, streams[worker], compressors[worker], blobs, &group.block, 1, blockStream))
+            {
+                LOG(Error, "Cannot decompress solid block %u.", group.block);
+                return false;
+            }
+
+            const std::string data = blockData.str();
+            if (data.size() != blobs[group.block].origSize)
+            {
+                LOG(Error, "Corrupted solid block %u.", group.block);
+                return false;
+            }
+
+            // the stream buffer and its copy
+            Stats::Allocation allocation(2 * data.size());
+
+            for (std::size_t i : group.files)
+            {
+                const FileMetadata& file = *files[i];
+                const BlobEntry& blob = blobs[file.blobs[0]];
+                fs::path outPath = destRoot / file.path;
+
+                {
+                    Stats::Timer timer(Stat::WriteNanos);
+                    started[i] = true;
+                    OutputFile outFile(outPath);
+                    if (!outFile.write(data.data() + blob.offset, static_cast<std::streamsize>(blob.origSize)))
+                    {
+                        LOG(Error, "Cannot create output file %s.", outPath.string().c_str());
+                        return false;
+                    }
+                    outFile.close();
+                    if (!outFile)
+                    {
+                        LOG(Error, "Cannot write output file %s.", outPath.string().c_str());
+                        return false;
+                    }
+                }
+                Stats::add(Stat::WriteBytes, blob.origSize);
+                if (!restoreMetadata(file, outPath))
+                {
+                    return false;
+                }
+                completed[i] = true;
+                Stats::add(Stat::FilesDone, 1);
+            }
+            return true;
+        };
+
+    std::atomic<bool> failed{ false };
+    pool.run(segments.size() + solidGroups.size(), [&](std::size_t index, std::size_t worker)
+        {
+            if (failed)
+            {
+                return;
+            }
+
+            if (index >= segments.size())
+            {
+                if (!restoreSolidGroup(solidGroups[index - segments.size()], worker))
+                {
+                    failed = true;
+                }
+                return;
+            }
+
+            const RestoreSegment& segment = segments[index];
+            const FileMetadata& file = *files[segment.file];
+            fs::path outPath = destRoot / file.path;
+
+            // a file in one segment is created here, the blocks of a split file go into the preallocated one
+            bool update = presized[segment.file];
+            started[segment.file] = true;
+            OutputFile outFile(outPath, update);
+            if (update)
+            {
+                outFile.seekp(static_cast<std::streamoff>(segment.offset));
+            }
+            if (!outFile)
+            {
+                LOG(Error, "Cannot create output file %s.", outPath.string().c_str());
+                failed = true;
+                return;
+            }
+
+            // zero blobs are skipped, the file was created at its size so they read back as zeros
+            uint64_t position = segment.offset;
+            for (std::size_t blob = 0; blob < segment.blobCount; blob++)
+            {
+                const uint32_t* index = file.blobs.data() + segment.firstBlob + blob;
+                position += blobs[*index].origSize;
+                if (0 != (blobs[*index].flags & BlobEntry::ZEROS))
+                {
+                    Stats::add(Stat::HoleBytes, blobs[*index].origSize);
+                    outFile.seekp(static_cast<std::streamoff>(position));
+                    continue;
+                }
+
+                if (!inflateBlobs(mapping, streams[worker], compressors[worker], blobs, index, 1, outFile))
+                {
+                    LOG(Error, "Cannot decompress blob: %s", file.path.c_str());
+                    failed = true;
+                    return;
+                }
+                Stats::add(Stat::WriteBytes, blobs[*index].origSize);
+            }
+            {
+                Stats::Timer timer(Stat::WriteNanos);
+                outFile.close();
+            }
+            if (!outFile)
+            {
+                LOG(Error, "Cannot write output file %s.", outPath.string().c_str());
+                failed = true;
+                return;
+            }
+
+            // the last finished segment of a file restores its metadata
+            if (1 == pendingSegments[segment.file]--)
+            {
+                if (!restoreMetadata(file, outPath))
+                {
+                    failed = true;
+                    return;
+                }
+                completed[segment.file] = true;
+                Stats::add(Stat::FilesDone, 1);
+            }
+        });
+
+    if (failed)
+    {
+        discardPartial();
+        return false;
+    }
+
+    // copies cost a reflink, a kernel copy or a hard link each instead of inflating the blobs again
+    pool.run(copies.size(), [&](std::size_t index, std::size_t)
+        {
+            if (failed)
+            {
+                return;
+            }
+
+            const FileMetadata& file = *files[copies[index]];
+            const FileMetadata& source = *files[copyOf[copies[index]]];
+            fs::path outPath = destRoot / file.path;
+            fs::path sourcePath = destRoot / source.path;
+
+            // a hard link shares the metadata as well, so only copies with the same one are linked
+            if (options.hardlinks && file.readonly == source.readonly && file.time == source.time)
+            {
+                std::error_code error;
+                started[copies[index]] = true;
+                fs::remove(outPath, error);
+                fs::create_hard_link(sourcePath, outPath, error);
+                if (!error)
+                {
+                    completed[copies[index]] = true;
+                    Stats::add(Stat::DedupFiles, 1);
+                    Stats::add(Stat::DedupBytes, file.size);
+                    Stats::add(Stat::FilesDone, 1);
+                    return;
+                }
+                LOG(Debug, "Cannot link %s, copying it instead.", outPath.string().c_str());
+            }
+
+            CloneMethod method = CloneMethod::Copy;
+            {
+                Stats::Timer timer(Stat::WriteNanos);
+                started[copies[index]] = true;
+                if (!cloneFile(sourcePath, outPath, method))
+                {
+                    failed = true;
+                    return;
+                }
+            }
+            if (CloneMethod::Reflink != method)
+            {
+                Stats::add(Stat::WriteBytes, file.size);
+            }
+            Stats::add(Stat::DedupFiles, 1);
+            Stats::add(Stat::DedupBytes, file.size);
+            if (!restoreMetadata(file, outPath))
+            {
+                failed = true;
+                return;
+            }
+            completed[copies[index]] = true;
+            Stats::add(Stat::FilesDone, 1);
+        });
+
+    if (failed)
+    {
+        discardPartial();
+        return false;
+    }
+    return true;
+}
+
+/**
+* Name: FileManager::sampleDictionary
+* Description: Read an evenly spread sample of the candidate files and train the archive dictionary on it
+* @Param root - absolute path to root directory
+* @Param files - scanned files
+* @Param candidates - indices of the small files to sample
+* @Param options - pack options, codec and dictionary size
+* @Param dictionary - output dictionary
+*/
+bool FileManager::sampleDictionary(const fs::path& root, const std::vector<FileMetadata>& files, const std::vector<std::size_t>& candidates, const PackOptions& options, std::vector<char>& dictionary)
+{
+    LOG(Info, "Entry.");
+
+    if (!codecSupportsDictionary(options.codec.id))
+    {
+        LOG(Warn, "Codec %s does not use dictionaries.", codecName(options.codec.id));
+        return false;
+    }
+
+    uint64_t total = 0;
+    for (std::size_t i : candidates)
+    {
+        total += files[i].size;
+    }
+
+    // every stride-th file, so the sample covers the whole tree within the budget
+    const uint64_t budget = static_cast<uint64_t>(options.dictionarySize) * DICTIONARY_SAMPLE_FACTOR;
+    const std::size_t stride = static_cast<std::size_t>(std::max<uint64_t>(1, (total + budget - 1) / budget));
+
+    std::vector<char> samples;
+    std::vector<std::size_t> sampleSizes;
+    for (std::size_t i = 0; i < candidates.size(); i += stride)
+    {
+        std::ifstream inFile(root / files[candidates[i]].path, std::ios::binary);
+        std::size_t size = static_cast<std::size_t>(files[candidates[i]].size);
+        std::size_t offset = samples.size();
+        samples.resize(offset + size);
+        inFile.read(samples.data() + offset, static_cast<std::streamsize>(size));
+
+        std::size_t readBytes = static_cast<std::size_t>(inFile.gcount());
+        samples.resize(offset + readBytes);
+        if (0 < readBytes)
+        {
+            sampleSizes.push_back(readBytes);
+        }
+    }
+
+    if (sampleSizes.empty() || !trainDictionary(options.codec.id, samples, sampleSizes, options.dictionarySize, dictionary))
+    {
+        LOG(Warn, "No dictionary trained from %zu samples.", sampleSizes.size());
+        dictionary.clear();
+        return false;
+    }
+
+    LOG(Info, "Exit.");
+    return true;
+}
+
+/**
+* Name: FileManager::loadDictionary
+* Description: Inflate the archive dictionary, an archive without one gives an empty dictionary
+* @Param mapping - archive mapping, used when open
+* @Param ifstream - archive stream used when the archive is not mapped
+* @Param compressor - compressor owned by the calling thread
+* @Param blobs - blob index
+* @Param dictionary - output dictionary
+*/
+bool FileManager::loadDictionary(const MappedFile& mapping, std::ifstream& ifstream, Compressor& compressor, const std::vector<BlobEntry>& blobs, std::vector<char>& dictionary)
+{
+    dictionary.clear();
+    for (uint32_t i = 0; i < blobs.size(); i++)
+    {
+        if (0 == (blobs[i].flags & BlobEntry::IS_DICTIONARY))
+        {
+            continue;
+        }
+
+        std::stringbuf data;
+        std::ostream ostream(&data);
+        if (!inflateBlobs(mapping, ifstream, compressor, blobs, &i, 1, ostream))
+        {
+            LOG(Error, "Cannot read archive dictionary.");
+            return false;
+        }
+
+        const std::string content = data.str();
+        dictionary.assign(content.begin(), content.end());
+        break;
+    }
+    return true;
+}
+
+/**
+* Name: FileManager::inflateBlobs
+* Description: Decompress blobs one after another into the output stream, members of solid blocks included
+* @Param mapping - archive mapping, blobs are inflated straight from it when open
+* @Param ifstream - archive stream used when the archive is not mapped
+* @Param compressor - compressor owned by the calling thread
+* @Param blobs - blob index
+* @Param indices - indices of the blobs to decompress
+* @Param count - number of blobs
+* @Param ostream - output stream
+*/
+bool FileManager::inflateBlobs(const MappedFile& mapping, std::ifstream& ifstream, Compressor& compressor, const std::vector<BlobEntry>& blobs, const uint32_t* indices, std::size_t count, std::ostream& ostream)
+{
+    for (std::size_t i = 0; i < count; i++)
+    {
+        const BlobEntry& blob = blobs[indices[i]];
+        if (BlobEntry::NO_SOLID_BLOCK != blob.solidBlock)
+        {
+            // member of a solid block, the block is inflated and only the bytes of the member reach the output
+            RangeBuffer range(ostream.rdbuf(), blob.offset, blob.origSize);
+            std::ostream member(&range);
+            if (!inflateBlobs(mapping, ifstream, compressor, blobs, &blob.solidBlock, 1, member))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        if (0 != (blob.flags & BlobEntry::ZEROS))
+        {
+            for (uint64_t remaining = blob.origSize; 0 < remaining;)
+            {
+                std::size_t size = static_cast<std::size_t>(std::min<uint64_t>(sizeof(ZERO_BYTES), remaining));
+                if (!ostream.write(ZERO_BYTES, static_cast<std::streamsize>(size)))
+                {
+                    return false;
+                }
+                remaining -= size;
+            }
+            continue;
+        }
+
+        // the inflated blob is checked against its crc on the way to the output
+        Stats::add(Stat::DecompressOut, blob.origSize);
+        ChecksumBuffer checksum(ostream.rdbuf());
+        std::ostream checked(&checksum);
+        bool dictionary = 0 != (blob.flags & BlobEntry::USES_DICTIONARY);
+        if (mapping.isOpen())
+        {
+            if (!compressor.decompressBufferToStream(mapping.data() + blob.offset, blob.compSize, blob.codec, dictionary, checked))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            ifstream.clear();
+            ifstream.seekg(static_cast<std::streamoff>(blob.offset));
+            if (!ifstream)
+            {
+                LOG(Error, "Seekg failed for blob %u.", indices[i]);
+                return false;
+            }
+
+            if (!compressor.decompressStreamToStream(ifstream, blob.compSize, blob.codec, dictionary, checked))
+            {
+                return false;
+            }
+        }
+
+        if (checksum.size() != blob.origSize || (0 == (blob.flags & BlobEntry::NO_CRC) && checksum.crc() != blob.crc))
+        {
+            LOG(Error, "Checksum mismatch in blob %u.", indices[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+* Name: FileManager::restoreMetadata
+* Description: Restore read only flag and modification time of a restored file. It runs on restore workers, so
+*              errors are logged and returned, never thrown.
+* @Param file - file table entry
+* @Param outPath - absolute path to the restored file
+*/
+bool FileManager::restoreMetadata(const FileMetadata& file, const fs::path& outPath)
+{
+    std::error_code error;
+    if (file.readonly)
+    {
+        fs::file_status status = fs::status(outPath, error);
+        if (!error)
+        {
+            fs::permissions(outPath, status.permissions() & ~fs::perms::owner_write, error);
+        }
+    }
+
+    if (!error)
+    {
+        auto ftime = fs::file_time_type::clock::time_point(std::chrono::seconds(file.time));
+        fs::last_write_time(outPath, ftime, error);
+    }
+
+    if (error)
+    {
+        LOG(Error, "Cannot restore metadata of %s: %s", outPath.string().c_str(), error.message().c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+* Name: FileManager::isSafePath
+* Description: Check that an archive path stays below the output directory: relative, no root name and no empty,
+*              '.' or '..' components
+* @Param path - archive path
+*/
+bool FileManager::isSafePath(const std::string& path)
+{
+    if (path.empty() || std::string::npos != path.find('\0'))
+    {
+        return false;
+    }
+
+    fs::path parsed(path);
+    if (parsed.has_root_name() || parsed.has_root_directory())
+    {
+        return false;
+    }
+
+    for (const fs::path& part : parsed)
+    {
+        if (part.empty() || "." == part || ".." == part)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+* Name: FileManager::createDirectories
+* Description: Create a directory and its missing parents, logs the error when that fails
+* @Param path - directory path
+*/
+bool FileManager::createDirectories(const fs::path& path)
+{
+    std::error_code error;
+    fs::create_directories(path, error);
+    if (error)
+    {
+        LOG(Error, "Cannot create directory %s: %s", path.string().c_str(), error.message().c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+* Name: FileManager::globMatch
+* Description: Match path against glob pattern, '*' and '?' stop at '/', '**' matches across directories and may also match no directory at all
+* @Param pattern - glob pattern
+* @Param path - archive path
+*/
+bool FileManager::globMatch(const char* pattern, const char* path)
+{
+    for (; '\0' != *pattern; pattern++, path++)
+    {
+        if ('*' == *pattern)
+        {
+            bool anyDepth = '*' == pattern[1];
+            pattern += anyDepth ? 2 : 1;
+            if (anyDepth && '/' == *pattern && globMatch(pattern + 1, path))
+            {
+                return true;
+            }
+            for (;; path++)
+            {
+                if (globMatch(pattern, path))
+                {
+                    return true;
+                }
+                if ('\0' == *path || (!anyDepth && '/' == *path))
+                {
+                    return false;
+                }
+            }
+        }
+
+        if ('\0' == *path || ('?' == *pattern ? '/' == *path : *pattern != *path))
+        {
+            return false;
+        }
+    }
+
+    return '\0' == *path;
 }
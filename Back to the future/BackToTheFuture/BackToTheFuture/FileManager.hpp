@@ -6,33 +6,113 @@
 #include <filesystem>
 
 #include "Logger.hpp"
+#include "Chunker.hpp"
 #include "Compressor.hpp"
 #include "FileScanner.hpp"
+#include "MappedFile.hpp"
+
+class ByteReader;
 
 namespace fs = std::filesystem;
 
+enum class CacheMode
+{
+	Off,
+	Use,
+	// hash every file and report cache entries which do not match
+	Verify,
+};
+
+struct PackOptions
+{
+	std::size_t threads = 1;
+	bool chunking = false;
+	ChunkerParams chunker;
+	bool entropyCheck = true;
+	CodecParams codec;
+	HashId hash = HashId::Sha256;
+	// files above this size are compressed as independent blocks, 0 disables splitting
+	uint64_t blockSize = 4 << 20;
+	CacheMode cache = CacheMode::Use;
+	// empty uses the per-tree cache file in the user cache directory
+	fs::path cachePath;
+	// small files are compressed together in solid blocks of about this size, 0 disables solid mode
+	uint64_t solidBlockSize = 0;
+	// size of the dictionary trained for small blobs, 0 disables it
+	std::size_t dictionarySize = 0;
+	// read very large files with O_DIRECT, only with the io_uring backend
+	bool directIo = false;
+};
+
+struct UnpackOptions
+{
+	std::size_t threads = 1;
+	// further copies of a file are hard links to the first one, they share its inode
+	bool hardlinks = false;
+};
+
+struct BlobEntry
+{
+	static constexpr uint32_t NO_SOLID_BLOCK = UINT32_MAX;
+	// flags
+	static constexpr uint32_t USES_DICTIONARY = 1;
+	static constexpr uint32_t IS_DICTIONARY = 2;
+	// content is all zeros, nothing is stored and restores leave a hole
+	static constexpr uint32_t ZEROS = 4;
+	// blob of a version 2 archive, which stored no crc, never written
+	static constexpr uint32_t NO_CRC = 8;
+
+	uint64_t origSize;
+	uint64_t compSize;
+	// archive offset, or offset inside the inflated solid block for its members
+	uint64_t offset;
+	CodecId codec;
+	// blob holding the solid block this blob is a member of
+	uint32_t solidBlock = NO_SOLID_BLOCK;
+	uint32_t flags = 0;
+	// CRC-32C of the inflated blob, members are covered by the crc of their block
+	uint32_t crc = 0;
+};
+
 class IFileManager
 {
 public: 
-	virtual void Pack(const fs::path& root, const fs::path& archivePath) = 0;
-	virtual void Unpack(const fs::path& archivepath, const fs::path& destRoot) = 0;
+	virtual bool Pack(const fs::path& root, const fs::path& archivePath, const PackOptions& options) = 0;
+	virtual bool Unpack(const fs::path& archivepath, const fs::path& destRoot, const UnpackOptions& options) = 0;
+	virtual bool Extract(const fs::path& archivePath, const fs::path& destRoot, const std::vector<std::string>& patterns, const UnpackOptions& options) = 0;
+	virtual bool List(const fs::path& archivePath) = 0;
+	virtual bool Cat(const fs::path& archivePath, const std::string& path, uint64_t offset, uint64_t length) = 0;
+	virtual bool Verify(const fs::path& archivePath, const UnpackOptions& options) = 0;
 };
 
 class FileManager : IFileManager
 {
 public:
 	FileManager(Compressor& compresor, FileScanner& scanner);
-	void Pack(const fs::path& root, const fs::path& archivePath) override;
-	void Unpack(const fs::path& archivepath, const fs::path& destRoot) override;
+	bool Pack(const fs::path& root, const fs::path& archivePath, const PackOptions& options) override;
+	bool Unpack(const fs::path& archivepath, const fs::path& destRoot, const UnpackOptions& options) override;
+	bool Extract(const fs::path& archivePath, const fs::path& destRoot, const std::vector<std::string>& patterns, const UnpackOptions& options) override;
+	bool List(const fs::path& archivePath) override;
+	bool Cat(const fs::path& archivePath, const std::string& path, uint64_t offset, uint64_t length) override;
+	bool Verify(const fs::path& archivePath, const UnpackOptions& options) override;
 
 private:
 	inline void write_u32(std::ostream& os, uint32_t v) { for (int i = 0; i < 4; i++) os.put((char)((v >> (8 * i)) & 0xFF)); }
 	inline void write_u64(std::ostream& os, uint64_t v) { for (int i = 0; i < 8; i++) os.put((char)((v >> (8 * i)) & 0xFF)); }
-	inline uint32_t read_u32(std::istream& is) { uint32_t v = 0; for (int i = 0; i < 4; i++) { int c = is.get(); if (c == EOF) LOG(Error, "Unexpected EOF"); v |= (uint32_t)c << (8 * i); } return v; }
-	inline uint64_t read_u64(std::istream& is) { uint64_t v = 0; for (int i = 0; i < 8; i++) { int c = is.get(); if (c == EOF) LOG(Error, "Unexpected EOF"); v |= (uint64_t)c << (8 * i); } return v; }
-	
-	void binToHexSHA(std::ifstream& ifstream, std::ostringstream& shaHex);
-	void hexToBinSHA(char* shaBin, const std::string& shaHex);
+	inline void write_varint(std::ostream& os, uint64_t v) { for (; 0x80 <= v; v >>= 7) os.put((char)((v & 0x7F) | 0x80)); os.put((char)v); }
+
+	bool openArchive(const fs::path& archivePath, MappedFile& mapping, std::vector<BlobEntry>& blobs, std::vector<FileMetadata>& files);
+	bool readTables(ByteReader& headerReader, ByteReader& reader, uint64_t archiveSize, std::vector<BlobEntry>& blobs, std::vector<FileMetadata>& files);
+	bool readLegacyTables(std::istream& istream, uint64_t archiveSize, std::vector<BlobEntry>& blobs, std::vector<FileMetadata>& files);
+	bool unpackStream(std::istream& istream, const fs::path& destRoot);
+	bool restoreFiles(const fs::path& archivePath, const MappedFile& mapping, const std::vector<BlobEntry>& blobs, const std::vector<const FileMetadata*>& files, const fs::path& destRoot, const UnpackOptions& options);
+	bool sampleDictionary(const fs::path& root, const std::vector<FileMetadata>& files, const std::vector<std::size_t>& candidates, const PackOptions& options, std::vector<char>& dictionary);
+	bool loadDictionary(const MappedFile& mapping, std::ifstream& ifstream, Compressor& compressor, const std::vector<BlobEntry>& blobs, std::vector<char>& dictionary);
+	bool inflateBlobs(const MappedFile& mapping, std::ifstream& ifstream, Compressor& compressor, const std::vector<BlobEntry>& blobs, const uint32_t* indices, std::size_t count, std::ostream& ostream);
+	bool restoreMetadata(const FileMetadata& file, const fs::path& outPath);
+	static bool globMatch(const char* pattern, const char* path);
+	static bool isSafePath(const std::string& path);
+	static bool createDirectories(const fs::path& path);
 
 private:
 	Compressor& m_compressor;
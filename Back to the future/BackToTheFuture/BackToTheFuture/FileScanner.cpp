@@ -1,15 +1,76 @@
 #include "FileScanner.hpp"
+#include "AsyncFile.hpp"
+#include "Hasher.hpp"
 #include "Logger.hpp"
+#include "ScanCache.hpp"
+#include "Stats.hpp"
+#include "WorkerPool.hpp"
 
-#include <openssl/evp.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
 #include <memory>
+#include <mutex>
+#include <string_view>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// file_time_type clock counts from its own epoch, offset to the Unix epoch in whole seconds
+	std::chrono::nanoseconds fileClockOffset()
+	{
+		auto file = std::chrono::duration_cast<std::chrono::nanoseconds>(fs::file_time_type::clock::now().time_since_epoch());
+		auto system = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch());
+		return std::chrono::round<std::chrono::seconds>(file - system);
+	}
+
+	// directories listed ahead of the walk per worker, bounds the file lists held in memory
+	constexpr std::size_t LIST_AHEAD = 4;
+	// files per batch when scanFiles collects the whole tree
+	constexpr std::size_t COLLECT_BATCH_FILES = 4096;
+
+	// directory on the stack of the depth first walk, workers fill subdirectories and files
+	struct Directory
+	{
+		std::string path;
+		bool queued = false;
+		bool listed = false;
+		std::vector<std::string> subdirectories;
+		ScanBatch files;
+	};
+
+	void appendRecord(ScanBatch& batch, const ScanRecord& record, const char* prefix, std::size_t prefixLength, const char* name)
+	{
+		ScanRecord entry = record;
+		entry.pathOffset = static_cast<uint32_t>(batch.paths.size());
+		entry.pathLength = static_cast<uint32_t>(prefixLength + record.pathLength);
+		batch.paths.insert(batch.paths.end(), prefix, prefix + prefixLength);
+		batch.paths.insert(batch.paths.end(), name, name + record.pathLength);
+		batch.records.push_back(entry);
+	}
+} // anonymous namespace
 
 /**
 * Name: FileScanner::scanFiles
-* Description: gather files recursively, compute SHA-256 and metadata
+* Description: gather files recursively, compute digests and metadata. Directories ahead of the walk are listed on
+*              worker threads, every entry costs one stat. The result is in scanBatches order, per directory and not
+*              one sort by path.
 * @Param root - absolute path to root directory
+* @Param threads - number of scanning and hashing threads, 0 means all hardware threads
+* @Param hashFiles - compute digests, false leaves it to the caller (fused hash and compress)
+* @Param cache - optional digest cache, unchanged files take their digest from it instead of being read
 */
-std::vector<FileMetadata> FileScanner::scanFiles(const fs::path& root)
+std::vector<FileMetadata> FileScanner::scanFiles(const fs::path& root, std::size_t threads, bool hashFiles, ScanCache* cache)
 {
 	LOG(Info, "Entry.");
 
@@ -21,102 +82,372 @@ std::vector<FileMetadata> FileScanner::scanFiles(const fs::path& root)
 		return entries;
 	}
 
-	try
-	{
-		for (const auto& entry : fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied))
+	bool scanned = scanBatches(root, threads, COLLECT_BATCH_FILES, [&](ScanBatch&& batch)
 		{
-			if (!fs::is_regular_file(entry))
+			entries.reserve(entries.size() + batch.records.size());
+			for (const ScanRecord& record : batch.records)
 			{
-				continue;
+				entries.push_back(batch.metadata(record));
 			}
+			return true;
+		});
 
-			FileMetadata fm;
-			fm.path = fs::relative(entry.path(), root).generic_string();
-			fm.sha256 = sha256File(entry.path());
-			fm.size = fs::file_size(entry);
-			fm.readonly = (fs::status(entry).permissions() & fs::perms::owner_write) == fs::perms::none;
-			auto fTime = fs::last_write_time(entry);
-			fm.time = std::chrono::duration_cast<std::chrono::seconds>(fTime.time_since_epoch()).count();
-			entries.emplace_back(fm);
-		}
-
-		std::sort(entries.begin(), entries.end(), [](const FileMetadata& rhs, const FileMetadata& lhs) { return rhs.path < lhs.path; });
-		return entries;
-	}
-	catch (const fs::filesystem_error& error)
+	if (!scanned || !hashFiles)
 	{
-		std::cerr << "Error: " << error.what() << "\n";
+		LOG(Info, "Exit.");
+		return entries;
 	}
 
+	WorkerPool pool(threads);
+	pool.run(entries.size(), [&](std::size_t index, std::size_t)
+		{
+			if (cache && cache->lookup(entries[index], m_hash, 0, entries[index].digest))
+			{
+				cache->store(entries[index], m_hash, 0);
+				return;
+			}
+
+			entries[index].digest = hashFile(root / entries[index].path);
+			if (cache)
+			{
+				cache->store(entries[index], m_hash, 0);
+			}
+		});
+
 	LOG(Info, "Exit.");
 	return entries;
 }
 
 /**
-* Name: FileScanner::sha256File
-* Description: Calculate SHA256 for the given file
-* @Param path - absolute path to file
+* Name: FileScanner::scanBatches
+* Description: Walk the tree depth first and hand its files to the sink in batches of about batchFiles.
+*              Workers list the directories next on the walk stack ahead of it, each directory is sorted by name
+*              and its files come before its subdirectories, so the order does not depend on the thread count.
+*              Memory is bounded by the batch, the directories listed ahead and the walk stack, not by the tree.
+* @Param root - absolute path to root directory
+* @Param threads - number of listing threads, 0 means all hardware threads
+* @Param batchFiles - files per batch, the last batch may be smaller
+* @Param sink - receives the batches in order, returning false stops the walk
 */
-std::string FileScanner::sha256File(const fs::path& path)
+bool FileScanner::scanBatches(const fs::path& root, std::size_t threads, std::size_t batchFiles, const BatchSink& sink)
 {
-	std::ifstream file(path, std::ios::binary);
-	if (!file)
+	LOG(Info, "Entry.");
+
+	std::error_code error;
+	if (!fs::is_directory(root, error))
 	{
-		LOG(Error, "Failed to open file: %s.", path.string().c_str());
-		return std::string();
+		std::cerr << "Error: " << root.string() << " is not a directory\n";
+		return false;
 	}
 
-	auto mdCtx = std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)>(
-		EVP_MD_CTX_new(),
-		&EVP_MD_CTX_free
-	);
+	WorkerPool pool(threads);
+	const std::chrono::nanoseconds clockOffset = fileClockOffset();
+	const std::size_t listAhead = LIST_AHEAD * pool.size();
+
+	std::vector<std::unique_ptr<Directory>> stack;
+	std::deque<Directory*> jobs;
+	bool closed = false;
+	std::mutex mutex;
+	std::condition_variable cv;
+
+	pool.start(pool.size(), [&](std::size_t, std::size_t)
+		{
+			std::unique_lock<std::mutex> lk(mutex);
+			while (true)
+			{
+				cv.wait(lk, [&]() { return closed || !jobs.empty(); });
+				if (jobs.empty())
+				{
+					return;
+				}
 
-	if (!mdCtx.get())
+				Directory* directory = jobs.front();
+				jobs.pop_front();
+				lk.unlock();
+				{
+					Stats::Timer timer(Stat::ScanNanos);
+					listDirectory(root, directory->path, clockOffset, directory->subdirectories, directory->files);
+				}
+				lk.lock();
+				directory->listed = true;
+				cv.notify_all();
+			}
+		});
+
+	bool complete = true;
+	ScanBatch batch;
+	std::string prefix;
+	stack.push_back(std::make_unique<Directory>());
+	while (!stack.empty())
 	{
-		LOG(Error, "Failed to create EVP context");
-		return std::string();
+		std::unique_ptr<Directory> directory;
+		{
+			std::unique_lock<std::mutex> lk(mutex);
+			const std::size_t ahead = std::min(listAhead, stack.size());
+			for (std::size_t i = stack.size() - ahead; i < stack.size(); i++)
+			{
+				if (!stack[i]->queued)
+				{
+					stack[i]->queued = true;
+					jobs.push_back(stack[i].get());
+				}
+			}
+			cv.notify_all();
+
+			directory = std::move(stack.back());
+			stack.pop_back();
+			cv.wait(lk, [&]() { return directory->listed; });
+		}
+
+		// pushed in reverse, so the first subdirectory by name is walked next
+		prefix = directory->path.empty() ? std::string() : directory->path + "/";
+		for (auto it = directory->subdirectories.rbegin(); it != directory->subdirectories.rend(); ++it)
+		{
+			stack.push_back(std::make_unique<Directory>());
+			stack.back()->path = prefix + *it;
+		}
+
+		const ScanBatch& files = directory->files;
+		for (const ScanRecord& record : files.records)
+		{
+			appendRecord(batch, record, prefix.data(), prefix.size(), files.paths.data() + record.pathOffset);
+			Stats::add(Stat::ScanFiles, 1);
+			Stats::add(Stat::ScanBytes, record.size);
+		}
+
+		if (batch.records.size() >= batchFiles)
+		{
+			complete = sink(std::move(batch));
+			batch = ScanBatch();
+			if (!complete)
+			{
+				break;
+			}
+		}
 	}
 
-	if (1 != EVP_DigestInit_ex(mdCtx.get(), EVP_sha256(), nullptr))
+	if (complete && !batch.empty())
 	{
-		LOG(Error, "Failed to init EVP.");
-		return std::string();
+		complete = sink(std::move(batch));
 	}
 
-	const std::size_t bufferSize = 1 << 20;
+	{
+		std::lock_guard<std::mutex> lk(mutex);
+		closed = true;
+		jobs.clear();
+	}
+	cv.notify_all();
+	pool.wait();
 
-	std::vector<char> buffer(bufferSize);
+	LOG(Info, "Exit.");
+	return complete;
+}
 
-	while (file)
+/**
+* Name: FileScanner::listDirectory
+* Description: Read one directory, collect the names of its subdirectories and its regular files, both sorted by name.
+*              Symbolic links to files are followed, links to directories are not, unreadable directories are skipped.
+* @Param root - absolute path to root directory
+* @Param directory - directory relative to the root, empty for the root itself
+* @Param clockOffset - offset of the file_time_type clock to the Unix epoch
+* @Param subdirectories - output subdirectory names
+* @Param files - output files, their paths are names only
+*/
+void FileScanner::listDirectory(const fs::path& root, const std::string& directory, std::chrono::nanoseconds clockOffset, std::vector<std::string>& subdirectories, ScanBatch& files)
+{
+	auto addFile = [&](std::string_view name, ScanRecord& record)
+		{
+			record.pathOffset = static_cast<uint32_t>(files.paths.size());
+			record.pathLength = static_cast<uint32_t>(name.size());
+			files.paths.insert(files.paths.end(), name.begin(), name.end());
+			files.records.push_back(record);
+		};
+
+#if defined(_WIN32)
+	(void)clockOffset;
+
+	std::error_code error;
+	fs::directory_iterator it(root / fs::u8path(directory), fs::directory_options::skip_permission_denied, error);
+	if (error)
 	{
-		file.read(buffer.data(), bufferSize);
-		std::streamsize streamSize = file.gcount();
+		LOG(Warn, "Cannot read directory %s.", directory.c_str());
+		return;
+	}
 
-		if (0 < streamSize)
+	// directory entries carry the attributes FindNextFile returned, no extra call per file
+	for (fs::directory_iterator end; it != end && !error; it.increment(error))
+	{
+		const fs::directory_entry& entry = *it;
+		std::string name = entry.path().filename().u8string();
+		if (entry.is_directory(error) && !entry.is_symlink(error))
 		{
-			if (1 != EVP_DigestUpdate(mdCtx.get(), buffer.data(), streamSize))
-			{
-				LOG(Error, "Update failed.");
-			}
+			subdirectories.push_back(std::move(name));
+			continue;
+		}
+
+		if (!entry.is_regular_file(error))
+		{
+			continue;
+		}
+
+		ScanRecord record = {};
+		record.size = entry.file_size(error);
+		record.readonly = (entry.status(error).permissions() & fs::perms::owner_write) == fs::perms::none;
+		record.time = std::chrono::floor<std::chrono::seconds>(entry.last_write_time(error).time_since_epoch()).count();
+		readSignature(entry.path(), record.signature);
+		addFile(name, record);
+	}
+#else
+	fs::path directoryPath = directory.empty() ? root : root / directory;
+	DIR* dir = opendir(directoryPath.c_str());
+	if (!dir)
+	{
+		if (EACCES != errno)
+		{
+			LOG(Warn, "Cannot read directory %s.", directoryPath.c_str());
+		}
+		return;
+	}
+
+	int dirFd = dirfd(dir);
+	while (const dirent* entry = readdir(dir))
+	{
+		const char* name = entry->d_name;
+		if ('.' == name[0] && ('\0' == name[1] || ('.' == name[1] && '\0' == name[2])))
+		{
+			continue;
+		}
+
+		if (DT_DIR == entry->d_type)
+		{
+			subdirectories.push_back(name);
+			continue;
+		}
+
+		// one stat per entry, links are followed to their target so only links to files end up in the archive
+		struct stat st;
+		if (DT_REG != entry->d_type && DT_LNK != entry->d_type && DT_UNKNOWN != entry->d_type)
+		{
+			continue;
+		}
+		if (0 != fstatat(dirFd, name, &st, DT_LNK == entry->d_type ? 0 : AT_SYMLINK_NOFOLLOW))
+		{
+			continue;
+		}
+
+		if (DT_UNKNOWN == entry->d_type && S_ISDIR(st.st_mode))
+		{
+			subdirectories.push_back(name);
+			continue;
+		}
+		if (DT_UNKNOWN == entry->d_type && S_ISLNK(st.st_mode) && 0 != fstatat(dirFd, name, &st, 0))
+		{
+			continue;
+		}
+		if (!S_ISREG(st.st_mode))
+		{
+			continue;
 		}
+
+		ScanRecord record = {};
+		record.size = static_cast<uint64_t>(st.st_size);
+		record.readonly = 0 == (st.st_mode & S_IWUSR);
+		record.signature.device = static_cast<uint64_t>(st.st_dev);
+		record.signature.inode = static_cast<uint64_t>(st.st_ino);
+		record.signature.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+		record.signature.ctime = static_cast<int64_t>(st.st_ctim.tv_sec) * 1'000'000'000 + st.st_ctim.tv_nsec;
+		record.time = std::chrono::floor<std::chrono::seconds>(std::chrono::nanoseconds(record.signature.mtime) + clockOffset).count();
+		addFile(name, record);
 	}
 
-	std::vector<unsigned char> hash(EVP_MAX_MD_SIZE);
-	unsigned int hashLen = 0;
+	closedir(dir);
+#endif
+
+	std::sort(subdirectories.begin(), subdirectories.end());
+
+	// names are sorted through a permutation, the arena stays as it was read
+	const char* names = files.paths.data();
+	std::sort(files.records.begin(), files.records.end(), [names](const ScanRecord& rhs, const ScanRecord& lhs)
+		{
+			return std::string_view(names + rhs.pathOffset, rhs.pathLength) < std::string_view(names + lhs.pathOffset, lhs.pathLength);
+		});
+}
 
-	if (1 != EVP_DigestFinal_ex(mdCtx.get(), hash.data(), &hashLen))
+/**
+* Name: FileScanner::readSignature
+* Description: Read device, inode and change times of a file, used to tell whether its cached digest is still valid
+* @Param path - absolute path to file
+* @Param signature - output signature
+*/
+bool FileScanner::readSignature(const fs::path& path, FileSignature& signature)
+{
+#if defined(_WIN32)
+	// no inode and second resolution only, size and both times still catch ordinary edits
+	struct _stat64 st;
+	if (0 != _wstat64(path.c_str(), &st))
 	{
-		LOG(Error, "Update failed.");
-		return std::string();
+		return false;
 	}
+	signature.device = static_cast<uint64_t>(st.st_dev);
+	signature.inode = static_cast<uint64_t>(st.st_ino);
+	signature.mtime = static_cast<int64_t>(st.st_mtime) * 1'000'000'000;
+	signature.ctime = static_cast<int64_t>(st.st_ctime) * 1'000'000'000;
+#else
+	struct stat st;
+	if (0 != ::stat(path.c_str(), &st))
+	{
+		return false;
+	}
+	signature.device = static_cast<uint64_t>(st.st_dev);
+	signature.inode = static_cast<uint64_t>(st.st_ino);
+	signature.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+	signature.ctime = static_cast<int64_t>(st.st_ctim.tv_sec) * 1'000'000'000 + st.st_ctim.tv_nsec;
+#endif
+	return true;
+}
 
-	std::ostringstream ss;
-	ss << std::hex << std::setfill('0');
+/**
+* Name: FileScanner::hashFile
+* Description: Calculate digest of the given file with the selected hash
+* @Param path - absolute path to file
+*/
+Digest FileScanner::hashFile(const fs::path& path)
+{
+	InputFile file(path);
+	if (!file)
+	{
+		LOG(Error, "Failed to open file: %s.", path.string().c_str());
+		return Digest();
+	}
+
+	std::unique_ptr<IHasher> hasher = createHasher(m_hash);
+	if (!hasher)
+	{
+		return Digest();
+	}
+
+	// small buffer, most files are small and it is allocated for every file
+	const std::size_t bufferSize = 64 << 10;
+
+	std::vector<char> buffer(bufferSize);
 
-	for (unsigned int i = 0; i < hashLen; ++i)
+	while (file)
 	{
-		ss << std::setw(2) << static_cast<int>(hash[i]);
+		std::streamsize streamSize;
+		{
+			Stats::Timer timer(Stat::ReadNanos);
+			file.read(buffer.data(), bufferSize);
+			streamSize = file.gcount();
+		}
+
+		if (0 < streamSize)
+		{
+			Stats::Timer timer(Stat::HashNanos);
+			hasher->update(buffer.data(), streamSize);
+		}
+		Stats::add(Stat::ReadBytes, static_cast<uint64_t>(streamSize));
+		Stats::add(Stat::HashBytes, static_cast<uint64_t>(streamSize));
 	}
 
-	return ss.str();
+	return hasher->finalDigest();
 }
@@ -1,25 +1,99 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <string>
 #include <vector>
 
+#include "Hasher.hpp"
+
 namespace fs = std::filesystem;
 
+class ScanCache;
+
+// stat fields which change whenever file content may have changed, times in nanoseconds since the epoch
+struct FileSignature
+{
+	uint64_t device = 0;
+	uint64_t inode = 0;
+	int64_t mtime = 0;
+	int64_t ctime = 0;
+};
+
 struct FileMetadata
 {
 	std::string path;
-	std::string sha256;
+	Digest digest;
 	std::size_t size;
 	bool readonly;
 	int64_t time;
+	std::vector<uint32_t> blobs;
+	FileSignature signature;
+};
+
+// fixed size scan entry, its path is a slice of the arena of its batch
+struct ScanRecord
+{
+	uint64_t size;
+	int64_t time;
+	FileSignature signature;
+	uint32_t pathOffset;
+	uint32_t pathLength;
+	bool readonly;
 };
 
+/**
+* Name: ScanBatch
+* Description: Files of consecutive directories in scan order. Records are fixed size and all paths share one arena,
+*              so a batch costs two allocations however many files it holds.
+*/
+struct ScanBatch
+{
+	std::vector<ScanRecord> records;
+	std::vector<char> paths;
+
+	bool empty() const { return records.empty(); }
+
+	std::string path(const ScanRecord& record) const
+	{
+		return std::string(paths.data() + record.pathOffset, record.pathLength);
+	}
+
+	FileMetadata metadata(const ScanRecord& record) const
+	{
+		FileMetadata file;
+		file.path = path(record);
+		file.size = static_cast<std::size_t>(record.size);
+		file.readonly = record.readonly;
+		file.time = record.time;
+		file.signature = record.signature;
+		return file;
+	}
+};
+
+/**
+* Name: FileScanner
+* Description: Depth first directory walk which hands out files in bounded batches. Worker threads list the
+*              directories next on the walk stack, the walk consumes them in order, so the file order is fixed:
+*              each directory sorted by name, its files before its subdirectories.
+*/
 class FileScanner
 {
 public:
-	std::vector<FileMetadata> scanFiles(const fs::path& root);
+	// receives every full batch, returning false stops the scan
+	using BatchSink = std::function<bool(ScanBatch&& batch)>;
+
+	std::vector<FileMetadata> scanFiles(const fs::path& root, std::size_t threads = 1, bool hashFiles = true, ScanCache* cache = nullptr);
+	bool scanBatches(const fs::path& root, std::size_t threads, std::size_t batchFiles, const BatchSink& sink);
+	static bool readSignature(const fs::path& path, FileSignature& signature);
+	void setHash(HashId hash) { m_hash = hash; }
+	Digest hashFile(const fs::path& path);
 
 private:
-	std::string sha256File(const fs::path& path);
+	void listDirectory(const fs::path& root, const std::string& directory, std::chrono::nanoseconds clockOffset, std::vector<std::string>& subdirectories, ScanBatch& files);
+
+	HashId m_hash = HashId::Sha256;
 
 };
\ No newline at end of file
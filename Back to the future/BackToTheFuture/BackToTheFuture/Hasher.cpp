@@ -0,0 +1,197 @@
+#include "Hasher.hpp"
+#include "Blake3Hasher.hpp"
+#include "LibBlake3Hasher.hpp"
+#include "Logger.hpp"
+#include "Xxh3Hasher.hpp"
+
+/**
+* Name: Sha256Hasher::Sha256Hasher
+* Description: Constructor, initializes EVP SHA256 context
+*/
+Sha256Hasher::Sha256Hasher() :
+	m_mdCtx(EVP_MD_CTX_new(), &EVP_MD_CTX_free), m_ok(false)
+{
+	if (!m_mdCtx.get())
+	{
+		LOG(Error, "Failed to create EVP context");
+		return;
+	}
+
+	if (1 != EVP_DigestInit_ex(m_mdCtx.get(), EVP_sha256(), nullptr))
+	{
+		LOG(Error, "Failed to init EVP.");
+		return;
+	}
+
+	m_ok = true;
+}
+
+/**
+* Name: Sha256Hasher::update
+* Description: Feed next part of the data to the digest
+* @Param data - pointer to data
+* @Param size - data size in bytes
+*/
+bool Sha256Hasher::update(const void* data, std::size_t size)
+{
+	if (m_ok && 1 != EVP_DigestUpdate(m_mdCtx.get(), data, size))
+	{
+		LOG(Error, "Update failed.");
+		m_ok = false;
+	}
+	return m_ok;
+}
+
+/**
+* Name: Sha256Hasher::finalDigest
+* Description: Finish digest, empty digest on failure
+*/
+Digest Sha256Hasher::finalDigest()
+{
+	Digest digest;
+	if (!m_ok)
+	{
+		return digest;
+	}
+
+	unsigned char hash[EVP_MAX_MD_SIZE];
+	unsigned int hashLen = 0;
+
+	m_ok = false;
+	if (1 != EVP_DigestFinal_ex(m_mdCtx.get(), hash, &hashLen) || MAX_DIGEST_SIZE < hashLen)
+	{
+		LOG(Error, "Final failed.");
+		return digest;
+	}
+
+	digest.assign(hash, hashLen);
+	return digest;
+}
+
+/**
+* Name: createHasher
+* Description: Create hasher for the content hash, nullptr when it is not built in
+* @Param id - hash id
+*/
+std::unique_ptr<IHasher> createHasher(HashId id)
+{
+	switch (id)
+	{
+	case HashId::Sha256:
+		return std::make_unique<Sha256Hasher>();
+	case HashId::Blake3:
+#if defined(BTTF_WITH_BLAKE3)
+		return std::make_unique<LibBlake3Hasher>();
+#else
+		return std::make_unique<Blake3Hasher>();
+#endif
+#if defined(BTTF_WITH_XXHASH)
+	case HashId::Xxh3_128:
+		return std::make_unique<Xxh3Hasher>();
+#endif
+	default:
+		LOG(Error, "Hash %u is not available in this build.", static_cast<uint32_t>(id));
+		return nullptr;
+	}
+}
+
+/**
+* Name: isHashAvailable
+* Description: Check whether the content hash is built in
+* @Param id - hash id
+*/
+bool isHashAvailable(HashId id)
+{
+	switch (id)
+	{
+	case HashId::Sha256:
+	case HashId::Blake3:
+		return true;
+#if defined(BTTF_WITH_XXHASH)
+	case HashId::Xxh3_128:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+/**
+* Name: digestSize
+* Description: Digest size in bytes, known for every hash id even when it is not built in, 0 for unknown ids
+* @Param id - hash id
+*/
+std::size_t digestSize(HashId id)
+{
+	switch (id)
+	{
+	case HashId::Sha256: return 32;
+	case HashId::Blake3: return 32;
+	case HashId::Xxh3_128: return 16;
+	default: return 0;
+	}
+}
+
+/**
+* Name: parseHashName
+* Description: Map hash name used on the command line to hash id
+* @Param name - hash name
+* @Param id - output hash id
+*/
+bool parseHashName(const std::string& name, HashId& id)
+{
+	for (HashId candidate : { HashId::Sha256, HashId::Blake3, HashId::Xxh3_128 })
+	{
+		if (name == hashName(candidate))
+		{
+			id = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+* Name: hashName
+* Description: Hash name used on the command line
+* @Param id - hash id
+*/
+const char* hashName(HashId id)
+{
+	switch (id)
+	{
+	case HashId::Sha256: return "sha256";
+	case HashId::Blake3: return "blake3";
+	case HashId::Xxh3_128: return "xxh3";
+	default: return "unknown";
+	}
+}
+
+/**
+* Name: toHex
+* Description: Lower case hex string of the bytes
+* @Param data - bytes
+* @Param size - number of bytes
+*/
+std::string toHex(const unsigned char* data, std::size_t size)
+{
+	static const char* HEX = "0123456789abcdef";
+
+	std::string hex(2 * size, '0');
+	for (std::size_t i = 0; i < size; i++)
+	{
+		hex[2 * i] = HEX[data[i] >> 4];
+		hex[2 * i + 1] = HEX[data[i] & 0x0F];
+	}
+	return hex;
+}
+
+/**
+* Name: toHex
+* Description: Lower case hex string of a digest
+* @Param digest - binary digest
+*/
+std::string toHex(const Digest& digest)
+{
+	return toHex(digest.bytes, digest.size);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <openssl/evp.h>
+
+// content hash stored in the archive header, values must never change
+enum class HashId : uint32_t
+{
+	Sha256 = 0,
+	Blake3 = 1,
+	Xxh3_128 = 2,
+};
+
+// largest binary digest of all hashes
+constexpr std::size_t MAX_DIGEST_SIZE = 32;
+
+// binary digest kept by value, size 0 marks a failed or missing digest
+struct Digest
+{
+	unsigned char bytes[MAX_DIGEST_SIZE] = {};
+	uint8_t size = 0;
+
+	bool empty() const { return 0 == size; }
+	void clear() { size = 0; }
+	void assign(const void* data, std::size_t count)
+	{
+		size = static_cast<uint8_t>(count);
+		std::memcpy(bytes, data, count);
+	}
+
+	bool operator==(const Digest& other) const { return size == other.size && 0 == std::memcmp(bytes, other.bytes, size); }
+	bool operator!=(const Digest& other) const { return !(*this == other); }
+};
+
+class IHasher
+{
+public:
+	virtual ~IHasher() = default;
+
+	virtual bool update(const void* data, std::size_t size) = 0;
+	virtual Digest finalDigest() = 0;
+};
+
+class Sha256Hasher : public IHasher
+{
+public:
+	Sha256Hasher();
+	bool update(const void* data, std::size_t size) override;
+	Digest finalDigest() override;
+
+private:
+	std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> m_mdCtx;
+	bool m_ok;
+};
+
+std::unique_ptr<IHasher> createHasher(HashId id);
+bool isHashAvailable(HashId id);
+std::size_t digestSize(HashId id);
+bool parseHashName(const std::string& name, HashId& id);
+const char* hashName(HashId id);
+std::string toHex(const unsigned char* data, std::size_t size);
+std::string toHex(const Digest& digest);
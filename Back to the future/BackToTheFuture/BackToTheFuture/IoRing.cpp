@@ -0,0 +1,317 @@
+#include "IoRing.hpp"
+
+#if defined(BTTF_WITH_URING)
+
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace
+{
+	// every block may be in flight at once, the rest is headroom
+	constexpr unsigned RING_ENTRIES = 16;
+
+	std::atomic<bool> unavailable{ false };
+
+	int ioUringSetup(unsigned entries, io_uring_params* params)
+	{
+		return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+	}
+
+	int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+	{
+		return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+	}
+
+	int ioUringRegister(int fd, unsigned opcode, const void* arg, unsigned count)
+	{
+		return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+	}
+} // anonymous namespace
+
+/**
+* Name: IoRing::forThread
+* Description: Ring of the calling thread, created on first use. Once setup fails (old kernel, seccomp) no thread
+*              tries again and callers fall back to blocking I/O.
+*/
+IoRing* IoRing::forThread()
+{
+	thread_local std::unique_ptr<IoRing> ring;
+	if (ring || unavailable)
+	{
+		return ring.get();
+	}
+
+	ring.reset(new IoRing());
+	if (!ring->init(RING_ENTRIES))
+	{
+		LOG(Warn, "io_uring is not available, using blocking I/O.");
+		unavailable = true;
+		ring.reset();
+	}
+	return ring.get();
+}
+
+/**
+* Name: IoRing::~IoRing
+* Description: Destructor, unmaps the rings and the blocks and closes the ring
+*/
+IoRing::~IoRing()
+{
+	if (m_blocks)
+	{
+		munmap(m_blocks, (READ_BLOCKS + WRITE_BLOCKS) * BLOCK_BYTES);
+	}
+	if (m_sqes)
+	{
+		munmap(m_sqes, m_sqesSize);
+	}
+	if (m_cqRing && m_cqRing != m_sqRing)
+	{
+		munmap(m_cqRing, m_cqRingSize);
+	}
+	if (m_sqRing)
+	{
+		munmap(m_sqRing, m_sqRingSize);
+	}
+	if (0 <= m_fd)
+	{
+		::close(m_fd);
+	}
+}
+
+/**
+* Name: IoRing::init
+* Description: Set up the ring, map its queues and register the block buffers, unregistered blocks still work
+*              with plain read and write requests
+* @Param entries - submission queue size
+*/
+bool IoRing::init(unsigned entries)
+{
+	io_uring_params params{};
+	m_fd = ioUringSetup(entries, &params);
+	if (0 > m_fd)
+	{
+		return false;
+	}
+
+	m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	bool single = 0 != (params.features & IORING_FEAT_SINGLE_MMAP);
+	if (single)
+	{
+		m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+	}
+
+	m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == m_sqRing)
+	{
+		m_sqRing = nullptr;
+		return false;
+	}
+
+	m_cqRing = single ? m_sqRing : mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+	if (MAP_FAILED == m_cqRing)
+	{
+		m_cqRing = nullptr;
+		return false;
+	}
+
+	m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	m_sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+	if (MAP_FAILED == m_sqes)
+	{
+		m_sqes = nullptr;
+		return false;
+	}
+
+	char* sq = static_cast<char*>(m_sqRing);
+	char* cq = static_cast<char*>(m_cqRing);
+	m_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	m_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	m_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	m_cqes = cq + params.cq_off.cqes;
+
+	// page aligned, which also satisfies O_DIRECT
+	void* blocks = mmap(nullptr, (READ_BLOCKS + WRITE_BLOCKS) * BLOCK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == blocks)
+	{
+		return false;
+	}
+	m_blocks = static_cast<char*>(blocks);
+
+	iovec vectors[READ_BLOCKS + WRITE_BLOCKS];
+	for (std::size_t i = 0; i < READ_BLOCKS + WRITE_BLOCKS; i++)
+	{
+		vectors[i].iov_base = block(i);
+		vectors[i].iov_len = BLOCK_BYTES;
+	}
+	m_fixed = 0 == ioUringRegister(m_fd, IORING_REGISTER_BUFFERS, vectors, READ_BLOCKS + WRITE_BLOCKS);
+	return true;
+}
+
+/**
+* Name: IoRing::acquireReader
+* Description: Lend the read blocks, fails while another input file of this thread holds them
+*/
+bool IoRing::acquireReader()
+{
+	if (m_readerBusy)
+	{
+		return false;
+	}
+	m_readerBusy = true;
+	return true;
+}
+
+/**
+* Name: IoRing::acquireWriter
+* Description: Lend the write blocks, fails while another output file of this thread holds them
+*/
+bool IoRing::acquireWriter()
+{
+	if (m_writerBusy)
+	{
+		return false;
+	}
+	m_writerBusy = true;
+	return true;
+}
+
+/**
+* Name: IoRing::queueRead
+* Description: Queue read of request.length bytes at request.offset into the request block
+* @Param fd - file descriptor
+* @Param request - request with its block, offset and length
+*/
+bool IoRing::queueRead(int fd, Request& request)
+{
+	return queue(m_fixed ? IORING_OP_READ_FIXED : IORING_OP_READ, fd, request);
+}
+
+/**
+* Name: IoRing::queueWrite
+* Description: Queue write of request.length bytes from the request block at request.offset
+* @Param fd - file descriptor
+* @Param request - request with its block, offset and length
+*/
+bool IoRing::queueWrite(int fd, Request& request)
+{
+	return queue(m_fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd, request);
+}
+
+/**
+* Name: IoRing::queue
+* Description: Fill the next submission entry, it reaches the kernel with the next submit or wait
+* @Param opcode - io_uring operation
+* @Param fd - file descriptor
+* @Param request - request, completed in place
+*/
+bool IoRing::queue(uint8_t opcode, int fd, Request& request)
+{
+	unsigned tail = *m_sqTail;
+	if (tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) > m_sqMask && !submit())
+	{
+		return false;
+	}
+
+	io_uring_sqe* sqe = static_cast<io_uring_sqe*>(m_sqes) + (tail & m_sqMask);
+	std::memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uint64_t>(request.data);
+	sqe->len = request.length;
+	sqe->off = request.offset;
+	sqe->buf_index = static_cast<uint16_t>(request.block);
+	sqe->user_data = reinterpret_cast<uint64_t>(&request);
+
+	m_sqArray[tail & m_sqMask] = tail & m_sqMask;
+	__atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+	request.pending = true;
+	m_queued++;
+	return true;
+}
+
+/**
+* Name: IoRing::submit
+* Description: Hand queued requests to the kernel without waiting for them
+*/
+bool IoRing::submit()
+{
+	while (0 < m_queued)
+	{
+		int submitted = ioUringEnter(m_fd, m_queued, 0, 0);
+		if (0 > submitted)
+		{
+			if (EINTR == errno || EAGAIN == errno || EBUSY == errno)
+			{
+				reap();
+				continue;
+			}
+			LOG(Error, "io_uring submit failed: %s.", std::strerror(errno));
+			return false;
+		}
+		m_queued -= static_cast<unsigned>(submitted);
+	}
+	return true;
+}
+
+/**
+* Name: IoRing::wait
+* Description: Wait until the request completes, completions of other requests are stored on the way
+* @Param request - queued request
+*/
+bool IoRing::wait(Request& request)
+{
+	if (!submit())
+	{
+		return false;
+	}
+
+	reap();
+	while (request.pending)
+	{
+		if (0 > ioUringEnter(m_fd, 0, 1, IORING_ENTER_GETEVENTS) && EINTR != errno)
+		{
+			LOG(Error, "io_uring wait failed: %s.", std::strerror(errno));
+			return false;
+		}
+		reap();
+	}
+	return true;
+}
+
+/**
+* Name: IoRing::reap
+* Description: Move all available completions into their requests
+*/
+void IoRing::reap()
+{
+	unsigned head = *m_cqHead;
+	unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++)
+	{
+		const io_uring_cqe& cqe = static_cast<const io_uring_cqe*>(m_cqes)[head & m_cqMask];
+		Request* request = reinterpret_cast<Request*>(cqe.user_data);
+		request->result = cqe.res;
+		request->pending = false;
+	}
+	__atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+}
+
+#endif // BTTF_WITH_URING
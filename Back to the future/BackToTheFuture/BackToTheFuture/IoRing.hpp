@@ -0,0 +1,81 @@
+#pragma once
+
+#if defined(BTTF_WITH_URING)
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+* Name: IoRing
+* Description: Minimal io_uring on raw system calls, one per thread. It owns aligned block buffers registered with
+*              the kernel, the first READ_BLOCKS serve one input file and the rest one output file at a time.
+*              Requests complete into their Request, so readers and writers of the same thread can wait independently.
+*/
+class IoRing
+{
+public:
+	static constexpr std::size_t BLOCK_BYTES = 256 << 10;
+	static constexpr std::size_t READ_BLOCKS = 4;
+	static constexpr std::size_t WRITE_BLOCKS = 4;
+
+	struct Request
+	{
+		char* data = nullptr;
+		unsigned block = 0;
+		uint64_t offset = 0;
+		uint32_t length = 0;
+		int32_t result = 0;
+		bool pending = false;
+	};
+
+	// ring of the calling thread, nullptr when io_uring is not available
+	static IoRing* forThread();
+
+	~IoRing();
+	IoRing(const IoRing&) = delete;
+	IoRing& operator=(const IoRing&) = delete;
+
+	char* block(std::size_t index) const { return m_blocks + index * BLOCK_BYTES; }
+
+	// block sets are lent to one reader and one writer at a time
+	bool acquireReader();
+	void releaseReader() { m_readerBusy = false; }
+	bool acquireWriter();
+	void releaseWriter() { m_writerBusy = false; }
+
+	bool queueRead(int fd, Request& request);
+	bool queueWrite(int fd, Request& request);
+	bool submit();
+	bool wait(Request& request);
+
+private:
+	IoRing() = default;
+	bool init(unsigned entries);
+	bool queue(uint8_t opcode, int fd, Request& request);
+	void reap();
+
+	int m_fd = -1;
+	void* m_sqRing = nullptr;
+	std::size_t m_sqRingSize = 0;
+	void* m_cqRing = nullptr;
+	std::size_t m_cqRingSize = 0;
+	void* m_sqes = nullptr;
+	std::size_t m_sqesSize = 0;
+
+	unsigned* m_sqHead = nullptr;
+	unsigned* m_sqTail = nullptr;
+	unsigned m_sqMask = 0;
+	unsigned* m_sqArray = nullptr;
+	unsigned* m_cqHead = nullptr;
+	unsigned* m_cqTail = nullptr;
+	unsigned m_cqMask = 0;
+	void* m_cqes = nullptr;
+
+	unsigned m_queued = 0;
+	char* m_blocks = nullptr;
+	bool m_fixed = false;
+	bool m_readerBusy = false;
+	bool m_writerBusy = false;
+};
+
+#endif // BTTF_WITH_URING
@@ -0,0 +1,40 @@
+#include "LibBlake3Hasher.hpp"
+
+#if defined(BTTF_WITH_BLAKE3)
+
+/**
+* Name: LibBlake3Hasher::LibBlake3Hasher
+* Description: Constructor, initializes the libblake3 state, the library picks its own SIMD path
+*/
+LibBlake3Hasher::LibBlake3Hasher()
+{
+	blake3_hasher_init(&m_hasher);
+}
+
+/**
+* Name: LibBlake3Hasher::update
+* Description: Feed next part of the data to the digest
+* @Param data - pointer to data
+* @Param size - data size in bytes
+*/
+bool LibBlake3Hasher::update(const void* data, std::size_t size)
+{
+	blake3_hasher_update(&m_hasher, data, size);
+	return true;
+}
+
+/**
+* Name: LibBlake3Hasher::finalDigest
+* Description: Finish 32 byte digest
+*/
+Digest LibBlake3Hasher::finalDigest()
+{
+	uint8_t out[BLAKE3_OUT_LEN];
+	blake3_hasher_finalize(&m_hasher, out, sizeof(out));
+
+	Digest digest;
+	digest.assign(out, sizeof(out));
+	return digest;
+}
+
+#endif // BTTF_WITH_BLAKE3
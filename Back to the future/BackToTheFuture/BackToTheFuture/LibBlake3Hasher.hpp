@@ -0,0 +1,21 @@
+#pragma once
+
+#if defined(BTTF_WITH_BLAKE3)
+
+#include <blake3.h>
+
+#include "Hasher.hpp"
+
+class LibBlake3Hasher : public IHasher
+{
+public:
+	LibBlake3Hasher();
+
+	bool update(const void* data, std::size_t size) override;
+	Digest finalDigest() override;
+
+private:
+	blake3_hasher m_hasher;
+};
+
+#endif // BTTF_WITH_BLAKE3
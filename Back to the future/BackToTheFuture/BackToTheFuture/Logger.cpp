@@ -0,0 +1,459 @@
+#include "Logger.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+
+namespace
+{
+    // the drain thread also wakes up when a ring is half full or a warning arrives
+    constexpr auto DRAIN_INTERVAL = std::chrono::milliseconds(10);
+
+    int64_t nowNanos()
+    {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+    }
+
+    const char* levelToString(LogLevel l)
+    {
+        switch (l)
+        {
+        case LogLevel::Debug: return "DBG";
+        case LogLevel::Info:  return "INF";
+        case LogLevel::Warn:  return "WRN";
+        case LogLevel::Error: return "ERR";
+        default: return "UNK";
+        }
+    }
+
+    void appendTime(int64_t nanos, std::string& out)
+    {
+        std::time_t tt = static_cast<std::time_t>(nanos / 1000000000);
+        int ms = static_cast<int>(nanos / 1000000 % 1000);
+
+        std::tm tm_buf;
+#if defined(_WIN32)
+        localtime_s(&tm_buf, &tt);
+#else
+        localtime_r(&tt, &tm_buf);
+#endif
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d.%03d",
+            tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
+            tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec, ms);
+        out += buf;
+    }
+
+    /**
+    * Name: Arguments
+    * Description: Reader of the tagged arguments of a record
+    */
+    class Arguments
+    {
+    public:
+        explicit Arguments(const LogRecord& record) : m_record(record) {}
+
+        bool next(LogRecord::Tag& tag, uint64_t& bits, std::string& text)
+        {
+            if (m_offset >= m_record.used)
+            {
+                return false;
+            }
+            tag = static_cast<LogRecord::Tag>(m_record.payload[m_offset++]);
+            if (LogRecord::String == tag)
+            {
+                uint16_t length;
+                std::memcpy(&length, m_record.payload + m_offset, sizeof(length));
+                text.assign(m_record.payload + m_offset + sizeof(length), length);
+                m_offset += sizeof(length) + length;
+                return true;
+            }
+            // every other tag is 8 bytes wide
+            std::memcpy(&bits, m_record.payload + m_offset, sizeof(bits));
+            m_offset += sizeof(bits);
+            return true;
+        }
+
+    private:
+        const LogRecord& m_record;
+        std::size_t m_offset = 0;
+    };
+
+    double asDouble(LogRecord::Tag tag, uint64_t bits)
+    {
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        if (LogRecord::Double == tag)
+        {
+            return value;
+        }
+        return LogRecord::Int == tag ? static_cast<double>(static_cast<int64_t>(bits)) : static_cast<double>(bits);
+    }
+
+    uint64_t asInteger(LogRecord::Tag tag, uint64_t bits)
+    {
+        return LogRecord::Double == tag ? static_cast<uint64_t>(static_cast<int64_t>(asDouble(tag, bits))) : bits;
+    }
+
+    /**
+    * Name: formatMessage
+    * Description: printf formatting of the deferred arguments. Length modifiers of the format are replaced by the
+    *              widths the arguments were stored with, * widths are not supported.
+    * @Param record - record with format and arguments
+    * @Param out - message is appended here
+    */
+    void formatMessage(const LogRecord& record, std::string& out)
+    {
+        Arguments arguments(record);
+        char buffer[512];
+        std::string text;
+        for (const char* p = record.fmt; *p; p++)
+        {
+            if ('%' != *p)
+            {
+                out += *p;
+                continue;
+            }
+            if ('%' == p[1])
+            {
+                out += '%';
+                p++;
+                continue;
+            }
+
+            std::string spec("%");
+            const char* q = p + 1;
+            while (*q && std::strchr("-+ #0123456789.", *q))
+            {
+                spec += *q++;
+            }
+            while (*q && std::strchr("hlLqjzt", *q))
+            {
+                q++;
+            }
+            char conversion = *q;
+            if (!conversion)
+            {
+                out.append(p);
+                return;
+            }
+            p = q;
+
+            LogRecord::Tag tag;
+            uint64_t bits = 0;
+            if (!arguments.next(tag, bits, text))
+            {
+                out += spec + conversion;
+                continue;
+            }
+
+            if (LogRecord::String == tag)
+            {
+                if ('s' == conversion)
+                {
+                    std::snprintf(buffer, sizeof(buffer), (spec + 's').c_str(), text.c_str());
+                    out += buffer;
+                }
+                else
+                {
+                    out += text;
+                }
+                continue;
+            }
+
+            switch (conversion)
+            {
+            case 'd': case 'i':
+                std::snprintf(buffer, sizeof(buffer), (spec + "ll" + conversion).c_str(), static_cast<long long>(asInteger(tag, bits)));
+                break;
+            case 'o': case 'u': case 'x': case 'X':
+                std::snprintf(buffer, sizeof(buffer), (spec + "ll" + conversion).c_str(), static_cast<unsigned long long>(asInteger(tag, bits)));
+                break;
+            case 'c':
+                std::snprintf(buffer, sizeof(buffer), (spec + 'c').c_str(), static_cast<int>(asInteger(tag, bits)));
+                break;
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+                std::snprintf(buffer, sizeof(buffer), (spec + conversion).c_str(), asDouble(tag, bits));
+                break;
+            case 'p':
+                std::snprintf(buffer, sizeof(buffer), "%p", reinterpret_cast<void*>(static_cast<uintptr_t>(bits)));
+                break;
+            default:
+                std::snprintf(buffer, sizeof(buffer), "%s", "?");
+                break;
+            }
+            out += buffer;
+        }
+    }
+} // anonymous namespace
+
+/**
+* Name: Logger::Logger
+* Description: Constructor, starts the drain thread. Debug builds log everything, others warnings and errors until
+*              setMinLevel says otherwise.
+*/
+Logger::Logger() :
+#if defined(_DEBUG)
+    minLevel_(static_cast<int>(LogLevel::Debug))
+#else
+    minLevel_(static_cast<int>(LogLevel::Warn))
+#endif
+{
+    running_ = true;
+    drainThread_ = std::thread(&Logger::drainLoop, this);
+}
+
+/**
+* Name: Logger::~Logger
+* Description: Destructor, stops the drain thread and writes what is left. Later messages are written directly.
+*/
+Logger::~Logger()
+{
+    {
+        std::lock_guard<std::mutex> lk(drainMutex_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    drainThread_.join();
+
+    std::lock_guard<std::mutex> lk(drainMutex_);
+    running_ = false;
+    drain();
+}
+
+/**
+* Name: Logger::init
+* Description: Set the runtime level and append to a log file, the console then only gets warnings and errors
+* @Param filename - log file, empty for the console only
+* @Param minLevel - lowest level written
+*/
+void Logger::init(const std::string& filename, LogLevel minLevel)
+{
+    setMinLevel(minLevel);
+    if (!filename.empty())
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        file_.open(filename, std::ios::out | std::ios::app | std::ios::binary);
+    }
+}
+
+/**
+* Name: Logger::parseLevel
+* Description: Level from its name: debug, info, warn, error or off
+* @Param name - level name
+* @Param lvl - parsed level
+*/
+bool Logger::parseLevel(const std::string& name, LogLevel& lvl)
+{
+    const char* names[] = { "debug", "info", "warn", "error", "off" };
+    for (int i = 0; i <= static_cast<int>(LogLevel::Off); i++)
+    {
+        if (name == names[i])
+        {
+            lvl = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* Name: Logger::flush
+* Description: Write the records of all threads queued so far
+*/
+void Logger::flush()
+{
+    std::lock_guard<std::mutex> lk(drainMutex_);
+    drain();
+}
+
+/**
+* Name: Logger::submit
+* Description: Queue a record on the ring of the calling thread. Takes no lock except on the first record of a thread.
+* @Param record - record with its arguments
+*/
+void Logger::submit(LogRecord& record)
+{
+    record.time = nowNanos();
+    if (!running_.load(std::memory_order_acquire))
+    {
+        record.thread = 0;
+        std::string out;
+        format(record, out);
+        std::lock_guard<std::mutex> lk(mutex_);
+        write(out, !file_.is_open() || LogLevel::Warn <= record.level);
+        return;
+    }
+
+    LogRing& ring = localRing();
+    record.thread = ring.id();
+    while (!ring.push(record))
+    {
+        if (LogLevel::Warn > record.level)
+        {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        wake_.notify_one();
+        std::this_thread::yield();
+    }
+
+    if (LogLevel::Warn <= record.level || ring.size() >= LogRing::CAPACITY / 2)
+    {
+        wake_.notify_one();
+    }
+}
+
+/**
+* Name: Logger::localRing
+* Description: Ring of the calling thread, registered on first use. It is retired when the thread exits and dropped
+*              by the drain thread once empty.
+*/
+LogRing& Logger::localRing()
+{
+    struct Handle
+    {
+        std::shared_ptr<LogRing> ring;
+        ~Handle()
+        {
+            if (ring)
+            {
+                ring->retired = true;
+            }
+        }
+    };
+    thread_local Handle handle;
+
+    if (!handle.ring)
+    {
+        std::lock_guard<std::mutex> lk(ringsMutex_);
+        handle.ring = std::make_shared<LogRing>(nextThread_++);
+        rings_.push_back(handle.ring);
+    }
+    return *handle.ring;
+}
+
+/**
+* Name: Logger::drainLoop
+* Description: Drain thread, writes the rings every DRAIN_INTERVAL or when woken up
+*/
+void Logger::drainLoop()
+{
+    std::unique_lock<std::mutex> lk(drainMutex_);
+    while (!stop_)
+    {
+        wake_.wait_for(lk, DRAIN_INTERVAL);
+        drain();
+    }
+}
+
+/**
+* Name: Logger::drain
+* Description: Pop the records of all rings, order them by time and write them, drainMutex_ must be held
+*/
+void Logger::drain()
+{
+    std::vector<std::shared_ptr<LogRing>> rings;
+    {
+        std::lock_guard<std::mutex> lk(ringsMutex_);
+        rings = rings_;
+    }
+
+    batch_.clear();
+    uint64_t dropped = 0;
+    for (const auto& ring : rings)
+    {
+        ring->pop(batch_);
+        dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(ringsMutex_);
+        rings_.erase(std::remove_if(rings_.begin(), rings_.end(),
+            [](const std::shared_ptr<LogRing>& ring) { return ring->retired && 0 == ring->size(); }), rings_.end());
+    }
+
+    if (batch_.empty() && 0 == dropped)
+    {
+        return;
+    }
+
+    std::stable_sort(batch_.begin(), batch_.end(),
+        [](const LogRecord& a, const LogRecord& b) { return a.time < b.time; });
+
+    std::lock_guard<std::mutex> lk(mutex_);
+    std::string all;
+    std::string console;
+    for (const LogRecord& record : batch_)
+    {
+        std::size_t start = all.size();
+        format(record, all);
+        if (LogLevel::Warn <= record.level)
+        {
+            console.append(all, start, std::string::npos);
+        }
+    }
+    if (0 < dropped)
+    {
+        std::string line;
+        appendTime(nowNanos(), line);
+        line += " [WRN] " + std::to_string(dropped) + " log messages dropped, the log rings were full\n";
+        all += line;
+        console += line;
+    }
+
+    if (file_.is_open())
+    {
+        write(all, false);
+        write(console, true);
+    }
+    else
+    {
+        write(all, true);
+    }
+}
+
+/**
+* Name: Logger::write
+* Description: Write formatted lines to the console or the log file, mutex_ must be held
+* @Param out - lines
+* @Param console - stderr instead of the log file
+*/
+void Logger::write(const std::string& out, bool console)
+{
+    if (out.empty())
+    {
+        return;
+    }
+    if (console)
+    {
+        std::fwrite(out.data(), 1, out.size(), stderr);
+        std::fflush(stderr);
+    }
+    else if (file_.is_open())
+    {
+        file_ << out;
+        file_.flush();
+    }
+}
+
+/**
+* Name: Logger::format
+* Description: Format a record as a log line
+* @Param record - record
+* @Param out - line is appended here
+*/
+void Logger::format(const LogRecord& record, std::string& out)
+{
+    appendTime(record.time, out);
+    out += " [";
+    out += levelToString(record.level);
+    out += "] T" + std::to_string(record.thread) + " ";
+    out += record.file;
+    out += ":" + std::to_string(record.line) + " (";
+    out += record.func;
+    out += ") - ";
+    formatMessage(record, out);
+    out += "\n";
+}
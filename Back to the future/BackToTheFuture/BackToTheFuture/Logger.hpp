@@ -1,119 +1,248 @@
 ﻿#pragma once
 
-#include <chrono>
-#include <ctime>
-#include <cstdarg>
-#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
-#include <iostream>
 #include <memory>
 #include <mutex>
-#include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
-enum class LogLevel { Debug = 0, Info, Warn, Error };
+enum class LogLevel { Debug = 0, Info, Warn, Error, Off };
 
-class Logger
+// Calls below this level are compiled out, the rest are filtered at runtime by Logger::setMinLevel
+#if !defined(BTTF_LOG_LEVEL)
+#if defined(_DEBUG)
+#define BTTF_LOG_LEVEL 0
+#else
+#define BTTF_LOG_LEVEL 1
+#endif
+#endif
+
+/**
+* Name: LogRecord
+* Description: One message as the producing thread left it. The format string, file and function must be literals,
+*              arguments are copied into the payload as tagged values and formatted later on the drain thread.
+*/
+struct LogRecord
 {
-public:
-    static Logger& instance()
+    static constexpr std::size_t SIZE = 256;
+
+    enum Tag : uint8_t { Int = 0, UInt, Double, Pointer, String };
+
+    const char* fmt;
+    const char* file;
+    const char* func;
+    int64_t time;
+    uint32_t line;
+    uint32_t thread;
+    LogLevel level;
+    uint16_t used;
+    char payload[SIZE - 3 * sizeof(const char*) - sizeof(int64_t) - 2 * sizeof(uint32_t) - sizeof(LogLevel) - sizeof(uint16_t)];
+
+    void put(Tag tag, const void* data, std::size_t size)
     {
-        static Logger inst;
-        return inst;
+        if (used + 1 + size <= sizeof(payload))
+        {
+            payload[used] = static_cast<char>(tag);
+            std::memcpy(payload + used + 1, data, size);
+            used = static_cast<uint16_t>(used + 1 + size);
+        }
     }
 
-    void init(const std::string& filename = "", LogLevel minLevel = LogLevel::Debug)
+    void putString(const char* text, std::size_t length)
     {
-        std::lock_guard<std::mutex> lk(mutex_);
-        minLevel_ = minLevel;
-        if (!filename.empty())
+        // long strings are cut to what is left of the payload
+        if (static_cast<std::size_t>(used) + 3 > sizeof(payload))
         {
-            file_.open(filename, std::ios::out | std::ios::app);
+            return;
         }
+        uint16_t stored = static_cast<uint16_t>(std::min(length, sizeof(payload) - used - 3));
+        payload[used] = static_cast<char>(String);
+        std::memcpy(payload + used + 1, &stored, sizeof(stored));
+        std::memcpy(payload + used + 3, text, stored);
+        used = static_cast<uint16_t>(used + 3 + stored);
     }
 
-    void setMinLevel(LogLevel lvl)
+    void encode(const char* text) { text ? putString(text, std::strlen(text)) : putString("(null)", 6); }
+    void encode(char* text) { encode(static_cast<const char*>(text)); }
+    void encode(const std::string& text) { putString(text.data(), text.size()); }
+
+    template <typename T>
+    void encode(const T& value)
     {
-        std::lock_guard<std::mutex> lk(mutex_);
-        minLevel_ = lvl;
+        if constexpr (std::is_enum_v<T>)
+        {
+            encode(static_cast<std::underlying_type_t<T>>(value));
+        }
+        else if constexpr (std::is_floating_point_v<T>)
+        {
+            double stored = static_cast<double>(value);
+            put(Double, &stored, sizeof(stored));
+        }
+        else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+        {
+            int64_t stored = static_cast<int64_t>(value);
+            put(Int, &stored, sizeof(stored));
+        }
+        else if constexpr (std::is_integral_v<T>)
+        {
+            uint64_t stored = static_cast<uint64_t>(value);
+            put(UInt, &stored, sizeof(stored));
+        }
+        else
+        {
+            static_assert(std::is_pointer_v<T>, "LOG arguments are numbers, strings or pointers");
+            const void* stored = value;
+            put(Pointer, &stored, sizeof(stored));
+        }
     }
+};
 
-    void log(LogLevel lvl, const char* file, int line, const char* func, const char* fmt, ...) {
-        if (lvl < minLevel_) return;
+static_assert(LogRecord::SIZE == sizeof(LogRecord), "LogRecord must fill its slot");
 
-        char buffer[1024];
-        va_list args;
-        va_start(args, fmt);
-        vsnprintf(buffer, sizeof(buffer), fmt, args);
-        va_end(args);
+/**
+* Name: LogRing
+* Description: Records of one thread, single producer single consumer. The producer only touches the tail and its
+*              cached copy of the head, so logging takes no lock and shares no cache line with other threads.
+*/
+class LogRing
+{
+public:
+    static constexpr std::size_t CAPACITY = 2048;
 
-        auto ts = nowString();
-        const char* levelStr = levelToString(lvl);
+    explicit LogRing(uint32_t id) : id_(id), slots_(new LogRecord[CAPACITY]) {}
 
-        std::ostringstream oss;
-        oss << ts << " [" << levelStr << "] "
-            << file << ":" << line << " (" << func << ") - " << buffer << "\n";
+    uint32_t id() const { return id_; }
 
-        std::string out = oss.str();
+    // false when the ring is full
+    bool push(const LogRecord& record)
+    {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cachedHead_ >= CAPACITY)
+        {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (tail - cachedHead_ >= CAPACITY)
+            {
+                return false;
+            }
+        }
+        std::memcpy(&slots_[tail % CAPACITY], &record, offsetof(LogRecord, payload) + record.used);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
 
-        std::lock_guard<std::mutex> lk(mutex_);
-        std::fwrite(out.data(), 1, out.size(), stdout);
-        fflush(stdout);
+    // records queued and not popped yet
+    std::size_t size() const
+    {
+        return static_cast<std::size_t>(tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_relaxed));
+    }
 
-        if (file_.is_open()) {
-            file_ << out;
-            file_.flush();
+    // move up to all queued records into out, for the consumer only
+    void pop(std::vector<LogRecord>& out)
+    {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        uint64_t tail = tail_.load(std::memory_order_acquire);
+        for (; head != tail; head++)
+        {
+            out.push_back(slots_[head % CAPACITY]);
         }
-
-        // #ifdef _WIN32
-        // OutputDebugStringA(out.c_str());
-        // #endif
+        head_.store(head, std::memory_order_release);
     }
 
+    std::atomic<uint64_t> dropped{ 0 };
+    std::atomic<bool> retired{ false };
+
 private:
-    Logger() : minLevel_(LogLevel::Debug) {}
-    ~Logger()
+    uint32_t id_;
+    std::unique_ptr<LogRecord[]> slots_;
+    alignas(64) std::atomic<uint64_t> head_{ 0 };
+    alignas(64) std::atomic<uint64_t> tail_{ 0 };
+    uint64_t cachedHead_ = 0;
+};
+
+/**
+* Name: Logger
+* Description: Asynchronous logger. Threads fill their own LogRing, a drain thread formats the records in time order
+*              and writes them to stderr and the log file. Debug and Info records are dropped and counted when a ring
+*              is full, Warn and Error wait for room.
+*/
+class Logger
+{
+public:
+    static Logger& instance()
     {
-        if (file_.is_open()) file_.close();
+        static Logger inst;
+        return inst;
     }
 
-    std::string nowString() {
-        using namespace std::chrono;
-        auto t = system_clock::now();
-        auto tt = system_clock::to_time_t(t);
-        auto ms = duration_cast<milliseconds>(t.time_since_epoch()) % 1000;
+    void init(const std::string& filename = "", LogLevel minLevel = LogLevel::Debug);
 
-        std::tm tm_buf;
-#if defined(_WIN32)
-        localtime_s(&tm_buf, &tt);
-#else
-        localtime_r(&tt, &tm_buf);
-#endif
-        char buf[64];
-        std::snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d.%03d",
-            tm_buf.tm_year + 1900, tm_buf.tm_mon + 1, tm_buf.tm_mday,
-            tm_buf.tm_hour, tm_buf.tm_min, tm_buf.tm_sec, static_cast<int>(ms.count()));
-        return std::string(buf);
+    void setMinLevel(LogLevel lvl)
+    {
+        minLevel_.store(static_cast<int>(lvl), std::memory_order_relaxed);
     }
 
-    const char* levelToString(LogLevel l) const {
-        switch (l) {
-        case LogLevel::Debug: return "DBG";
-        case LogLevel::Info:  return "INF";
-        case LogLevel::Warn:  return "WRN";
-        case LogLevel::Error: return "ERR";
-        default: return "UNK";
-        }
+    bool enabled(LogLevel lvl) const
+    {
+        return static_cast<int>(lvl) >= minLevel_.load(std::memory_order_relaxed);
+    }
+
+    template <typename... Args>
+    void log(LogLevel lvl, const char* file, int line, const char* func, const char* fmt, const Args&... args)
+    {
+        LogRecord record;
+        record.fmt = fmt;
+        record.file = file;
+        record.func = func;
+        record.line = static_cast<uint32_t>(line);
+        record.level = lvl;
+        record.used = 0;
+        (record.encode(args), ...);
+        submit(record);
     }
 
+    // write everything logged so far before returning
+    void flush();
+
+    static bool parseLevel(const std::string& name, LogLevel& lvl);
+
+private:
+    Logger();
+    ~Logger();
+
+    void submit(LogRecord& record);
+    LogRing& localRing();
+    void drainLoop();
+    void drain();
+    void write(const std::string& out, bool console);
+    static void format(const LogRecord& record, std::string& out);
+
     std::mutex mutex_;
     std::ofstream file_;
-    LogLevel minLevel_;
+    std::atomic<int> minLevel_;
+
+    // rings of all threads which logged, retired rings are removed once empty
+    std::mutex ringsMutex_;
+    std::vector<std::shared_ptr<LogRing>> rings_;
+    uint32_t nextThread_ = 0;
+
+    std::mutex drainMutex_;
+    std::condition_variable wake_;
+    std::atomic<bool> running_{ false };
+    bool stop_ = false;
+    std::thread drainThread_;
+    std::vector<LogRecord> batch_;
+};
 
-#ifdef _DEBUG
 #define LOG(level, fmt, ...) \
-        do { Logger::instance().log(LogLevel::level, __FILE__, __LINE__, __func__, (fmt), ##__VA_ARGS__); } while(0)
-#else
-#define LOG(level, fmt, ...) do {} while(0)
-#endif
-};
\ No newline at end of file
+    do { \
+        if (static_cast<int>(LogLevel::level) >= BTTF_LOG_LEVEL && Logger::instance().enabled(LogLevel::level)) \
+            Logger::instance().log(LogLevel::level, __FILE__, __LINE__, __func__, (fmt), ##__VA_ARGS__); \
+    } while(0)
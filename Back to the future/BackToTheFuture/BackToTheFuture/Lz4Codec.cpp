@@ -0,0 +1,175 @@
+#include "Lz4Codec.hpp"
+
+#if defined(BTTF_WITH_LZ4)
+
+#include "Logger.hpp"
+
+#include <algorithm>
+
+namespace
+{
+	LZ4F_preferences_t framePreferences(int level)
+	{
+		LZ4F_preferences_t preferences{};
+		preferences.compressionLevel = level;
+		preferences.frameInfo.blockSizeID = LZ4F_max4MB;
+		preferences.frameInfo.contentChecksumFlag = LZ4F_noContentChecksum;
+		return preferences;
+	}
+} // anonymous namespace
+
+/**
+* Name: Lz4Codec::Lz4Codec
+* Description: Constructor
+* @Param chunkSize - input step, the output buffer is sized so one step, including buffered blocks, always fits
+*/
+Lz4Codec::Lz4Codec(std::size_t chunkSize) :
+	m_preferences(framePreferences(0)), m_inputStep(chunkSize),
+	m_outBuffer(LZ4F_compressBound(chunkSize, &m_preferences) + LZ4F_HEADER_SIZE_MAX) {}
+
+/**
+* Name: Lz4Codec::~Lz4Codec
+* Description: Destructor, releases lz4 contexts
+*/
+Lz4Codec::~Lz4Codec()
+{
+	LZ4F_freeCompressionContext(m_cctx);
+	LZ4F_freeDecompressionContext(m_dctx);
+}
+
+/**
+* Name: Lz4Codec::beginCompress
+* Description: Start new lz4 frame and write its header
+* @Param level - 0 is the fast compressor, 3 and above select LZ4 HC
+* @Param longRange - not supported by lz4, ignored
+* @Param dictionary - not supported, lz4 blobs never use the dictionary
+*/
+bool Lz4Codec::beginCompress(int level, bool, bool)
+{
+	if (!m_cctx && LZ4F_isError(LZ4F_createCompressionContext(&m_cctx, LZ4F_VERSION)))
+	{
+		LOG(Error, "LZ4F_createCompressionContext failed.");
+		return false;
+	}
+
+	m_frameOpen = false;
+	m_preferences = framePreferences(level);
+	return true;
+}
+
+/**
+* Name: Lz4Codec::compress
+* Description: Compress next part of the frame, the frame header goes out with the first call.
+*              Returns number of bytes written or -1 on failure.
+* @Param data - input data
+* @Param size - input size
+* @Param last - end the frame
+* @Param ostream - output stream
+*/
+int64_t Lz4Codec::compress(const char* data, std::size_t size, bool last, std::ostream& ostream)
+{
+	int64_t totalOut = 0;
+
+	if (!m_frameOpen)
+	{
+		std::size_t header = LZ4F_compressBegin(m_cctx, m_outBuffer.data(), m_outBuffer.size(), &m_preferences);
+		if (LZ4F_isError(header))
+		{
+			LOG(Error, "Lz4 error %s.", LZ4F_getErrorName(header));
+			return -1;
+		}
+		ostream.write(m_outBuffer.data(), static_cast<std::streamsize>(header));
+		totalOut += static_cast<int64_t>(header);
+		m_frameOpen = true;
+	}
+
+	while (0 < size)
+	{
+		std::size_t piece = std::min(size, m_inputStep);
+		std::size_t written = LZ4F_compressUpdate(m_cctx, m_outBuffer.data(), m_outBuffer.size(), data, piece, nullptr);
+		if (LZ4F_isError(written))
+		{
+			LOG(Error, "Lz4 error %s.", LZ4F_getErrorName(written));
+			return -1;
+		}
+		ostream.write(m_outBuffer.data(), static_cast<std::streamsize>(written));
+		totalOut += static_cast<int64_t>(written);
+
+		data += piece;
+		size -= piece;
+	}
+
+	if (last)
+	{
+		std::size_t written = LZ4F_compressEnd(m_cctx, m_outBuffer.data(), m_outBuffer.size(), nullptr);
+		if (LZ4F_isError(written))
+		{
+			LOG(Error, "Lz4 error %s.", LZ4F_getErrorName(written));
+			return -1;
+		}
+		ostream.write(m_outBuffer.data(), static_cast<std::streamsize>(written));
+		totalOut += static_cast<int64_t>(written);
+		m_frameOpen = false;
+	}
+
+	return ostream ? totalOut : -1;
+}
+
+/**
+* Name: Lz4Codec::beginDecompress
+* Description: Start reading new lz4 frame
+* @Param dictionary - not supported, lz4 blobs never use the dictionary
+*/
+bool Lz4Codec::beginDecompress(bool)
+{
+	m_finished = false;
+	if (!m_dctx)
+	{
+		if (LZ4F_isError(LZ4F_createDecompressionContext(&m_dctx, LZ4F_VERSION)))
+		{
+			LOG(Error, "LZ4F_createDecompressionContext failed.");
+			return false;
+		}
+		return true;
+	}
+
+	LZ4F_resetDecompressionContext(m_dctx);
+	return true;
+}
+
+/**
+* Name: Lz4Codec::decompress
+* Description: Decompress next part of the frame
+* @Param data - compressed data
+* @Param size - compressed size
+* @Param ostream - output stream
+*/
+bool Lz4Codec::decompress(const char* data, std::size_t size, std::ostream& ostream)
+{
+	while (!m_finished)
+	{
+		std::size_t outSize = m_outBuffer.size();
+		std::size_t inSize = size;
+
+		std::size_t ret = LZ4F_decompress(m_dctx, m_outBuffer.data(), &outSize, data, &inSize, nullptr);
+		if (LZ4F_isError(ret))
+		{
+			LOG(Error, "Lz4 error %s.", LZ4F_getErrorName(ret));
+			return false;
+		}
+
+		ostream.write(m_outBuffer.data(), static_cast<std::streamsize>(outSize));
+		data += inSize;
+		size -= inSize;
+		m_finished = 0 == ret;
+
+		if (0 == size && outSize < m_outBuffer.size())
+		{
+			break;
+		}
+	}
+
+	return static_cast<bool>(ostream);
+}
+
+#endif // BTTF_WITH_LZ4
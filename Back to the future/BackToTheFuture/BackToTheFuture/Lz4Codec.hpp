@@ -0,0 +1,40 @@
+#pragma once
+
+#if defined(BTTF_WITH_LZ4)
+
+#include <lz4frame.h>
+#include <vector>
+
+#include "Codec.hpp"
+
+class Lz4Codec : public ICodec
+{
+public:
+	explicit Lz4Codec(std::size_t chunkSize);
+	~Lz4Codec() override;
+
+	CodecId id() const override { return CodecId::Lz4; }
+	int defaultLevel() const override { return 0; }
+	int fastLevel() const override { return 0; }
+	int minLevel() const override { return 0; }
+	// LZ4HC_CLEVEL_MAX, higher levels are the same
+	int maxLevel() const override { return 12; }
+
+	bool beginCompress(int level, bool longRange, bool dictionary) override;
+	int64_t compress(const char* data, std::size_t size, bool last, std::ostream& ostream) override;
+
+	bool beginDecompress(bool dictionary) override;
+	bool decompress(const char* data, std::size_t size, std::ostream& ostream) override;
+	bool finished() const override { return m_finished; }
+
+private:
+	LZ4F_cctx* m_cctx = nullptr;
+	LZ4F_dctx* m_dctx = nullptr;
+	LZ4F_preferences_t m_preferences{};
+	const std::size_t m_inputStep;
+	bool m_frameOpen = false;
+	bool m_finished = false;
+	std::vector<char> m_outBuffer;
+};
+
+#endif // BTTF_WITH_LZ4
@@ -0,0 +1,118 @@
+#include "MappedFile.hpp"
+#include "Logger.hpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+* Name: MappedFile::~MappedFile
+* Description: Destructor, unmaps the file
+*/
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+/**
+* Name: MappedFile::open
+* Description: Map whole file read-only, fails for empty and non-mappable files (pipes, devices)
+* @Param path - absolute path to file
+*/
+bool MappedFile::open(const fs::path& path)
+{
+	close();
+
+#if defined(_WIN32)
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (INVALID_HANDLE_VALUE == file)
+	{
+		LOG(Warn, "Cannot open %s for mapping.", path.string().c_str());
+		return false;
+	}
+
+	LARGE_INTEGER fileSize{};
+	if (!GetFileSizeEx(file, &fileSize) || 0 == fileSize.QuadPart)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!view)
+	{
+		LOG(Warn, "Cannot map %s.", path.string().c_str());
+		if (mapping)
+		{
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+		return false;
+	}
+
+	m_file = file;
+	m_mapping = mapping;
+	m_data = static_cast<const char*>(view);
+	m_size = static_cast<uint64_t>(fileSize.QuadPart);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (0 > fd)
+	{
+		LOG(Warn, "Cannot open %s for mapping.", path.string().c_str());
+		return false;
+	}
+
+	struct stat st{};
+	if (0 != fstat(fd, &st) || !S_ISREG(st.st_mode) || 0 == st.st_size)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void* view = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (MAP_FAILED == view)
+	{
+		LOG(Warn, "Cannot map %s.", path.string().c_str());
+		return false;
+	}
+
+	m_data = static_cast<const char*>(view);
+	m_size = static_cast<uint64_t>(st.st_size);
+#endif
+
+	return true;
+}
+
+/**
+* Name: MappedFile::close
+* Description: Unmap the file
+*/
+void MappedFile::close()
+{
+	if (!m_data)
+	{
+		return;
+	}
+
+#if defined(_WIN32)
+	UnmapViewOfFile(m_data);
+	CloseHandle(m_mapping);
+	CloseHandle(m_file);
+	m_mapping = nullptr;
+	m_file = nullptr;
+#else
+	munmap(const_cast<char*>(m_data), static_cast<std::size_t>(m_size));
+#endif
+
+	m_data = nullptr;
+	m_size = 0;
+}
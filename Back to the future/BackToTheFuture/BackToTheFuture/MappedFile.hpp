@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+/**
+* Name: MappedFile
+* Description: Read-only memory mapping of a whole file
+*/
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const fs::path& path);
+	void close();
+
+	bool isOpen() const { return nullptr != m_data; }
+	const char* data() const { return m_data; }
+	uint64_t size() const { return m_size; }
+
+private:
+	const char* m_data = nullptr;
+	uint64_t m_size = 0;
+#if defined(_WIN32)
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#endif
+};
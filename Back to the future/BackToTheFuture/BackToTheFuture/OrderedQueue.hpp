@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+/**
+* Name: OrderedQueue
+* Description: Bounded queue which hands results of parallel tasks to a single consumer in index order.
+*              Producers must reserve indices in increasing order, at most 'window' of them are in flight.
+*/
+template <typename T>
+class OrderedQueue
+{
+public:
+	explicit OrderedQueue(std::size_t window) :
+		m_slots(0 != window ? window : 1) {}
+
+	void reserve(std::size_t index)
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+		m_cv.wait(lk, [&]() { return index < m_next + m_slots.size(); });
+	}
+
+	void push(std::size_t index, T&& value)
+	{
+		{
+			std::lock_guard<std::mutex> lk(m_mutex);
+			m_slots[index % m_slots.size()].emplace(std::move(value));
+		}
+		m_cv.notify_all();
+	}
+
+	// true while the consumer waits for this index or will take it next
+	bool isNext(std::size_t index)
+	{
+		std::lock_guard<std::mutex> lk(m_mutex);
+		return index == m_next;
+	}
+
+	T pop()
+	{
+		std::unique_lock<std::mutex> lk(m_mutex);
+		std::optional<T>& slot = m_slots[m_next % m_slots.size()];
+		m_cv.wait(lk, [&]() { return slot.has_value(); });
+
+		T value = std::move(*slot);
+		slot.reset();
+		m_next++;
+		lk.unlock();
+
+		m_cv.notify_all();
+		return value;
+	}
+
+private:
+	std::vector<std::optional<T>> m_slots;
+	std::size_t m_next = 0;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+};
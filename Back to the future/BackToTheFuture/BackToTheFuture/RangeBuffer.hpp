@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <streambuf>
+
+/**
+* Name: RangeBuffer
+* Description: Output buffer which forwards only a byte range of what is written to it. The first 'skip' bytes
+*              are dropped, then at most 'length' bytes reach the target, the rest is dropped as well.
+*/
+class RangeBuffer : public std::streambuf
+{
+public:
+	RangeBuffer(std::streambuf* target, uint64_t skip, uint64_t length) :
+		m_target(target), m_skip(skip), m_remaining(length) {}
+
+	void skip(uint64_t count) { m_skip = count; }
+	bool full() const { return 0 == m_remaining; }
+
+protected:
+	std::streamsize xsputn(const char* data, std::streamsize count) override
+	{
+		uint64_t size = static_cast<uint64_t>(count);
+		uint64_t skipped = std::min(m_skip, size);
+		m_skip -= skipped;
+
+		uint64_t forward = std::min(m_remaining, size - skipped);
+		if (0 < forward && static_cast<std::streamsize>(forward) != m_target->sputn(data + skipped, static_cast<std::streamsize>(forward)))
+		{
+			return 0;
+		}
+		m_remaining -= forward;
+		return count;
+	}
+
+	int_type overflow(int_type ch) override
+	{
+		if (traits_type::eq_int_type(ch, traits_type::eof()))
+		{
+			return traits_type::not_eof(ch);
+		}
+
+		char c = traits_type::to_char_type(ch);
+		return 1 == xsputn(&c, 1) ? ch : traits_type::eof();
+	}
+
+private:
+	std::streambuf* m_target;
+	uint64_t m_skip;
+	uint64_t m_remaining;
+};
@@ -0,0 +1,300 @@
+#include "ScanCache.hpp"
+#include "ByteReader.hpp"
+#include "Hasher.hpp"
+#include "Logger.hpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <vector>
+
+namespace
+{
+	constexpr char MAGIC[4] = { 'T','M','S','C' };
+	constexpr uint32_t VERSION = 2;
+	// files changed this close to the cache write could change again within the same timestamp, they are not cached
+	constexpr int64_t RACY_WINDOW = 2'000'000'000;
+
+	void write_u32(std::ostream& os, uint32_t v) { for (int i = 0; i < 4; i++) os.put((char)((v >> (8 * i)) & 0xFF)); }
+	void write_u64(std::ostream& os, uint64_t v) { for (int i = 0; i < 8; i++) os.put((char)((v >> (8 * i)) & 0xFF)); }
+
+	// flushes a written file or a directory to the disk, Windows flushes the directory entry with the rename
+	bool syncPath(const fs::path& path, bool directory)
+	{
+#if defined(_WIN32)
+		if (directory)
+		{
+			return true;
+		}
+		HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (INVALID_HANDLE_VALUE == file)
+		{
+			return false;
+		}
+		bool synced = FALSE != FlushFileBuffers(file);
+		CloseHandle(file);
+		return synced;
+#else
+		int fd = ::open(path.c_str(), O_RDONLY | (directory ? O_DIRECTORY : 0));
+		if (0 > fd)
+		{
+			return false;
+		}
+		bool synced = 0 == ::fsync(fd);
+		::close(fd);
+		return synced;
+#endif
+	}
+
+	int processId()
+	{
+#if defined(_WIN32)
+		return static_cast<int>(GetCurrentProcessId());
+#else
+		return static_cast<int>(::getpid());
+#endif
+	}
+} // anonymous namespace
+
+/**
+* Name: ScanCache::ScanCache
+* Description: Constructor, the cache starts empty until load
+* @Param cachePath - absolute path to the cache file
+*/
+ScanCache::ScanCache(fs::path cachePath) :
+	m_cachePath(std::move(cachePath)),
+	m_created(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count()) {}
+
+/**
+* Name: ScanCache::defaultPath
+* Description: Cache file of the root directory in the user cache directory, named after the digest of the root path
+* @Param root - root directory of the tree
+*/
+fs::path ScanCache::defaultPath(const fs::path& root)
+{
+	fs::path directory;
+#if defined(_WIN32)
+	if (const char* localAppData = std::getenv("LOCALAPPDATA"))
+	{
+		directory = fs::path(localAppData) / "BackToTheFuture";
+	}
+#else
+	if (const char* cacheHome = std::getenv("XDG_CACHE_HOME"))
+	{
+		directory = fs::path(cacheHome) / "bttf";
+	}
+	else if (const char* home = std::getenv("HOME"))
+	{
+		directory = fs::path(home) / ".cache" / "bttf";
+	}
+#endif
+	if (directory.empty())
+	{
+		directory = fs::temp_directory_path() / "bttf";
+	}
+
+	std::error_code error;
+	std::string rootPath = fs::absolute(root, error).lexically_normal().generic_string();
+
+	Sha256Hasher hasher;
+	hasher.update(rootPath.data(), rootPath.size());
+	return directory / (toHex(hasher.finalDigest()).substr(0, 16) + ".cache");
+}
+
+/**
+* Name: ScanCache::load
+* Description: Read the cache file, a missing or damaged cache is treated as empty
+*/
+bool ScanCache::load()
+{
+	std::ifstream ifstream(m_cachePath, std::ios::binary);
+	if (!ifstream)
+	{
+		LOG(Info, "No scan cache %s.", m_cachePath.string().c_str());
+		return false;
+	}
+
+	std::vector<char> data((std::istreambuf_iterator<char>(ifstream)), std::istreambuf_iterator<char>());
+	ByteReader reader(data.data(), data.size());
+
+	const char* magic = reader.bytes(4);
+	if (!magic || 0 != std::memcmp(magic, MAGIC, 4) || VERSION != reader.u32())
+	{
+		LOG(Warn, "Ignoring scan cache in unknown format.");
+		return false;
+	}
+
+	std::unordered_map<std::string, Entry> entries;
+	uint32_t count = reader.u32();
+	for (uint32_t i = 0; i < count && reader.ok(); i++)
+	{
+		uint32_t pathLength = reader.u32();
+		const char* path = reader.bytes(pathLength);
+
+		Entry entry;
+		entry.signature.device = reader.u64();
+		entry.signature.inode = reader.u64();
+		entry.signature.mtime = static_cast<int64_t>(reader.u64());
+		entry.signature.ctime = static_cast<int64_t>(reader.u64());
+		entry.size = reader.u64();
+		entry.hash = static_cast<HashId>(reader.u32());
+		entry.digestKind = reader.u64();
+
+		std::size_t digestBytes = digestSize(entry.hash);
+		const char* digest = reader.bytes(digestBytes);
+		if (!reader.ok() || 0 == digestBytes)
+		{
+			break;
+		}
+
+		entry.digest.assign(digest, digestBytes);
+		entries.emplace(std::string(path, pathLength), std::move(entry));
+	}
+
+	if (!reader.ok() || entries.size() != count)
+	{
+		LOG(Warn, "Ignoring damaged scan cache.");
+		return false;
+	}
+
+	m_loaded = std::move(entries);
+	return true;
+}
+
+/**
+* Name: ScanCache::save
+* Description: Write entries seen in this run to a temporary file and rename it over the cache, so readers see
+*              either the old or the new cache. The temporary name is unique to the run, so concurrent packs of
+*              the same tree do not write into each other's file, and the file and then the directory are synced,
+*              so a crash leaves a complete cache
+*/
+bool ScanCache::save() const
+{
+	std::lock_guard<std::mutex> lk(m_mutex);
+
+	std::error_code error;
+	fs::create_directories(m_cachePath.parent_path(), error);
+
+	fs::path tempPath = m_cachePath;
+	tempPath += "." + std::to_string(processId()) + "-" + std::to_string(std::random_device()()) + ".tmp";
+	{
+		std::ofstream ofstream(tempPath, std::ios::binary);
+		if (!ofstream)
+		{
+			LOG(Error, "Cannot create scan cache %s.", tempPath.string().c_str());
+			return false;
+		}
+
+		std::vector<const std::pair<const std::string, Entry>*> stable;
+		for (const auto& item : m_current)
+		{
+			const FileSignature& signature = item.second.signature;
+			if (std::max(signature.mtime, signature.ctime) + RACY_WINDOW < m_created)
+			{
+				stable.push_back(&item);
+			}
+		}
+
+		ofstream.write(MAGIC, 4);
+		write_u32(ofstream, VERSION);
+		write_u32(ofstream, static_cast<uint32_t>(stable.size()));
+		for (const auto* item : stable)
+		{
+			const Entry& entry = item->second;
+			write_u32(ofstream, static_cast<uint32_t>(item->first.size()));
+			ofstream.write(item->first.data(), static_cast<std::streamsize>(item->first.size()));
+			write_u64(ofstream, entry.signature.device);
+			write_u64(ofstream, entry.signature.inode);
+			write_u64(ofstream, static_cast<uint64_t>(entry.signature.mtime));
+			write_u64(ofstream, static_cast<uint64_t>(entry.signature.ctime));
+			write_u64(ofstream, entry.size);
+			write_u32(ofstream, static_cast<uint32_t>(entry.hash));
+			write_u64(ofstream, entry.digestKind);
+
+			ofstream.write(reinterpret_cast<const char*>(entry.digest.bytes), entry.digest.size);
+		}
+
+		ofstream.close();
+		if (!ofstream || !syncPath(tempPath, false))
+		{
+			LOG(Error, "Cannot write scan cache %s.", tempPath.string().c_str());
+			fs::remove(tempPath, error);
+			return false;
+		}
+	}
+
+	fs::rename(tempPath, m_cachePath, error);
+	if (error)
+	{
+		LOG(Error, "Cannot replace scan cache %s.", m_cachePath.string().c_str());
+		fs::remove(tempPath, error);
+		return false;
+	}
+
+	// a cache path without a directory lives in the working directory
+	const fs::path directory = m_cachePath.has_parent_path() ? m_cachePath.parent_path() : fs::path(".");
+	if (!syncPath(directory, true))
+	{
+		LOG(Warn, "Cannot sync the directory of scan cache %s.", m_cachePath.string().c_str());
+	}
+	return true;
+}
+
+/**
+* Name: ScanCache::lookup
+* Description: Find digest of an unchanged file, a hit keeps the entry for the next save
+* @Param file - scanned file with its stat signature
+* @Param hash - content hash of the digest
+* @Param digestKind - how the digest was computed, 0 is the digest of the content, other values the block size
+*                     of a split file
+* @Param digest - output digest
+*/
+bool ScanCache::lookup(const FileMetadata& file, HashId hash, uint64_t digestKind, Digest& digest) const
+{
+	auto it = m_loaded.find(file.path);
+	if (m_loaded.end() == it)
+	{
+		return false;
+	}
+
+	const Entry& entry = it->second;
+	if (entry.size != file.size || entry.hash != hash || entry.digestKind != digestKind ||
+		entry.signature.device != file.signature.device || entry.signature.inode != file.signature.inode ||
+		entry.signature.mtime != file.signature.mtime || entry.signature.ctime != file.signature.ctime)
+	{
+		return false;
+	}
+
+	digest = entry.digest;
+	return true;
+}
+
+/**
+* Name: ScanCache::store
+* Description: Remember digest of a file for the next save, safe to call from several threads
+* @Param file - file with its stat signature and digest
+* @Param hash - content hash of the digest
+* @Param digestKind - how the digest was computed, see lookup
+*/
+void ScanCache::store(const FileMetadata& file, HashId hash, uint64_t digestKind)
+{
+	if (file.digest.size != digestSize(hash))
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lk(m_mutex);
+	m_current[file.path] = Entry{ file.signature, file.size, hash, digestKind, file.digest };
+}
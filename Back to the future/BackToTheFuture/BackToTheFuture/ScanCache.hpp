@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "FileScanner.hpp"
+#include "Hasher.hpp"
+
+namespace fs = std::filesystem;
+
+/**
+* Name: ScanCache
+* Description: Persistent digest cache of a source tree. Entries are keyed by relative path and stat signature,
+*              so files which did not change since the last run are not read again. The cache file is replaced
+*              atomically on save and only keeps the files seen in the current run.
+*/
+class ScanCache
+{
+public:
+	explicit ScanCache(fs::path cachePath);
+
+	static fs::path defaultPath(const fs::path& root);
+
+	bool load();
+	bool save() const;
+
+	bool lookup(const FileMetadata& file, HashId hash, uint64_t digestKind, Digest& digest) const;
+	void store(const FileMetadata& file, HashId hash, uint64_t digestKind);
+
+private:
+	struct Entry
+	{
+		FileSignature signature;
+		uint64_t size;
+		HashId hash;
+		uint64_t digestKind;
+		Digest digest;
+	};
+
+	const fs::path m_cachePath;
+	const int64_t m_created;
+	std::unordered_map<std::string, Entry> m_loaded;
+	std::unordered_map<std::string, Entry> m_current;
+	mutable std::mutex m_mutex;
+};
@@ -0,0 +1,181 @@
+#include "SparseFile.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// adds a data range, ranges closer than minHole are merged, so small holes are read as zeros
+	void addExtent(std::vector<Extent>& extents, uint64_t offset, uint64_t end, uint64_t minHole)
+	{
+		if (!extents.empty() && offset - (extents.back().offset + extents.back().length) < minHole)
+		{
+			extents.back().length = end - extents.back().offset;
+			return;
+		}
+		extents.push_back(Extent{ offset, end - offset });
+	}
+
+#if defined(_WIN32)
+	// allocated ranges come in batches of this many
+	constexpr std::size_t RANGE_BATCH = 64;
+#endif
+} // anonymous namespace
+
+/**
+* Name: findDataExtents
+* Description: List the ranges of a file which hold data, holes of at least minHole bytes are left out.
+*              Returns false when the file has no such hole or the file system cannot tell, the caller then reads
+*              the whole file. Files whose allocation covers their size are recognized without a query.
+* @Param path - absolute path to file
+* @Param size - file size
+* @Param minHole - smallest hole worth skipping
+* @Param extents - output data ranges in file order
+*/
+bool findDataExtents(const fs::path& path, uint64_t size, uint64_t minHole, std::vector<Extent>& extents)
+{
+	extents.clear();
+
+#if defined(_WIN32)
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (INVALID_HANDLE_VALUE == file)
+	{
+		return false;
+	}
+
+	FILE_ALLOCATED_RANGE_BUFFER query{};
+	query.FileOffset.QuadPart = 0;
+	query.Length.QuadPart = static_cast<LONGLONG>(size);
+	FILE_ALLOCATED_RANGE_BUFFER ranges[RANGE_BATCH];
+	bool known = true;
+	while (true)
+	{
+		DWORD bytes = 0;
+		BOOL done = DeviceIoControl(file, FSCTL_QUERY_ALLOCATED_RANGES, &query, sizeof(query), ranges, sizeof(ranges), &bytes, nullptr);
+		if (!done && ERROR_MORE_DATA != GetLastError())
+		{
+			known = false;
+			break;
+		}
+
+		std::size_t count = bytes / sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+		for (std::size_t i = 0; i < count; i++)
+		{
+			uint64_t offset = static_cast<uint64_t>(ranges[i].FileOffset.QuadPart);
+			addExtent(extents, offset, offset + static_cast<uint64_t>(ranges[i].Length.QuadPart), minHole);
+		}
+
+		if (done || 0 == count)
+		{
+			break;
+		}
+		uint64_t next = static_cast<uint64_t>(ranges[count - 1].FileOffset.QuadPart + ranges[count - 1].Length.QuadPart);
+		query.FileOffset.QuadPart = static_cast<LONGLONG>(next);
+		query.Length.QuadPart = static_cast<LONGLONG>(size - next);
+	}
+	CloseHandle(file);
+
+	if (!known)
+	{
+		extents.clear();
+		return false;
+	}
+#else
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (0 > fd)
+	{
+		return false;
+	}
+
+	struct stat st;
+	if (0 != fstat(fd, &st) || static_cast<uint64_t>(st.st_blocks) * 512 >= size)
+	{
+		::close(fd);
+		return false;
+	}
+
+	bool known = true;
+	for (uint64_t position = 0; position < size;)
+	{
+		off_t data = lseek(fd, static_cast<off_t>(position), SEEK_DATA);
+		if (0 > data)
+		{
+			// the rest of the file is a hole
+			known = ENXIO == errno;
+			break;
+		}
+
+		off_t hole = lseek(fd, data, SEEK_HOLE);
+		uint64_t end = 0 > hole ? size : std::min<uint64_t>(static_cast<uint64_t>(hole), size);
+		if (static_cast<uint64_t>(data) >= end)
+		{
+			break;
+		}
+		addExtent(extents, static_cast<uint64_t>(data), end, minHole);
+		position = end;
+	}
+	::close(fd);
+
+	if (!known)
+	{
+		LOG(Debug, "Cannot query holes of %s.", path.string().c_str());
+		extents.clear();
+		return false;
+	}
+#endif
+
+	// a leading or trailing hole below the limit is read as well
+	if (!extents.empty() && extents.front().offset < minHole)
+	{
+		extents.front().length += extents.front().offset;
+		extents.front().offset = 0;
+	}
+	if (!extents.empty() && size - (extents.back().offset + extents.back().length) < minHole)
+	{
+		extents.back().length = size - extents.back().offset;
+	}
+
+	if (1 == extents.size() && 0 == extents[0].offset && size == extents[0].length)
+	{
+		extents.clear();
+		return false;
+	}
+	return true;
+}
+
+/**
+* Name: markSparse
+* Description: Let a new file keep the ranges which are skipped while writing it as holes. POSIX file systems do
+*              it for every file, NTFS only for files flagged sparse.
+* @Param path - absolute path to file
+*/
+bool markSparse(const fs::path& path)
+{
+#if defined(_WIN32)
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (INVALID_HANDLE_VALUE == file)
+	{
+		return false;
+	}
+
+	DWORD bytes = 0;
+	BOOL done = DeviceIoControl(file, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &bytes, nullptr);
+	CloseHandle(file);
+	return FALSE != done;
+#else
+	(void)path;
+	return true;
+#endif
+}
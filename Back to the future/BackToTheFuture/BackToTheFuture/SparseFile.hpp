@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// byte range of a file
+struct Extent
+{
+	uint64_t offset;
+	uint64_t length;
+};
+
+bool findDataExtents(const fs::path& path, uint64_t size, uint64_t minHole, std::vector<Extent>& extents);
+bool markSparse(const fs::path& path);
@@ -0,0 +1,135 @@
+#include "SpillBuffer.hpp"
+#include "Logger.hpp"
+#include "Stats.hpp"
+
+#include <algorithm>
+
+/**
+* Name: SpillBuffer::SpillBuffer
+* Description: Constructor
+* @Param memoryLimit - number of bytes kept in memory
+* @Param spillPath - temporary file used for bytes over the limit
+* @Param extendedLimit - number of bytes kept in memory when extend allows it
+* @Param extend - asked once the memory limit is reached and nothing was spilled yet
+*/
+SpillBuffer::SpillBuffer(std::size_t memoryLimit, fs::path spillPath, std::size_t extendedLimit, Extension extend) :
+	m_memoryLimit(memoryLimit), m_extendedLimit(std::max(memoryLimit, extendedLimit)), m_extend(std::move(extend)),
+	m_spillPath(std::move(spillPath)), m_size(0), m_readPos(0) {}
+
+/**
+* Name: SpillBuffer::~SpillBuffer
+* Description: Destructor, removes the temporary file
+*/
+SpillBuffer::~SpillBuffer()
+{
+	Stats::release(m_memory.size());
+	if (m_size > m_memory.size())
+	{
+		m_spill.close();
+		m_reader.close();
+		std::error_code error;
+		fs::remove(m_spillPath, error);
+	}
+}
+
+/**
+* Name: SpillBuffer::xsputn
+* Description: Append data, fills memory first and then the spill file
+* @Param data - data to append
+* @Param count - data size
+*/
+std::streamsize SpillBuffer::xsputn(const char* data, std::streamsize count)
+{
+	// bytes stay in write order, so memory can only grow as long as nothing went to the spill file
+	std::size_t limit = m_memoryLimit;
+	if (m_size == m_memory.size() && m_memory.size() + static_cast<std::size_t>(count) > m_memoryLimit && m_extend && m_extend())
+	{
+		limit = m_extendedLimit;
+	}
+	std::size_t toMemory = std::min<std::size_t>(static_cast<std::size_t>(count), limit - std::min(limit, m_memory.size()));
+	m_memory.insert(m_memory.end(), data, data + toMemory);
+	if (0 < toMemory)
+	{
+		Stats::allocate(toMemory);
+	}
+
+	std::streamsize toSpill = count - static_cast<std::streamsize>(toMemory);
+	if (0 < toSpill)
+	{
+		if (!m_spill.is_open())
+		{
+			m_spill.open(m_spillPath, std::ios::binary | std::ios::trunc);
+		}
+
+		if (!m_spill.write(data + toMemory, toSpill))
+		{
+			LOG(Error, "Cannot write spill file %s.", m_spillPath.string().c_str());
+			return static_cast<std::streamsize>(toMemory);
+		}
+	}
+
+	m_size += static_cast<uint64_t>(count);
+	return count;
+}
+
+/**
+* Name: SpillBuffer::overflow
+* Description: Append single character
+* @Param ch - character
+*/
+SpillBuffer::int_type SpillBuffer::overflow(int_type ch)
+{
+	if (traits_type::eq_int_type(ch, traits_type::eof()))
+	{
+		return traits_type::not_eof(ch);
+	}
+
+	char c = traits_type::to_char_type(ch);
+	return 1 == xsputn(&c, 1) ? ch : traits_type::eof();
+}
+
+/**
+* Name: SpillBuffer::consume
+* Description: Take next bytes in write order, copy them to the output stream or drop them when it is null
+* @Param count - number of bytes
+* @Param ostream - output stream, nullptr skips the bytes
+* @Param buffer - scratch buffer used to read back the spill file
+*/
+bool SpillBuffer::consume(uint64_t count, std::ostream* ostream, std::vector<char>& buffer)
+{
+	std::size_t fromMemory = static_cast<std::size_t>(std::min<uint64_t>(count, m_memory.size() - m_readPos));
+	if (ostream)
+	{
+		ostream->write(m_memory.data() + m_readPos, static_cast<std::streamsize>(fromMemory));
+	}
+	m_readPos += fromMemory;
+	count -= fromMemory;
+
+	if (0 < count && !m_reader.is_open())
+	{
+		m_spill.close();
+		m_reader.open(m_spillPath, std::ios::binary);
+	}
+
+	if (0 < count && !ostream)
+	{
+		m_reader.seekg(static_cast<std::streamoff>(count), std::ios::cur);
+		count = 0;
+	}
+
+	while (0 < count && m_reader)
+	{
+		std::streamsize toRead = static_cast<std::streamsize>(std::min<uint64_t>(buffer.size(), count));
+		m_reader.read(buffer.data(), toRead);
+		ostream->write(buffer.data(), m_reader.gcount());
+		count -= static_cast<uint64_t>(m_reader.gcount());
+	}
+
+	if (0 < count || (m_reader.is_open() && !m_reader))
+	{
+		LOG(Error, "Cannot read spill file %s.", m_spillPath.string().c_str());
+		return false;
+	}
+
+	return !ostream || static_cast<bool>(*ostream);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <streambuf>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/**
+* Name: SpillBuffer
+* Description: Output buffer which keeps up to memoryLimit bytes in memory and spills the rest to a temporary file,
+*              so a compressed blob can wait for the ordered writer without holding the whole blob in RAM.
+*              A buffer the writer is waiting for may grow up to the extended limit instead, it is consumed right away.
+*/
+class SpillBuffer : public std::streambuf
+{
+public:
+	// asked when the memory limit is reached, true lets the buffer keep growing in memory
+	using Extension = std::function<bool()>;
+
+	SpillBuffer(std::size_t memoryLimit, fs::path spillPath, std::size_t extendedLimit = 0, Extension extend = nullptr);
+	~SpillBuffer() override;
+
+	uint64_t size() const { return m_size; }
+	bool consume(uint64_t count, std::ostream* ostream, std::vector<char>& buffer);
+
+protected:
+	std::streamsize xsputn(const char* data, std::streamsize count) override;
+	int_type overflow(int_type ch) override;
+
+private:
+	std::vector<char> m_memory;
+	const std::size_t m_memoryLimit;
+	const std::size_t m_extendedLimit;
+	const Extension m_extend;
+	const fs::path m_spillPath;
+	std::ofstream m_spill;
+	std::ifstream m_reader;
+	uint64_t m_size;
+	std::size_t m_readPos;
+};
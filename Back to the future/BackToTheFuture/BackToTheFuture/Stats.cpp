@@ -0,0 +1,270 @@
+#include "Stats.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	constexpr std::size_t STAT_COUNT = static_cast<std::size_t>(Stat::Count);
+	constexpr double MIB = 1024.0 * 1024.0;
+
+	// written by one thread only, atomic so snapshots from other threads stay well defined
+	struct ThreadCounters
+	{
+		std::array<std::atomic<uint64_t>, STAT_COUNT> values{};
+	};
+
+	// blocks of finished threads stay, their counts belong to the totals
+	struct Registry
+	{
+		std::mutex mutex;
+		std::vector<std::unique_ptr<ThreadCounters>> blocks;
+		std::atomic<uint64_t> memory{ 0 };
+		std::atomic<uint64_t> peakMemory{ 0 };
+		std::atomic<uint64_t> filesTotal{ 0 };
+
+		std::mutex progressMutex;
+		std::condition_variable progressWake;
+		std::thread progressThread;
+		bool progressStop = false;
+	};
+
+	Registry& registry()
+	{
+		static Registry instance;
+		return instance;
+	}
+
+	ThreadCounters& localCounters()
+	{
+		thread_local ThreadCounters* counters = nullptr;
+		if (!counters)
+		{
+			Registry& stats = registry();
+			std::lock_guard<std::mutex> lk(stats.mutex);
+			stats.blocks.push_back(std::make_unique<ThreadCounters>());
+			counters = stats.blocks.back().get();
+		}
+		return *counters;
+	}
+
+	uint64_t value(const Stats::Counters& counters, Stat stat)
+	{
+		return counters[static_cast<std::size_t>(stat)];
+	}
+
+	double secondsOf(const Stats::Counters& counters, Stat stat)
+	{
+		return static_cast<double>(value(counters, stat)) / 1e9;
+	}
+
+	// MiB per second of thread time, 0 when nothing was timed
+	double rate(const Stats::Counters& counters, Stat bytes, Stat nanos)
+	{
+		double time = secondsOf(counters, nanos);
+		return 0.0 < time ? static_cast<double>(value(counters, bytes)) / MIB / time : 0.0;
+	}
+
+	void appendNumber(std::string& out, const char* name, uint64_t number, bool last = false)
+	{
+		out += "\"" + std::string(name) + "\": " + std::to_string(number) + (last ? "" : ", ");
+	}
+
+	void appendNumber(std::string& out, const char* name, double number, bool last = false)
+	{
+		char buffer[64];
+		std::snprintf(buffer, sizeof(buffer), "%.3f", number);
+		out += "\"" + std::string(name) + "\": " + buffer + (last ? "" : ", ");
+	}
+
+	/**
+	* Name: printProgress
+	* Description: Print one progress line to stderr
+	* @Param elapsed - seconds since the progress started
+	*/
+	void printProgress(double elapsed)
+	{
+		Stats::Counters counters = Stats::snapshot();
+		uint64_t read = value(counters, Stat::ReadBytes);
+		std::fprintf(stderr, "progress %.1fs: files %llu/%llu, read %.1f MiB (%.1f MiB/s), written %.1f MiB\n",
+			elapsed,
+			static_cast<unsigned long long>(value(counters, Stat::FilesDone)),
+			static_cast<unsigned long long>(registry().filesTotal.load(std::memory_order_relaxed)),
+			static_cast<double>(read) / MIB,
+			0.0 < elapsed ? static_cast<double>(read) / MIB / elapsed : 0.0,
+			static_cast<double>(value(counters, Stat::WriteBytes)) / MIB);
+	}
+} // anonymous namespace
+
+/**
+* Name: Stats::add
+* Description: Add to a counter of the calling thread
+* @Param stat - counter
+* @Param value - amount
+*/
+void Stats::add(Stat stat, uint64_t value)
+{
+	std::atomic<uint64_t>& counter = localCounters().values[static_cast<std::size_t>(stat)];
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/**
+* Name: Stats::snapshot
+* Description: Sum of the counters of all threads
+*/
+Stats::Counters Stats::snapshot()
+{
+	Counters totals{};
+	Registry& stats = registry();
+	std::lock_guard<std::mutex> lk(stats.mutex);
+	for (const std::unique_ptr<ThreadCounters>& block : stats.blocks)
+	{
+		for (std::size_t i = 0; i < STAT_COUNT; i++)
+		{
+			totals[i] += block->values[i].load(std::memory_order_relaxed);
+		}
+	}
+	return totals;
+}
+
+/**
+* Name: Stats::allocate
+* Description: Account a buffer taken, raises the peak when needed
+* @Param bytes - buffer size
+*/
+void Stats::allocate(uint64_t bytes)
+{
+	Registry& stats = registry();
+	uint64_t now = stats.memory.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+	uint64_t peak = stats.peakMemory.load(std::memory_order_relaxed);
+	while (peak < now && !stats.peakMemory.compare_exchange_weak(peak, now, std::memory_order_relaxed))
+	{
+	}
+}
+
+/**
+* Name: Stats::release
+* Description: Account a buffer given back
+* @Param bytes - buffer size
+*/
+void Stats::release(uint64_t bytes)
+{
+	registry().memory.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+/**
+* Name: Stats::peakMemory
+* Description: Largest amount of buffer memory held at once
+*/
+uint64_t Stats::peakMemory()
+{
+	return registry().peakMemory.load(std::memory_order_relaxed);
+}
+
+/**
+* Name: Stats::setFilesTotal
+* Description: Set the number of files the progress lines count towards
+* @Param files - number of files
+*/
+void Stats::setFilesTotal(uint64_t files)
+{
+	registry().filesTotal.store(files, std::memory_order_relaxed);
+}
+
+/**
+* Name: Stats::startProgress
+* Description: Print a progress line to stderr every interval until stopProgress
+* @Param seconds - interval
+*/
+void Stats::startProgress(double seconds)
+{
+	Registry& stats = registry();
+	if (stats.progressThread.joinable() || 0.0 >= seconds)
+	{
+		return;
+	}
+
+	stats.progressStop = false;
+	stats.progressThread = std::thread([seconds, &stats]()
+		{
+			const auto start = std::chrono::steady_clock::now();
+			const auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+			std::unique_lock<std::mutex> lk(stats.progressMutex);
+			while (!stats.progressWake.wait_for(lk, interval, [&]() { return stats.progressStop; }))
+			{
+				printProgress(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+			}
+		});
+}
+
+/**
+* Name: Stats::stopProgress
+* Description: Stop the progress thread
+*/
+void Stats::stopProgress()
+{
+	Registry& stats = registry();
+	if (!stats.progressThread.joinable())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(stats.progressMutex);
+		stats.progressStop = true;
+	}
+	stats.progressWake.notify_one();
+	stats.progressThread.join();
+}
+
+/**
+* Name: Stats::toJson
+* Description: Report of all counters as a JSON object
+* @Param mode - command which ran
+* @Param seconds - wall clock time of the command
+*/
+std::string Stats::toJson(const std::string& mode, double seconds)
+{
+	Counters c = snapshot();
+	std::string out = "{\n";
+	out += "  \"mode\": \"" + mode + "\", ";
+	appendNumber(out, "seconds", seconds, true);
+	out += ",\n  \"scan\": { ";
+	appendNumber(out, "files", value(c, Stat::ScanFiles));
+	appendNumber(out, "bytes", value(c, Stat::ScanBytes));
+	appendNumber(out, "seconds", secondsOf(c, Stat::ScanNanos), true);
+	out += " },\n  \"hash\": { ";
+	appendNumber(out, "bytes", value(c, Stat::HashBytes));
+	appendNumber(out, "thread_seconds", secondsOf(c, Stat::HashNanos));
+	appendNumber(out, "mib_per_s", rate(c, Stat::HashBytes, Stat::HashNanos), true);
+	out += " },\n  \"compress\": { ";
+	appendNumber(out, "bytes_in", value(c, Stat::CompressIn));
+	appendNumber(out, "bytes_out", value(c, Stat::CompressOut));
+	appendNumber(out, "thread_seconds", secondsOf(c, Stat::CompressNanos));
+	appendNumber(out, "mib_per_s", rate(c, Stat::CompressIn, Stat::CompressNanos), true);
+	out += " },\n  \"decompress\": { ";
+	appendNumber(out, "bytes_in", value(c, Stat::DecompressIn));
+	appendNumber(out, "bytes_out", value(c, Stat::DecompressOut));
+	appendNumber(out, "thread_seconds", secondsOf(c, Stat::DecompressNanos));
+	appendNumber(out, "mib_per_s", rate(c, Stat::DecompressOut, Stat::DecompressNanos), true);
+	out += " },\n  \"dedup\": { ";
+	appendNumber(out, "files", value(c, Stat::DedupFiles));
+	appendNumber(out, "blobs", value(c, Stat::DedupBlobs));
+	appendNumber(out, "bytes", value(c, Stat::DedupBytes), true);
+	out += " },\n  \"io\": { ";
+	appendNumber(out, "read_bytes", value(c, Stat::ReadBytes));
+	appendNumber(out, "read_wait_seconds", secondsOf(c, Stat::ReadNanos));
+	appendNumber(out, "write_bytes", value(c, Stat::WriteBytes));
+	appendNumber(out, "write_wait_seconds", secondsOf(c, Stat::WriteNanos));
+	appendNumber(out, "hole_bytes", value(c, Stat::HoleBytes), true);
+	out += " },\n  ";
+	appendNumber(out, "files_done", value(c, Stat::FilesDone));
+	appendNumber(out, "peak_buffer_bytes", peakMemory(), true);
+	out += "\n}\n";
+	return out;
+}
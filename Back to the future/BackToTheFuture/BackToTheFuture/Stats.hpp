@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// times are nanoseconds summed over all threads, so rates are per thread
+enum class Stat : std::size_t
+{
+	ScanFiles,
+	ScanBytes,
+	ScanNanos,
+	HashBytes,
+	HashNanos,
+	CompressIn,
+	CompressOut,
+	CompressNanos,
+	DecompressIn,
+	DecompressOut,
+	DecompressNanos,
+	// files and blobs which were found stored already, and the bytes they did not add to the archive,
+	// on unpack the files copied from a restored one, and the bytes which were not inflated again
+	DedupFiles,
+	DedupBlobs,
+	DedupBytes,
+	ReadBytes,
+	ReadNanos,
+	WriteBytes,
+	WriteNanos,
+	FilesDone,
+	// bytes of holes and zero blocks which were neither stored nor written
+	HoleBytes,
+	Count,
+};
+
+/**
+* Name: Stats
+* Description: Process wide counters of the pack and unpack phases. Every thread adds to a block of counters of its
+*              own with relaxed stores, snapshots sum the blocks of all threads. Buffer memory is one shared gauge
+*              which keeps its peak. A progress thread can print the counters periodically.
+*/
+class Stats
+{
+public:
+	using Counters = std::array<uint64_t, static_cast<std::size_t>(Stat::Count)>;
+
+	static void add(Stat stat, uint64_t value);
+	static Counters snapshot();
+
+	// buffers held in memory, e.g. spill buffers and inflated solid blocks
+	static void allocate(uint64_t bytes);
+	static void release(uint64_t bytes);
+	static uint64_t peakMemory();
+
+	// files the running command will process, for progress lines
+	static void setFilesTotal(uint64_t files);
+
+	static void startProgress(double seconds);
+	static void stopProgress();
+
+	static std::string toJson(const std::string& mode, double seconds);
+
+	/**
+	* Name: Stats::Timer
+	* Description: Adds the nanoseconds of its scope to a counter
+	*/
+	class Timer
+	{
+	public:
+		explicit Timer(Stat stat) :
+			m_stat(stat), m_start(std::chrono::steady_clock::now()) {}
+
+		~Timer()
+		{
+			add(m_stat, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count()));
+		}
+
+		Timer(const Timer&) = delete;
+		Timer& operator=(const Timer&) = delete;
+
+	private:
+		const Stat m_stat;
+		const std::chrono::steady_clock::time_point m_start;
+	};
+
+	/**
+	* Name: Stats::Allocation
+	* Description: Accounts a buffer for the lifetime of its scope
+	*/
+	class Allocation
+	{
+	public:
+		explicit Allocation(uint64_t bytes) :
+			m_bytes(bytes) { allocate(m_bytes); }
+
+		~Allocation() { release(m_bytes); }
+
+		Allocation(const Allocation&) = delete;
+		Allocation& operator=(const Allocation&) = delete;
+
+	private:
+		const uint64_t m_bytes;
+	};
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+
+/**
+* Name: StreamReader
+* Description: Little endian and varint reader over a forward only stream such as stdin, the counterpart of ByteReader.
+*              A failed read sets ok() to false and returns 0.
+*/
+class StreamReader
+{
+public:
+	explicit StreamReader(std::istream& istream) :
+		m_istream(istream) {}
+
+	bool ok() const { return m_ok; }
+	std::istream& stream() { return m_istream; }
+
+	bool bytes(char* data, std::size_t count)
+	{
+		if (m_ok && !m_istream.read(data, static_cast<std::streamsize>(count)))
+		{
+			m_ok = false;
+		}
+		return m_ok;
+	}
+
+	// discard count bytes
+	void skip(uint64_t count)
+	{
+		char buffer[256];
+		while (m_ok && 0 < count)
+		{
+			std::size_t size = static_cast<std::size_t>(count < sizeof(buffer) ? count : sizeof(buffer));
+			bytes(buffer, size);
+			count -= size;
+		}
+	}
+
+	uint8_t u8() { return load<uint8_t>(); }
+	uint32_t u32() { return load<uint32_t>(); }
+	uint64_t u64() { return load<uint64_t>(); }
+
+	// LEB128, 7 bits per byte with the high bit set on all but the last byte
+	uint64_t varint()
+	{
+		uint64_t v = 0;
+		for (int shift = 0; m_ok && shift < 64; shift += 7)
+		{
+			std::istream::int_type byte = m_istream.get();
+			if (std::istream::traits_type::eof() == byte)
+			{
+				break;
+			}
+			v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			if (0 == (byte & 0x80))
+			{
+				return v;
+			}
+		}
+		m_ok = false;
+		return 0;
+	}
+
+private:
+	template <typename T>
+	T load()
+	{
+		unsigned char p[sizeof(T)];
+		if (!bytes(reinterpret_cast<char*>(p), sizeof(T)))
+		{
+			return 0;
+		}
+
+		T v = 0;
+		for (std::size_t i = 0; i < sizeof(T); i++)
+		{
+			v |= static_cast<T>(static_cast<T>(p[i]) << (8 * i));
+		}
+		return v;
+	}
+
+	std::istream& m_istream;
+	bool m_ok = true;
+};
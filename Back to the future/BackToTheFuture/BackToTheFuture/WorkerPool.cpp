@@ -0,0 +1,91 @@
+#include "WorkerPool.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+
+/**
+* Name: WorkerPool::WorkerPool
+* Description: Constructor
+* @Param threads - number of worker threads, 0 means all hardware threads
+*/
+WorkerPool::WorkerPool(std::size_t threads) :
+	m_threads(resolveThreads(threads)) {}
+
+/**
+* Name: WorkerPool::~WorkerPool
+* Description: Destructor, joins workers which are still running
+*/
+WorkerPool::~WorkerPool()
+{
+	wait();
+}
+
+/**
+* Name: WorkerPool::start
+* Description: Start workers which pull indices [0, count) in increasing order and run the task on them
+* @Param count - number of tasks
+* @Param task - task called with the task index and the worker index
+*/
+void WorkerPool::start(std::size_t count, Task task)
+{
+	LOG(Info, "Entry.");
+
+	wait();
+
+	m_task = std::move(task);
+	m_next = 0;
+
+	for (std::size_t worker = 0; worker < m_threads; worker++)
+	{
+		m_workers.emplace_back([this, count, worker]()
+			{
+				for (std::size_t index = m_next++; index < count; index = m_next++)
+				{
+					m_task(index, worker);
+				}
+			});
+	}
+
+	LOG(Info, "Exit.");
+}
+
+/**
+* Name: WorkerPool::wait
+* Description: Wait until all started tasks are finished
+*/
+void WorkerPool::wait()
+{
+	for (std::thread& worker : m_workers)
+	{
+		worker.join();
+	}
+	m_workers.clear();
+}
+
+/**
+* Name: WorkerPool::run
+* Description: Run tasks [0, count) on the workers and wait for them
+* @Param count - number of tasks
+* @Param task - task called with the task index and the worker index
+*/
+void WorkerPool::run(std::size_t count, Task task)
+{
+	start(count, std::move(task));
+	wait();
+}
+
+/**
+* Name: WorkerPool::resolveThreads
+* Description: Map requested thread count to the real one, 0 means all hardware threads, at most MAX_THREADS
+* @Param requested - requested thread count
+*/
+std::size_t WorkerPool::resolveThreads(std::size_t requested)
+{
+	if (0 != requested)
+	{
+		return std::min(requested, MAX_THREADS);
+	}
+
+	std::size_t hardware = std::thread::hardware_concurrency();
+	return 0 != hardware ? std::min<std::size_t>(hardware, MAX_THREADS) : 1;
+}
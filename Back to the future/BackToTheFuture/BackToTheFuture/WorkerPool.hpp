@@ -0,0 +1,32 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <vector>
+
+class WorkerPool
+{
+public:
+	using Task = std::function<void(std::size_t index, std::size_t worker)>;
+
+	explicit WorkerPool(std::size_t threads);
+	~WorkerPool();
+
+	void start(std::size_t count, Task task);
+	void wait();
+	void run(std::size_t count, Task task);
+
+	std::size_t size() const { return m_threads; }
+	static std::size_t resolveThreads(std::size_t requested);
+
+	// larger requests are clamped, every thread holds its own buffers and rings
+	static constexpr std::size_t MAX_THREADS = 256;
+
+private:
+	const std::size_t m_threads;
+	std::vector<std::thread> m_workers;
+	std::atomic<std::size_t> m_next{ 0 };
+	Task m_task;
+};
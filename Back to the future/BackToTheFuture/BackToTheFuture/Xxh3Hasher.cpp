@@ -0,0 +1,65 @@
+#include "Xxh3Hasher.hpp"
+
+#if defined(BTTF_WITH_XXHASH)
+
+#include "Logger.hpp"
+
+/**
+* Name: Xxh3Hasher::Xxh3Hasher
+* Description: Constructor, initializes XXH3 128 bit state
+*/
+Xxh3Hasher::Xxh3Hasher() :
+	m_state(XXH3_createState()), m_ok(false)
+{
+	if (!m_state || XXH_OK != XXH3_128bits_reset(m_state))
+	{
+		LOG(Error, "Failed to init XXH3.");
+		return;
+	}
+	m_ok = true;
+}
+
+/**
+* Name: Xxh3Hasher::~Xxh3Hasher
+* Description: Destructor, releases the state
+*/
+Xxh3Hasher::~Xxh3Hasher()
+{
+	XXH3_freeState(m_state);
+}
+
+/**
+* Name: Xxh3Hasher::update
+* Description: Feed next part of the data to the digest
+* @Param data - pointer to data
+* @Param size - data size in bytes
+*/
+bool Xxh3Hasher::update(const void* data, std::size_t size)
+{
+	if (m_ok && XXH_OK != XXH3_128bits_update(m_state, data, size))
+	{
+		LOG(Error, "Update failed.");
+		m_ok = false;
+	}
+	return m_ok;
+}
+
+/**
+* Name: Xxh3Hasher::finalDigest
+* Description: Finish digest in its canonical (big endian) form, empty digest on failure
+*/
+Digest Xxh3Hasher::finalDigest()
+{
+	Digest digest;
+	if (!m_ok)
+	{
+		return digest;
+	}
+
+	XXH128_canonical_t canonical;
+	XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(m_state));
+	digest.assign(canonical.digest, sizeof(canonical.digest));
+	return digest;
+}
+
+#endif // BTTF_WITH_XXHASH
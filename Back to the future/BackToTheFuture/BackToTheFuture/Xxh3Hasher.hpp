@@ -0,0 +1,26 @@
+#pragma once
+
+#if defined(BTTF_WITH_XXHASH)
+
+#include <xxhash.h>
+
+#include "Hasher.hpp"
+
+class Xxh3Hasher : public IHasher
+{
+public:
+	Xxh3Hasher();
+	~Xxh3Hasher() override;
+
+	Xxh3Hasher(const Xxh3Hasher&) = delete;
+	Xxh3Hasher& operator=(const Xxh3Hasher&) = delete;
+
+	bool update(const void* data, std::size_t size) override;
+	Digest finalDigest() override;
+
+private:
+	XXH3_state_t* m_state;
+	bool m_ok;
+};
+
+#endif // BTTF_WITH_XXHASH
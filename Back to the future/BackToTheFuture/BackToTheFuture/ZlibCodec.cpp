@@ -0,0 +1,210 @@
+#include "ZlibCodec.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <climits>
+
+/**
+* Name: ZlibCodec::ZlibCodec
+* Description: Constructor
+* @Param chunkSize - output buffer size
+*/
+ZlibCodec::ZlibCodec(std::size_t chunkSize) :
+	m_outBuffer(chunkSize) {}
+
+/**
+* Name: ZlibCodec::~ZlibCodec
+* Description: Destructor, releases zlib streams
+*/
+ZlibCodec::~ZlibCodec()
+{
+	if (m_deflateReady)
+	{
+		deflateEnd(&m_deflate);
+	}
+	if (m_inflateReady)
+	{
+		inflateEnd(&m_inflate);
+	}
+}
+
+/**
+* Name: ZlibCodec::setDictionary
+* Description: Set dictionary of the archive, deflate uses at most its last 32 KiB
+* @Param data - dictionary content
+* @Param size - dictionary size
+*/
+bool ZlibCodec::setDictionary(const char* data, std::size_t size)
+{
+	std::size_t window = std::min<std::size_t>(size, std::size_t(1) << MAX_WBITS);
+	m_dictionary.assign(data + size - window, data + size);
+	return !m_dictionary.empty();
+}
+
+/**
+* Name: ZlibCodec::beginCompress
+* Description: Start new zlib stream, the deflate state is reused between blobs
+* @Param level - zlib level
+* @Param longRange - not supported by zlib, ignored
+* @Param dictionary - prime the stream with the archive dictionary
+*/
+bool ZlibCodec::beginCompress(int level, bool, bool dictionary)
+{
+	if (!m_deflateReady)
+	{
+		if (Z_OK != deflateInit(&m_deflate, level))
+		{
+			LOG(Error, "deflateInit failed.");
+			return false;
+		}
+		m_deflateReady = true;
+		m_level = level;
+	}
+	else
+	{
+		deflateReset(&m_deflate);
+		if (level != m_level && Z_OK != deflateParams(&m_deflate, level, Z_DEFAULT_STRATEGY))
+		{
+			LOG(Error, "deflateParams failed.");
+			return false;
+		}
+		m_level = level;
+	}
+
+	if (dictionary && Z_OK != deflateSetDictionary(&m_deflate, reinterpret_cast<const Bytef*>(m_dictionary.data()), static_cast<uInt>(m_dictionary.size())))
+	{
+		LOG(Error, "deflateSetDictionary failed.");
+		return false;
+	}
+	return true;
+}
+
+/**
+* Name: ZlibCodec::compress
+* Description: Deflate next part of the blob, returns number of bytes written or -1 on failure
+* @Param data - input data
+* @Param size - input size
+* @Param last - finish the stream
+* @Param ostream - output stream
+*/
+int64_t ZlibCodec::compress(const char* data, std::size_t size, bool last, std::ostream& ostream)
+{
+	int64_t totalOut = 0;
+	do
+	{
+		// avail_in is 32 bit
+		std::size_t piece = std::min<std::size_t>(size, UINT_MAX);
+		int flush = last && piece == size ? Z_FINISH : Z_NO_FLUSH;
+
+		m_deflate.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+		m_deflate.avail_in = static_cast<uInt>(piece);
+
+		int ret = Z_OK;
+		do
+		{
+			m_deflate.next_out = reinterpret_cast<Bytef*>(m_outBuffer.data());
+			m_deflate.avail_out = static_cast<uInt>(m_outBuffer.size());
+
+			ret = deflate(&m_deflate, flush);
+			if (Z_STREAM_ERROR == ret)
+			{
+				LOG(Error, "Deflate error.");
+				return -1;
+			}
+
+			uInt have = static_cast<uInt>(m_outBuffer.size()) - m_deflate.avail_out;
+			ostream.write(m_outBuffer.data(), have);
+			totalOut += have;
+		} while (0 == m_deflate.avail_out || (Z_FINISH == flush && Z_STREAM_END != ret));
+
+		data += piece;
+		size -= piece;
+	} while (0 < size);
+
+	return ostream ? totalOut : -1;
+}
+
+/**
+* Name: ZlibCodec::beginDecompress
+* Description: Start reading new zlib stream, the dictionary is supplied when inflate asks for it
+* @Param dictionary - blob was primed with the archive dictionary
+*/
+bool ZlibCodec::beginDecompress(bool dictionary)
+{
+	m_finished = false;
+	if (dictionary && m_dictionary.empty())
+	{
+		LOG(Error, "Blob needs the archive dictionary.");
+		return false;
+	}
+
+	if (!m_inflateReady)
+	{
+		if (Z_OK != inflateInit(&m_inflate))
+		{
+			LOG(Error, "InflateInit failed.");
+			return false;
+		}
+		m_inflateReady = true;
+		return true;
+	}
+
+	return Z_OK == inflateReset(&m_inflate);
+}
+
+/**
+* Name: ZlibCodec::decompress
+* Description: Inflate next part of the blob
+* @Param data - compressed data
+* @Param size - compressed size
+* @Param ostream - output stream
+*/
+bool ZlibCodec::decompress(const char* data, std::size_t size, std::ostream& ostream)
+{
+	do
+	{
+		std::size_t piece = std::min<std::size_t>(size, UINT_MAX);
+		m_inflate.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+		m_inflate.avail_in = static_cast<uInt>(piece);
+
+		do
+		{
+			m_inflate.next_out = reinterpret_cast<Bytef*>(m_outBuffer.data());
+			m_inflate.avail_out = static_cast<uInt>(m_outBuffer.size());
+
+			int ret = inflate(&m_inflate, Z_NO_FLUSH);
+			if (Z_NEED_DICT == ret)
+			{
+				if (m_dictionary.empty() || Z_OK != inflateSetDictionary(&m_inflate, reinterpret_cast<const Bytef*>(m_dictionary.data()), static_cast<uInt>(m_dictionary.size())))
+				{
+					LOG(Error, "Missing inflate dictionary.");
+					return false;
+				}
+				continue;
+			}
+
+			if (0 > ret && Z_BUF_ERROR != ret)
+			{
+				LOG(Error, "Inflate error.");
+				return false;
+			}
+
+			uInt have = static_cast<uInt>(m_outBuffer.size()) - m_inflate.avail_out;
+			if (0 < have)
+			{
+				ostream.write(m_outBuffer.data(), have);
+			}
+
+			if (Z_STREAM_END == ret)
+			{
+				m_finished = true;
+				break;
+			}
+		} while (0 == m_inflate.avail_out || 0 < m_inflate.avail_in);
+
+		data += piece;
+		size -= piece;
+	} while (0 < size && !m_finished);
+
+	return static_cast<bool>(ostream);
+}
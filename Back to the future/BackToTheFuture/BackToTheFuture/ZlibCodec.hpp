@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <zlib.h>
+
+#include "Codec.hpp"
+
+class ZlibCodec : public ICodec
+{
+public:
+	explicit ZlibCodec(std::size_t chunkSize);
+	~ZlibCodec() override;
+
+	CodecId id() const override { return CodecId::Zlib; }
+	int defaultLevel() const override { return Z_BEST_COMPRESSION; }
+	int fastLevel() const override { return Z_BEST_SPEED; }
+	int minLevel() const override { return Z_DEFAULT_COMPRESSION; }
+	int maxLevel() const override { return Z_BEST_COMPRESSION; }
+
+	bool setDictionary(const char* data, std::size_t size) override;
+	bool hasDictionary() const override { return !m_dictionary.empty(); }
+
+	bool beginCompress(int level, bool longRange, bool dictionary) override;
+	int64_t compress(const char* data, std::size_t size, bool last, std::ostream& ostream) override;
+
+	bool beginDecompress(bool dictionary) override;
+	bool decompress(const char* data, std::size_t size, std::ostream& ostream) override;
+	bool finished() const override { return m_finished; }
+
+private:
+	z_stream m_deflate{};
+	z_stream m_inflate{};
+	bool m_deflateReady = false;
+	bool m_inflateReady = false;
+	int m_level = Z_BEST_COMPRESSION;
+	bool m_finished = false;
+	std::vector<char> m_outBuffer;
+	// last 32 KiB of the archive dictionary, deflate cannot reach further back
+	std::vector<char> m_dictionary;
+};
@@ -0,0 +1,212 @@
+#include "ZstdCodec.hpp"
+
+#if defined(BTTF_WITH_ZSTD)
+
+#include "Logger.hpp"
+
+namespace
+{
+	// window of the long distance matcher, 128 MiB
+	constexpr int LONG_WINDOW_LOG = 27;
+	// largest window accepted on decompression, anything zstd itself can produce
+	constexpr int MAX_WINDOW_LOG = 31;
+} // anonymous namespace
+
+/**
+* Name: ZstdCodec::ZstdCodec
+* Description: Constructor
+* @Param chunkSize - output buffer size
+*/
+ZstdCodec::ZstdCodec(std::size_t chunkSize) :
+	m_outBuffer(chunkSize) {}
+
+/**
+* Name: ZstdCodec::~ZstdCodec
+* Description: Destructor, releases zstd contexts
+*/
+ZstdCodec::~ZstdCodec()
+{
+	for (auto& cdict : m_cdicts)
+	{
+		ZSTD_freeCDict(cdict.second);
+	}
+	ZSTD_freeDDict(m_ddict);
+	ZSTD_freeCCtx(m_cctx);
+	ZSTD_freeDCtx(m_dctx);
+}
+
+/**
+* Name: ZstdCodec::setDictionary
+* Description: Set dictionary of the archive, either trained zstd dictionary or raw content
+* @Param data - dictionary content
+* @Param size - dictionary size
+*/
+bool ZstdCodec::setDictionary(const char* data, std::size_t size)
+{
+	for (auto& cdict : m_cdicts)
+	{
+		ZSTD_freeCDict(cdict.second);
+	}
+	m_cdicts.clear();
+	ZSTD_freeDDict(m_ddict);
+	m_ddict = nullptr;
+
+	m_dictionary.assign(data, data + size);
+	return !m_dictionary.empty();
+}
+
+/**
+* Name: ZstdCodec::beginCompress
+* Description: Start new zstd frame, the context is reused between blobs
+* @Param level - zstd level
+* @Param longRange - enable long distance matching with a 128 MiB window
+* @Param dictionary - prime the frame with the archive dictionary
+*/
+bool ZstdCodec::beginCompress(int level, bool longRange, bool dictionary)
+{
+	if (!m_cctx)
+	{
+		m_cctx = ZSTD_createCCtx();
+		if (!m_cctx)
+		{
+			LOG(Error, "ZSTD_createCCtx failed.");
+			return false;
+		}
+	}
+
+	ZSTD_CCtx_reset(m_cctx, ZSTD_reset_session_and_parameters);
+	if (ZSTD_isError(ZSTD_CCtx_setParameter(m_cctx, ZSTD_c_compressionLevel, level)))
+	{
+		LOG(Error, "Invalid zstd level %d.", level);
+		return false;
+	}
+
+	if (longRange)
+	{
+		ZSTD_CCtx_setParameter(m_cctx, ZSTD_c_enableLongDistanceMatching, 1);
+		ZSTD_CCtx_setParameter(m_cctx, ZSTD_c_windowLog, LONG_WINDOW_LOG);
+	}
+
+	if (dictionary)
+	{
+		ZSTD_CDict*& cdict = m_cdicts[level];
+		if (!cdict)
+		{
+			cdict = ZSTD_createCDict(m_dictionary.data(), m_dictionary.size(), level);
+		}
+
+		if (!cdict || ZSTD_isError(ZSTD_CCtx_refCDict(m_cctx, cdict)))
+		{
+			LOG(Error, "Cannot load zstd dictionary.");
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+* Name: ZstdCodec::compress
+* Description: Compress next part of the frame, returns number of bytes written or -1 on failure
+* @Param data - input data
+* @Param size - input size
+* @Param last - end the frame
+* @Param ostream - output stream
+*/
+int64_t ZstdCodec::compress(const char* data, std::size_t size, bool last, std::ostream& ostream)
+{
+	ZSTD_inBuffer input{ data, size, 0 };
+	ZSTD_EndDirective mode = last ? ZSTD_e_end : ZSTD_e_continue;
+
+	int64_t totalOut = 0;
+	std::size_t remaining = 0;
+	do
+	{
+		ZSTD_outBuffer output{ m_outBuffer.data(), m_outBuffer.size(), 0 };
+
+		remaining = ZSTD_compressStream2(m_cctx, &output, &input, mode);
+		if (ZSTD_isError(remaining))
+		{
+			LOG(Error, "Zstd error %s.", ZSTD_getErrorName(remaining));
+			return -1;
+		}
+
+		ostream.write(m_outBuffer.data(), static_cast<std::streamsize>(output.pos));
+		totalOut += static_cast<int64_t>(output.pos);
+	} while (last ? 0 != remaining : input.pos < input.size);
+
+	return ostream ? totalOut : -1;
+}
+
+/**
+* Name: ZstdCodec::beginDecompress
+* Description: Start reading new zstd frame
+* @Param dictionary - frame was primed with the archive dictionary
+*/
+bool ZstdCodec::beginDecompress(bool dictionary)
+{
+	m_finished = false;
+	if (!m_dctx)
+	{
+		m_dctx = ZSTD_createDCtx();
+		if (!m_dctx)
+		{
+			LOG(Error, "ZSTD_createDCtx failed.");
+			return false;
+		}
+		ZSTD_DCtx_setParameter(m_dctx, ZSTD_d_windowLogMax, MAX_WINDOW_LOG);
+	}
+	else if (ZSTD_isError(ZSTD_DCtx_reset(m_dctx, ZSTD_reset_session_only)))
+	{
+		return false;
+	}
+
+	// a referenced dictionary stays until it is replaced, frames without one get none
+	if (dictionary && !m_ddict && !m_dictionary.empty())
+	{
+		m_ddict = ZSTD_createDDict(m_dictionary.data(), m_dictionary.size());
+	}
+
+	if (dictionary && !m_ddict)
+	{
+		LOG(Error, "Blob needs the archive dictionary.");
+		return false;
+	}
+	return !ZSTD_isError(ZSTD_DCtx_refDDict(m_dctx, dictionary ? m_ddict : nullptr));
+}
+
+/**
+* Name: ZstdCodec::decompress
+* Description: Decompress next part of the frame
+* @Param data - compressed data
+* @Param size - compressed size
+* @Param ostream - output stream
+*/
+bool ZstdCodec::decompress(const char* data, std::size_t size, std::ostream& ostream)
+{
+	ZSTD_inBuffer input{ data, size, 0 };
+
+	while (!m_finished)
+	{
+		ZSTD_outBuffer output{ m_outBuffer.data(), m_outBuffer.size(), 0 };
+
+		std::size_t ret = ZSTD_decompressStream(m_dctx, &output, &input);
+		if (ZSTD_isError(ret))
+		{
+			LOG(Error, "Zstd error %s.", ZSTD_getErrorName(ret));
+			return false;
+		}
+
+		ostream.write(m_outBuffer.data(), static_cast<std::streamsize>(output.pos));
+		m_finished = 0 == ret;
+
+		// output buffer not full means zstd needs more input
+		if (input.pos == input.size && output.pos < output.size)
+		{
+			break;
+		}
+	}
+
+	return static_cast<bool>(ostream);
+}
+
+#endif // BTTF_WITH_ZSTD
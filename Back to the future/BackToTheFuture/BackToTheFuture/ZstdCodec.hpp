@@ -0,0 +1,44 @@
+#pragma once
+
+#if defined(BTTF_WITH_ZSTD)
+
+#include <map>
+#include <vector>
+#include <zstd.h>
+
+#include "Codec.hpp"
+
+class ZstdCodec : public ICodec
+{
+public:
+	explicit ZstdCodec(std::size_t chunkSize);
+	~ZstdCodec() override;
+
+	CodecId id() const override { return CodecId::Zstd; }
+	int defaultLevel() const override { return 3; }
+	int fastLevel() const override { return 1; }
+	int minLevel() const override { return ZSTD_minCLevel(); }
+	int maxLevel() const override { return ZSTD_maxCLevel(); }
+
+	bool setDictionary(const char* data, std::size_t size) override;
+	bool hasDictionary() const override { return !m_dictionary.empty(); }
+
+	bool beginCompress(int level, bool longRange, bool dictionary) override;
+	int64_t compress(const char* data, std::size_t size, bool last, std::ostream& ostream) override;
+
+	bool beginDecompress(bool dictionary) override;
+	bool decompress(const char* data, std::size_t size, std::ostream& ostream) override;
+	bool finished() const override { return m_finished; }
+
+private:
+	ZSTD_CCtx* m_cctx = nullptr;
+	ZSTD_DCtx* m_dctx = nullptr;
+	bool m_finished = false;
+	std::vector<char> m_outBuffer;
+	std::vector<char> m_dictionary;
+	// dictionary digested once per compression level and once for decompression
+	std::map<int, ZSTD_CDict*> m_cdicts;
+	ZSTD_DDict* m_ddict = nullptr;
+};
+
+#endif // BTTF_WITH_ZSTD
@@ -0,0 +1,638 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+#include "Codec.hpp"
+#include "Compressor.hpp"
+#include "CorpusGenerator.hpp"
+#include "FileManager.hpp"
+#include "FileScanner.hpp"
+#include "Hasher.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	const char* FILES_OPTION = "--files";
+	const char* SIZE_OPTION = "--size";
+	const char* DISTRIBUTION_OPTION = "--distribution";
+	const char* DUPLICATES_OPTION = "--duplicates";
+	const char* COMPRESSIBILITY_OPTION = "--compressibility";
+	const char* SEED_OPTION = "--seed";
+	const char* THREADS_OPTION = "--threads";
+	const char* CODEC_OPTION = "--codec";
+	const char* HASH_OPTION = "--hash";
+	const char* SAMPLE_OPTION = "--sample";
+	const char* REPEAT_OPTION = "--repeat";
+	const char* ONLY_OPTION = "--only";
+	const char* DIR_OPTION = "--dir";
+	const char* JSON_OPTION = "--json";
+	const char* KEEP_OPTION = "--keep";
+
+	constexpr double MIB = 1024.0 * 1024.0;
+	// micro benchmarks feed their data in pieces of this size, as the compressor does
+	constexpr std::size_t PIECE_SIZE = 1 << 20;
+
+	struct BenchOptions
+	{
+		CorpusParams corpus;
+		std::size_t threads = 0;
+		CodecParams codec;
+		HashId hash = HashId::Sha256;
+		std::size_t sampleSize = 32 << 20;
+		std::size_t repeat = 3;
+		std::vector<std::string> only;
+		fs::path dir = "bttf_bench";
+		fs::path json;
+		bool keep = false;
+	};
+
+	struct Result
+	{
+		std::string name;
+		double seconds = 0.0;
+		uint64_t bytes = 0;
+		uint64_t files = 0;
+		// output size to input size, 0 when it does not apply
+		double ratio = 0.0;
+		double peakRssMib = 0.0;
+	};
+
+	/**
+	* Name: VectorBuffer
+	* Description: Output buffer collecting everything written, or only counting it
+	*/
+	class VectorBuffer : public std::streambuf
+	{
+	public:
+		explicit VectorBuffer(bool keep) : m_keep(keep) {}
+
+		const std::vector<char>& data() const { return m_data; }
+		uint64_t size() const { return m_size; }
+		void clear() { m_data.clear(); m_size = 0; }
+
+	protected:
+		std::streamsize xsputn(const char* data, std::streamsize count) override
+		{
+			if (m_keep)
+			{
+				m_data.insert(m_data.end(), data, data + count);
+			}
+			m_size += static_cast<uint64_t>(count);
+			return count;
+		}
+
+		int_type overflow(int_type ch) override
+		{
+			if (traits_type::eq_int_type(ch, traits_type::eof()))
+			{
+				return traits_type::not_eof(ch);
+			}
+			char c = traits_type::to_char_type(ch);
+			return 1 == xsputn(&c, 1) ? ch : traits_type::eof();
+		}
+
+	private:
+		const bool m_keep;
+		std::vector<char> m_data;
+		uint64_t m_size = 0;
+	};
+
+	uint64_t parseSize(const std::string& text)
+	{
+		std::size_t end = 0;
+		uint64_t value = std::stoull(text, &end);
+		if (end < text.size())
+		{
+			switch (std::toupper(static_cast<unsigned char>(text[end])))
+			{
+			case 'K': value <<= 10; break;
+			case 'M': value <<= 20; break;
+			case 'G': value <<= 30; break;
+			default: break;
+			}
+		}
+		return value;
+	}
+
+	/**
+	* Name: resetPeakRss
+	* Description: Start a new peak resident set size measurement, where the kernel allows it
+	*/
+	void resetPeakRss()
+	{
+#if defined(__linux__)
+		std::ofstream clearRefs("/proc/self/clear_refs");
+		clearRefs << "5";
+#endif
+	}
+
+	/**
+	* Name: peakRssMib
+	* Description: Peak resident set size since the last reset, or of the whole process
+	*/
+	double peakRssMib()
+	{
+#if defined(__linux__)
+		std::ifstream status("/proc/self/status");
+		std::string line;
+		while (std::getline(status, line))
+		{
+			if (0 == line.compare(0, 6, "VmHWM:"))
+			{
+				return static_cast<double>(std::stoull(line.substr(6))) / 1024.0;
+			}
+		}
+#endif
+#if !defined(_WIN32)
+		rusage usage{};
+		getrusage(RUSAGE_SELF, &usage);
+		return static_cast<double>(usage.ru_maxrss) / 1024.0;
+#else
+		return 0.0;
+#endif
+	}
+
+	/**
+	* Name: measure
+	* Description: Run a benchmark repeat times and keep the fastest run
+	* @Param repeat - number of runs
+	* @Param run - benchmark, fills bytes, files and ratio of its result
+	* @Param result - output result
+	*/
+	bool measure(std::size_t repeat, const std::function<bool(Result&)>& run, Result& result)
+	{
+		for (std::size_t i = 0; i < std::max<std::size_t>(1, repeat); i++)
+		{
+			Result attempt = result;
+			resetPeakRss();
+			auto start = std::chrono::steady_clock::now();
+			if (!run(attempt))
+			{
+				return false;
+			}
+			attempt.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			attempt.peakRssMib = peakRssMib();
+			if (0 == i || attempt.seconds < result.seconds)
+			{
+				result = attempt;
+			}
+		}
+		return true;
+	}
+
+	void printResult(const Result& result)
+	{
+		double mibPerSecond = 0.0 < result.seconds ? static_cast<double>(result.bytes) / MIB / result.seconds : 0.0;
+		double filesPerSecond = 0.0 < result.seconds ? static_cast<double>(result.files) / result.seconds : 0.0;
+		std::printf("%-28s %9.3f %10.1f %11.0f %7.3f %9.1f\n", result.name.c_str(), result.seconds, mibPerSecond, filesPerSecond, result.ratio, result.peakRssMib);
+		std::fflush(stdout);
+	}
+
+	bool selected(const BenchOptions& options, const std::string& group)
+	{
+		return options.only.empty() || options.only.end() != std::find(options.only.begin(), options.only.end(), group);
+	}
+
+	/**
+	* Name: hashBenchmarks
+	* Description: Hash the sample with every available hash
+	* @Param options - benchmark options
+	* @Param sample - data to hash
+	* @Param results - output results
+	*/
+	bool hashBenchmarks(const BenchOptions& options, const std::vector<char>& sample, std::vector<Result>& results)
+	{
+		for (HashId id : { HashId::Sha256, HashId::Blake3, HashId::Xxh3_128 })
+		{
+			if (!isHashAvailable(id))
+			{
+				continue;
+			}
+
+			Result result;
+			result.name = std::string("hash ") + hashName(id);
+			bool ok = measure(options.repeat, [&](Result& attempt)
+				{
+					std::unique_ptr<IHasher> hasher = createHasher(id);
+					for (std::size_t offset = 0; offset < sample.size(); offset += PIECE_SIZE)
+					{
+						hasher->update(sample.data() + offset, std::min(PIECE_SIZE, sample.size() - offset));
+					}
+					attempt.bytes = sample.size();
+					return !hasher->finalDigest().empty();
+				}, result);
+			if (!ok)
+			{
+				return false;
+			}
+			printResult(result);
+			results.push_back(result);
+		}
+		return true;
+	}
+
+	/**
+	* Name: codecBenchmarks
+	* Description: Compress the sample as one blob with every available codec at its default level and inflate it again
+	* @Param options - benchmark options
+	* @Param sample - data to compress
+	* @Param results - output results
+	*/
+	bool codecBenchmarks(const BenchOptions& options, const std::vector<char>& sample, std::vector<Result>& results)
+	{
+		for (CodecId id : { CodecId::Stored, CodecId::Zlib, CodecId::Zstd, CodecId::Lz4 })
+		{
+			std::unique_ptr<ICodec> codec = isCodecAvailable(id) ? createCodec(id, PIECE_SIZE) : nullptr;
+			if (!codec)
+			{
+				continue;
+			}
+
+			VectorBuffer compressed(true);
+			Result compress;
+			compress.name = std::string("codec ") + codecName(id) + " compress";
+			bool ok = measure(options.repeat, [&](Result& attempt)
+				{
+					compressed.clear();
+					std::ostream ostream(&compressed);
+					if (!codec->beginCompress(codec->defaultLevel(), false, false))
+					{
+						return false;
+					}
+					for (std::size_t offset = 0; offset < sample.size(); offset += PIECE_SIZE)
+					{
+						std::size_t size = std::min(PIECE_SIZE, sample.size() - offset);
+						if (0 > codec->compress(sample.data() + offset, size, offset + size == sample.size(), ostream))
+						{
+							return false;
+						}
+					}
+					attempt.bytes = sample.size();
+					attempt.ratio = static_cast<double>(compressed.size()) / static_cast<double>(sample.size());
+					return true;
+				}, compress);
+			if (!ok)
+			{
+				std::cerr << "Codec " << codecName(id) << " failed\n";
+				return false;
+			}
+			printResult(compress);
+			results.push_back(compress);
+
+			Result decompress;
+			decompress.name = std::string("codec ") + codecName(id) + " decompress";
+			ok = measure(options.repeat, [&](Result& attempt)
+				{
+					VectorBuffer restored(false);
+					std::ostream ostream(&restored);
+					const std::vector<char>& data = compressed.data();
+					if (!codec->beginDecompress(false))
+					{
+						return false;
+					}
+					for (std::size_t offset = 0; offset < data.size(); offset += PIECE_SIZE)
+					{
+						if (!codec->decompress(data.data() + offset, std::min(PIECE_SIZE, data.size() - offset), ostream))
+						{
+							return false;
+						}
+					}
+					attempt.bytes = restored.size();
+					return restored.size() == sample.size();
+				}, decompress);
+			if (!ok)
+			{
+				std::cerr << "Codec " << codecName(id) << " did not restore the sample\n";
+				return false;
+			}
+			printResult(decompress);
+			results.push_back(decompress);
+		}
+		return true;
+	}
+
+	/**
+	* Name: treeSize
+	* Description: Count the regular files below a directory and their bytes
+	* @Param root - directory
+	* @Param files - output file count
+	* @Param bytes - output total size
+	*/
+	void treeSize(const fs::path& root, uint64_t& files, uint64_t& bytes)
+	{
+		files = 0;
+		bytes = 0;
+		for (const fs::directory_entry& entry : fs::recursive_directory_iterator(root))
+		{
+			if (entry.is_regular_file())
+			{
+				files++;
+				bytes += entry.file_size();
+			}
+		}
+	}
+
+	void writeJson(const BenchOptions& options, const CorpusInfo& corpus, const std::vector<Result>& results)
+	{
+		std::ofstream json(options.json, std::ios::binary);
+		char buffer[256];
+		json << "{\n  \"corpus\": { \"files\": " << corpus.files << ", \"bytes\": " << corpus.bytes
+			<< ", \"duplicates\": " << corpus.duplicates << ", \"seed\": " << options.corpus.seed << " },\n  \"results\": [\n";
+		for (std::size_t i = 0; i < results.size(); i++)
+		{
+			const Result& result = results[i];
+			double mibPerSecond = 0.0 < result.seconds ? static_cast<double>(result.bytes) / MIB / result.seconds : 0.0;
+			double filesPerSecond = 0.0 < result.seconds ? static_cast<double>(result.files) / result.seconds : 0.0;
+			std::snprintf(buffer, sizeof(buffer),
+				"    { \"name\": \"%s\", \"seconds\": %.4f, \"bytes\": %llu, \"files\": %llu, \"mib_per_s\": %.2f, \"files_per_s\": %.1f, \"ratio\": %.4f, \"peak_rss_mib\": %.1f }%s\n",
+				result.name.c_str(), result.seconds, static_cast<unsigned long long>(result.bytes), static_cast<unsigned long long>(result.files),
+				mibPerSecond, filesPerSecond, result.ratio, result.peakRssMib, i + 1 < results.size() ? "," : "");
+			json << buffer;
+		}
+		json << "  ]\n}\n";
+	}
+
+	void printHelp()
+	{
+		std::cout << "Usage: bttf_bench [--files N] [--size SIZE] [--distribution fixed|uniform|lognormal] [--duplicates RATIO]\n"
+			<< "                  [--compressibility RATIO] [--seed N] [--threads N] [--codec NAME[:LEVEL]] [--hash NAME]\n"
+			<< "                  [--sample SIZE] [--repeat N] [--only GROUP] [--dir PATH] [--json PATH] [--keep]\n"
+			<< "Options:\n"
+			<< "       --files N                   files in the corpus (default 10000)\n"
+			<< "       --size SIZE                 mean file size, K/M/G suffixes allowed (default 16K)\n"
+			<< "       --distribution NAME         file size distribution (default lognormal)\n"
+			<< "       --duplicates RATIO          share of files which copy an earlier file (default 0.1)\n"
+			<< "       --compressibility RATIO     share of text like content, the rest is random (default 0.5)\n"
+			<< "       --seed N                    seed of the corpus, equal seeds give equal corpora (default 1)\n"
+			<< "       --threads N                 worker threads of scan, pack and unpack, 0 uses all cores (default 0)\n"
+			<< "       --codec NAME[:LEVEL]        codec of the pack benchmark (default zlib)\n"
+			<< "       --hash NAME                 hash of the pack benchmark (default sha256)\n"
+			<< "       --sample SIZE               data size of the hash and codec benchmarks (default 32M)\n"
+			<< "       --repeat N                  runs of every benchmark, the fastest is reported (default 3)\n"
+			<< "       --only GROUP                run only scan, hash, codec, pack or unpack, may be repeated\n"
+			<< "       --dir PATH                  working directory for corpus and archive (default bttf_bench)\n"
+			<< "       --json PATH                 also write the results as JSON\n"
+			<< "       --keep                      keep corpus, archive and restored tree\n";
+	}
+
+	bool parseOptions(int argc, char** argv, BenchOptions& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string option(argv[i]);
+			bool hasValue = i + 1 < argc;
+			if (FILES_OPTION == option && hasValue)
+			{
+				options.corpus.files = std::stoul(argv[++i]);
+			}
+			else if (SIZE_OPTION == option && hasValue)
+			{
+				options.corpus.meanSize = parseSize(argv[++i]);
+			}
+			else if (DISTRIBUTION_OPTION == option && hasValue)
+			{
+				if (!CorpusGenerator::parseDistribution(argv[++i], options.corpus.distribution))
+				{
+					std::cout << "Unknown distribution " << argv[i] << "\n";
+					return false;
+				}
+			}
+			else if (DUPLICATES_OPTION == option && hasValue)
+			{
+				options.corpus.duplicateRatio = std::stod(argv[++i]);
+			}
+			else if (COMPRESSIBILITY_OPTION == option && hasValue)
+			{
+				options.corpus.compressibility = std::stod(argv[++i]);
+			}
+			else if (SEED_OPTION == option && hasValue)
+			{
+				options.corpus.seed = std::stoull(argv[++i]);
+			}
+			else if (THREADS_OPTION == option && hasValue)
+			{
+				options.threads = std::stoul(argv[++i]);
+			}
+			else if (CODEC_OPTION == option && hasValue)
+			{
+				std::string value(argv[++i]);
+				std::size_t colon = value.find(':');
+				if (!parseCodecName(value.substr(0, colon), options.codec.id) || !isCodecAvailable(options.codec.id))
+				{
+					std::cout << "Codec " << value << " is not available\n";
+					return false;
+				}
+				if (std::string::npos != colon)
+				{
+					options.codec.level = std::stoi(value.substr(colon + 1));
+				}
+			}
+			else if (HASH_OPTION == option && hasValue)
+			{
+				if (!parseHashName(argv[++i], options.hash) || !isHashAvailable(options.hash))
+				{
+					std::cout << "Hash " << argv[i] << " is not available\n";
+					return false;
+				}
+			}
+			else if (SAMPLE_OPTION == option && hasValue)
+			{
+				options.sampleSize = static_cast<std::size_t>(parseSize(argv[++i]));
+			}
+			else if (REPEAT_OPTION == option && hasValue)
+			{
+				options.repeat = std::stoul(argv[++i]);
+			}
+			else if (ONLY_OPTION == option && hasValue)
+			{
+				options.only.push_back(argv[++i]);
+			}
+			else if (DIR_OPTION == option && hasValue)
+			{
+				options.dir = argv[++i];
+			}
+			else if (JSON_OPTION == option && hasValue)
+			{
+				options.json = argv[++i];
+			}
+			else if (KEEP_OPTION == option)
+			{
+				options.keep = true;
+			}
+			else
+			{
+				std::cout << "Unknown option " << option << "\n";
+				return false;
+			}
+		}
+		return true;
+	}
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+	BenchOptions options;
+	if (!parseOptions(argc, argv, options))
+	{
+		printHelp();
+		return 1;
+	}
+
+	const fs::path corpusDir = options.dir / "corpus";
+	const fs::path archivePath = options.dir / "corpus.tmar";
+	const fs::path restoreDir = options.dir / "restore";
+	std::vector<Result> results;
+
+	std::printf("%-28s %9s %10s %11s %7s %9s\n", "benchmark", "seconds", "MiB/s", "files/s", "ratio", "peak MiB");
+
+	// the corpus is generated once, the seed makes it the same on every machine
+	CorpusInfo corpus;
+	bool needsCorpus = selected(options, "scan") || selected(options, "pack") || selected(options, "unpack");
+	if (needsCorpus)
+	{
+		Result result;
+		result.name = "corpus generate";
+		bool ok = measure(1, [&](Result& attempt)
+			{
+				CorpusGenerator generator(options.corpus);
+				if (!generator.generate(corpusDir, corpus))
+				{
+					return false;
+				}
+				attempt.bytes = corpus.bytes;
+				attempt.files = corpus.files;
+				return true;
+			}, result);
+		if (!ok)
+		{
+			std::cerr << "Cannot write the corpus to " << corpusDir.string() << "\n";
+			return 1;
+		}
+		printResult(result);
+		results.push_back(result);
+	}
+
+	if (selected(options, "scan"))
+	{
+		Result result;
+		result.name = "scan";
+		measure(options.repeat, [&](Result& attempt)
+			{
+				FileScanner scanner;
+				std::vector<FileMetadata> files = scanner.scanFiles(corpusDir, options.threads, false);
+				attempt.files = files.size();
+				for (const FileMetadata& file : files)
+				{
+					attempt.bytes += file.size;
+				}
+				return true;
+			}, result);
+		printResult(result);
+		results.push_back(result);
+	}
+
+	// micro benchmarks share one sample of the corpus compressibility
+	if (selected(options, "hash") || selected(options, "codec"))
+	{
+		std::vector<char> sample(options.sampleSize);
+		CorpusParams sampleParams = options.corpus;
+		sampleParams.seed++;
+		CorpusGenerator(sampleParams).fill(sample.data(), sample.size());
+
+		if (selected(options, "hash") && !hashBenchmarks(options, sample, results))
+		{
+			return 1;
+		}
+		if (selected(options, "codec") && !codecBenchmarks(options, sample, results))
+		{
+			return 1;
+		}
+	}
+
+	FileScanner scanner;
+	Compressor compressor;
+	FileManager fileManager(compressor, scanner);
+	if (selected(options, "pack") || selected(options, "unpack"))
+	{
+		PackOptions packOptions;
+		packOptions.threads = options.threads;
+		packOptions.codec = options.codec;
+		packOptions.hash = options.hash;
+		// every run reads and hashes all files
+		packOptions.cache = CacheMode::Off;
+
+		Result result;
+		result.name = std::string("pack ") + codecName(options.codec.id);
+		measure(selected(options, "pack") ? options.repeat : 1, [&](Result& attempt)
+			{
+				if (!fileManager.Pack(corpusDir, archivePath, packOptions))
+				{
+					return false;
+				}
+				attempt.bytes = corpus.bytes;
+				attempt.files = corpus.files;
+				std::error_code error;
+				attempt.ratio = 0 != corpus.bytes ? static_cast<double>(fs::file_size(archivePath, error)) / static_cast<double>(corpus.bytes) : 0.0;
+				return !error;
+			}, result);
+		if (selected(options, "pack"))
+		{
+			printResult(result);
+			results.push_back(result);
+		}
+	}
+
+	if (selected(options, "unpack"))
+	{
+		UnpackOptions unpackOptions;
+		unpackOptions.threads = options.threads;
+
+		Result result;
+		result.name = "unpack";
+		bool ok = measure(options.repeat, [&](Result& attempt)
+			{
+				std::error_code error;
+				fs::remove_all(restoreDir, error);
+				attempt.bytes = corpus.bytes;
+				attempt.files = corpus.files;
+				return fileManager.Unpack(archivePath, restoreDir, unpackOptions);
+			}, result);
+
+		// the restored tree must match the corpus in file count and size
+		uint64_t files = 0;
+		uint64_t bytes = 0;
+		treeSize(restoreDir, files, bytes);
+		if (!ok || files != corpus.files || bytes != corpus.bytes)
+		{
+			std::cerr << "Restored tree differs from the corpus: " << files << " files, " << bytes << " bytes\n";
+			return 1;
+		}
+		printResult(result);
+		results.push_back(result);
+	}
+
+	if (!options.json.empty())
+	{
+		writeJson(options, corpus, results);
+	}
+
+	if (!options.keep)
+	{
+		std::error_code error;
+		fs::remove_all(corpusDir, error);
+		fs::remove_all(restoreDir, error);
+		fs::remove(archivePath, error);
+	}
+	return 0;
+}
@@ -0,0 +1,189 @@
+#include "CorpusGenerator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+	// word list of the text like runs, a small vocabulary compresses about like source code
+	const char* const WORDS[] = {
+		"the", "file", "archive", "return", "const", "std::size_t", "if", "else", "for", "while", "value",
+		"buffer", "index", "stream", "offset", "length", "digest", "block", "static_cast", "include", "namespace",
+		"class", "struct", "void", "bool", "uint64_t", "error", "options", "path", "data", "size", "{", "}", ";",
+	};
+	constexpr std::size_t WORD_COUNT = sizeof(WORDS) / sizeof(WORDS[0]);
+
+	// content is produced in runs of this size, each either text or random bytes
+	constexpr std::size_t RUN_SIZE = 64;
+	// lognormal shape and the cap of its tail as a multiple of the mean size
+	constexpr double LOGNORMAL_SIGMA = 1.5;
+	constexpr uint64_t SIZE_CAP_FACTOR = 64;
+} // anonymous namespace
+
+/**
+* Name: CorpusGenerator::CorpusGenerator
+* Description: Constructor
+* @Param params - corpus parameters
+*/
+CorpusGenerator::CorpusGenerator(const CorpusParams& params) :
+	m_params(params), m_random(params.seed) {}
+
+/**
+* Name: CorpusGenerator::parseDistribution
+* Description: Size distribution from its name: fixed, uniform or lognormal
+* @Param name - distribution name
+* @Param distribution - parsed distribution
+*/
+bool CorpusGenerator::parseDistribution(const std::string& name, SizeDistribution& distribution)
+{
+	if ("fixed" == name)
+	{
+		distribution = SizeDistribution::Fixed;
+	}
+	else if ("uniform" == name)
+	{
+		distribution = SizeDistribution::Uniform;
+	}
+	else if ("lognormal" == name)
+	{
+		distribution = SizeDistribution::LogNormal;
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+/**
+* Name: CorpusGenerator::generate
+* Description: Write the corpus below root, which is emptied first
+* @Param root - corpus directory
+* @Param info - output file count, duplicates and total size
+*/
+bool CorpusGenerator::generate(const fs::path& root, CorpusInfo& info)
+{
+	std::error_code error;
+	fs::remove_all(root, error);
+	fs::create_directories(root, error);
+	if (error)
+	{
+		return false;
+	}
+
+	info = CorpusInfo();
+	std::vector<std::size_t> unique;
+	std::vector<char> data;
+	std::uniform_real_distribution<double> chance(0.0, 1.0);
+	for (std::size_t i = 0; i < m_params.files; i++)
+	{
+		fs::path path = root / pathOf(i);
+		fs::create_directories(path.parent_path(), error);
+
+		if (!unique.empty() && chance(m_random) < m_params.duplicateRatio)
+		{
+			// copy of an earlier file, the copy keeps its own path
+			std::size_t original = unique[std::uniform_int_distribution<std::size_t>(0, unique.size() - 1)(m_random)];
+			fs::copy_file(root / pathOf(original), path, fs::copy_options::overwrite_existing, error);
+			if (error)
+			{
+				return false;
+			}
+			info.duplicates++;
+			info.bytes += fs::file_size(path);
+		}
+		else
+		{
+			data.resize(static_cast<std::size_t>(nextSize()));
+			fill(data.data(), data.size());
+
+			std::ofstream file(path, std::ios::binary | std::ios::trunc);
+			if (!file.write(data.data(), static_cast<std::streamsize>(data.size())))
+			{
+				return false;
+			}
+			unique.push_back(i);
+			info.bytes += data.size();
+		}
+		info.files++;
+	}
+	return true;
+}
+
+/**
+* Name: CorpusGenerator::fill
+* Description: Fill a buffer with content of the configured compressibility
+* @Param data - buffer
+* @Param size - buffer size
+*/
+void CorpusGenerator::fill(char* data, std::size_t size)
+{
+	std::uniform_real_distribution<double> chance(0.0, 1.0);
+	std::uniform_int_distribution<std::size_t> word(0, WORD_COUNT - 1);
+	for (std::size_t offset = 0; offset < size; offset += RUN_SIZE)
+	{
+		std::size_t run = std::min(RUN_SIZE, size - offset);
+		if (chance(m_random) < m_params.compressibility)
+		{
+			std::size_t written = 0;
+			while (written < run)
+			{
+				const char* text = WORDS[word(m_random)];
+				std::size_t length = std::min(std::strlen(text), run - written);
+				std::memcpy(data + offset + written, text, length);
+				written += length;
+				if (written < run)
+				{
+					data[offset + written++] = ' ';
+				}
+			}
+			continue;
+		}
+
+		for (std::size_t i = 0; i < run; i += sizeof(uint64_t))
+		{
+			uint64_t bits = m_random();
+			std::memcpy(data + offset + i, &bits, std::min(sizeof(bits), run - i));
+		}
+	}
+}
+
+/**
+* Name: CorpusGenerator::nextSize
+* Description: Draw the size of the next unique file
+*/
+uint64_t CorpusGenerator::nextSize()
+{
+	const double mean = static_cast<double>(m_params.meanSize);
+	switch (m_params.distribution)
+	{
+	case SizeDistribution::Fixed:
+		return m_params.meanSize;
+	case SizeDistribution::Uniform:
+		return static_cast<uint64_t>(std::uniform_real_distribution<double>(0.0, 2.0 * mean)(m_random));
+	case SizeDistribution::LogNormal:
+	default:
+		{
+			double size = std::lognormal_distribution<double>(std::log(std::max(1.0, mean)), LOGNORMAL_SIGMA)(m_random);
+			return std::min(static_cast<uint64_t>(size), SIZE_CAP_FACTOR * m_params.meanSize);
+		}
+	}
+}
+
+/**
+* Name: CorpusGenerator::pathOf
+* Description: Relative path of the file with the given index, e.g. d003/d012/f001234.dat
+* @Param index - file index
+*/
+std::string CorpusGenerator::pathOf(std::size_t index) const
+{
+	const std::size_t perDirectory = std::max<std::size_t>(1, m_params.filesPerDirectory);
+	std::size_t directory = index / perDirectory;
+
+	char path[64];
+	std::snprintf(path, sizeof(path), "d%03zu/d%03zu/f%07zu.dat", directory / perDirectory, directory % perDirectory, index);
+	return path;
+}
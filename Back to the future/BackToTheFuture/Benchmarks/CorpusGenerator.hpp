@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+enum class SizeDistribution
+{
+	// every file has the mean size
+	Fixed,
+	// sizes uniform in [0, 2 * mean]
+	Uniform,
+	// many small files and a long tail of large ones, median is the mean size
+	LogNormal,
+};
+
+struct CorpusParams
+{
+	std::size_t files = 10000;
+	uint64_t meanSize = 16 << 10;
+	SizeDistribution distribution = SizeDistribution::LogNormal;
+	// share of files which repeat the content of an earlier file
+	double duplicateRatio = 0.1;
+	// share of the content which is text like, the rest is random bytes
+	double compressibility = 0.5;
+	// files per directory, directories nest two levels deep
+	std::size_t filesPerDirectory = 100;
+	uint64_t seed = 1;
+};
+
+struct CorpusInfo
+{
+	std::size_t files = 0;
+	std::size_t duplicates = 0;
+	uint64_t bytes = 0;
+};
+
+/**
+* Name: CorpusGenerator
+* Description: Writes a reproducible synthetic source tree, the same parameters and seed give the same bytes
+*/
+class CorpusGenerator
+{
+public:
+	explicit CorpusGenerator(const CorpusParams& params);
+
+	bool generate(const fs::path& root, CorpusInfo& info);
+	void fill(char* data, std::size_t size);
+
+	static bool parseDistribution(const std::string& name, SizeDistribution& distribution);
+
+private:
+	uint64_t nextSize();
+	std::string pathOf(std::size_t index) const;
+
+	const CorpusParams m_params;
+	std::mt19937_64 m_random;
+};
@@ -0,0 +1,527 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+#include "CorpusGenerator.hpp"
+#include "Blake3Hasher.hpp"
+#include "Hasher.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+	struct TestContext
+	{
+		// command line tool, quoted for the shell
+		std::string tool;
+		// scratch directory of the test, empty when it starts
+		fs::path dir;
+		// checked in test data
+		fs::path data;
+	};
+
+	struct TestCase
+	{
+		const char* name;
+		std::function<bool(const TestContext&)> run;
+	};
+
+	/**
+	* Name: check
+	* Description: Report a failed expectation, returns the condition so tests can stop on it
+	* @Param condition - expectation
+	* @Param what - what was expected
+	*/
+	bool check(bool condition, const std::string& what)
+	{
+		if (!condition)
+		{
+			std::cerr << "FAILED: " << what << "\n";
+		}
+		return condition;
+	}
+
+	std::string quote(const fs::path& path)
+	{
+		return "\"" + path.string() + "\"";
+	}
+
+	/**
+	* Name: run
+	* Description: Run a command line through the shell and return its exit status, -1 when it did not exit
+	* @Param command - command line
+	*/
+	int run(const std::string& command)
+	{
+		std::cout << "$ " << command << std::endl;
+		int status = std::system(command.c_str());
+#if defined(_WIN32)
+		return status;
+#else
+		return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+	}
+
+	// runs the tool with its arguments, errors only so the test log stays readable
+	int tool(const TestContext& ctx, const std::string& arguments)
+	{
+		return run(ctx.tool + " " + arguments + " --log-level error");
+	}
+
+	bool writeFile(const fs::path& path, const std::string& data)
+	{
+		fs::create_directories(path.parent_path());
+		std::ofstream ofstream(path, std::ios::binary | std::ios::trunc);
+		ofstream.write(data.data(), static_cast<std::streamsize>(data.size()));
+		return static_cast<bool>(ofstream);
+	}
+
+	bool readFile(const fs::path& path, std::string& data)
+	{
+		std::ifstream ifstream(path, std::ios::binary);
+		data.assign(std::istreambuf_iterator<char>(ifstream), std::istreambuf_iterator<char>());
+		return ifstream.is_open() && !ifstream.bad();
+	}
+
+	/**
+	* Name: sameTree
+	* Description: Compare the regular files of two trees by relative path and content
+	* @Param expected - source tree
+	* @Param actual - restored tree
+	*/
+	bool sameTree(const fs::path& expected, const fs::path& actual)
+	{
+		std::vector<fs::path> expectedFiles;
+		std::vector<fs::path> actualFiles;
+		for (const auto& entry : fs::recursive_directory_iterator(expected))
+		{
+			if (entry.is_regular_file())
+			{
+				expectedFiles.push_back(fs::relative(entry.path(), expected));
+			}
+		}
+		for (const auto& entry : fs::recursive_directory_iterator(actual))
+		{
+			if (entry.is_regular_file())
+			{
+				actualFiles.push_back(fs::relative(entry.path(), actual));
+			}
+		}
+		std::sort(expectedFiles.begin(), expectedFiles.end());
+		std::sort(actualFiles.begin(), actualFiles.end());
+		if (!check(expectedFiles == actualFiles, "restored tree has the files of " + expected.string()))
+		{
+			return false;
+		}
+
+		std::string expectedData;
+		std::string actualData;
+		for (const fs::path& file : expectedFiles)
+		{
+			if (!check(readFile(expected / file, expectedData) && readFile(actual / file, actualData) && expectedData == actualData,
+				"restored " + file.string() + " has the original content"))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	std::string pattern(std::size_t size)
+	{
+		std::string data(size, '\0');
+		for (std::size_t i = 0; i < size; i++)
+		{
+			data[i] = static_cast<char>(i % 251);
+		}
+		return data;
+	}
+
+	/**
+	* Name: makeTree
+	* Description: Reproducible input tree: a small corpus with duplicates, an empty file and a large file with a copy,
+	*              so every mode has small, large and repeated content to work on
+	* @Param root - tree root
+	*/
+	bool makeTree(const fs::path& root)
+	{
+		CorpusParams params;
+		params.files = 200;
+		params.meanSize = 8 << 10;
+		params.duplicateRatio = 0.2;
+		params.filesPerDirectory = 20;
+		CorpusGenerator generator(params);
+		CorpusInfo info;
+		if (!generator.generate(root / "corpus", info))
+		{
+			return false;
+		}
+
+		std::string large(3 << 20, '\0');
+		generator.fill(large.data(), large.size());
+		return writeFile(root / "empty.txt", std::string()) && writeFile(root / "large.bin", large) && writeFile(root / "copy" / "large.bin", large);
+	}
+
+	/**
+	* Name: roundTrip
+	* Description: Pack the test tree with the given options, then unpack, verify and compare it
+	* @Param ctx - test context
+	* @Param options - pack options
+	*/
+	bool roundTrip(const TestContext& ctx, const std::string& options)
+	{
+		const fs::path source = ctx.dir / "in";
+		const fs::path archive = ctx.dir / "in.tmar";
+		const fs::path restored = ctx.dir / "out";
+		return check(makeTree(source), "test tree is written") &&
+			check(0 == tool(ctx, "pack " + quote(source) + " " + quote(archive) + " --no-cache " + options), "pack succeeds") &&
+			check(0 == tool(ctx, "unpack " + quote(archive) + " " + quote(restored) + " --threads 4"), "unpack succeeds") &&
+			check(0 == tool(ctx, "verify " + quote(archive)), "verify succeeds") &&
+			sameTree(source, restored);
+	}
+
+	/**
+	* Name: testSparse
+	* Description: A file with holes round trips through a file and a stream, restored holes stay holes
+	*/
+	bool testSparse(const TestContext& ctx)
+	{
+		const fs::path source = ctx.dir / "in";
+		const fs::path file = source / "sparse.bin";
+		const std::string data = pattern(4096);
+		{
+			fs::create_directories(source);
+			std::ofstream ofstream(file, std::ios::binary);
+			for (uint64_t offset : { uint64_t(0), uint64_t(3) << 20, (uint64_t(8) << 20) - 4096 })
+			{
+				ofstream.seekp(static_cast<std::streamoff>(offset));
+				ofstream.write(data.data(), static_cast<std::streamsize>(data.size()));
+			}
+			if (!check(static_cast<bool>(ofstream), "sparse file is written"))
+			{
+				return false;
+			}
+		}
+
+		const fs::path archive = ctx.dir / "in.tmar";
+		const fs::path restored = ctx.dir / "out";
+		const fs::path streamed = ctx.dir / "stream";
+		if (!check(0 == tool(ctx, "pack " + quote(source) + " " + quote(archive) + " --no-cache --block-size 1M"), "pack succeeds") ||
+			!check(0 == tool(ctx, "unpack " + quote(archive) + " " + quote(restored)), "unpack succeeds") ||
+			!check(0 == tool(ctx, "unpack - " + quote(streamed) + " < " + quote(archive)), "stream unpack succeeds") ||
+			!sameTree(source, restored) || !sameTree(source, streamed))
+		{
+			return false;
+		}
+
+#if !defined(_WIN32)
+		// holes are only expected back where the file system kept them in the source
+		struct stat sourceStat;
+		struct stat restoredStat;
+		if (0 == stat(file.c_str(), &sourceStat) && 512 * static_cast<uint64_t>(sourceStat.st_blocks) < static_cast<uint64_t>(sourceStat.st_size))
+		{
+			return check(0 == stat((restored / "sparse.bin").c_str(), &restoredStat) &&
+				512 * static_cast<uint64_t>(restoredStat.st_blocks) < static_cast<uint64_t>(restoredStat.st_size), "restored file keeps its holes");
+		}
+#endif
+		return true;
+	}
+
+	/**
+	* Name: testStream
+	* Description: Pack to stdout and unpack from stdin, through a file and through a pipe, for a tree and an empty folder
+	*/
+	bool testStream(const TestContext& ctx)
+	{
+		const fs::path source = ctx.dir / "in";
+		const fs::path archive = ctx.dir / "in.tmar";
+		const fs::path empty = ctx.dir / "empty";
+		fs::create_directories(empty);
+		return check(makeTree(source), "test tree is written") &&
+			check(0 == tool(ctx, "pack " + quote(source) + " - --no-cache > " + quote(archive)), "pack to stdout succeeds") &&
+			check(0 == tool(ctx, "unpack - " + quote(ctx.dir / "out") + " < " + quote(archive)), "unpack from stdin succeeds") &&
+			sameTree(source, ctx.dir / "out") &&
+			check(0 == tool(ctx, "pack " + quote(source) + " - --no-cache --solid | " + ctx.tool + " unpack - " + quote(ctx.dir / "piped")), "piped pack and unpack succeed") &&
+			sameTree(source, ctx.dir / "piped") &&
+			check(0 == tool(ctx, "pack " + quote(empty) + " - --no-cache | " + ctx.tool + " unpack - " + quote(ctx.dir / "empty_out")), "piped empty folder succeeds") &&
+			check(fs::is_directory(ctx.dir / "empty_out"), "unpack of an empty archive creates the output folder");
+	}
+
+	/**
+	* Name: testPackErrors
+	* Description: A missing input folder fails the pack without an archive, an empty one gives an archive without files
+	*/
+	bool testPackErrors(const TestContext& ctx)
+	{
+		const fs::path missing = ctx.dir / "missing";
+		const fs::path empty = ctx.dir / "empty";
+		fs::create_directories(empty);
+		return check(1 == tool(ctx, "pack " + quote(missing) + " " + quote(ctx.dir / "missing.tmar") + " --no-cache"), "pack of a missing folder exits with 1") &&
+			check(!fs::exists(ctx.dir / "missing.tmar"), "failed pack leaves no archive") &&
+			check(0 == tool(ctx, "pack " + quote(empty) + " " + quote(ctx.dir / "empty.tmar") + " --no-cache"), "pack of an empty folder succeeds") &&
+			check(0 == tool(ctx, "list " + quote(ctx.dir / "empty.tmar")), "empty archive lists") &&
+			check(0 == tool(ctx, "unpack " + quote(ctx.dir / "empty.tmar") + " " + quote(ctx.dir / "out")), "empty archive unpacks") &&
+			check(fs::is_directory(ctx.dir / "out"), "unpack creates the output folder");
+	}
+
+	/**
+	* Name: testVerifyCorrupt
+	* Description: A flipped byte inside a blob fails verify and unpack, unpack leaves no partial file
+	*/
+	bool testVerifyCorrupt(const TestContext& ctx)
+	{
+		const fs::path source = ctx.dir / "in";
+		const fs::path archive = ctx.dir / "in.tmar";
+		std::string data(1 << 20, '\0');
+		CorpusParams params;
+		params.compressibility = 0.0;
+		CorpusGenerator(params).fill(data.data(), data.size());
+		if (!check(writeFile(source / "random.bin", data), "input is written") ||
+			!check(0 == tool(ctx, "pack " + quote(source) + " " + quote(archive) + " --no-cache"), "pack succeeds") ||
+			!check(0 == tool(ctx, "verify " + quote(archive)), "verify of the intact archive succeeds"))
+		{
+			return false;
+		}
+
+		// incompressible content is stored as it is, so the middle of the archive is blob data
+		std::string bytes;
+		readFile(archive, bytes);
+		bytes[bytes.size() / 2] ^= 0x5A;
+		writeFile(archive, bytes);
+		return check(1 == tool(ctx, "verify " + quote(archive)), "verify of the damaged archive exits with 1") &&
+			check(1 == tool(ctx, "unpack " + quote(archive) + " " + quote(ctx.dir / "out")), "unpack of the damaged archive exits with 1") &&
+			check(!fs::exists(ctx.dir / "out" / "random.bin"), "failed unpack leaves no partial file");
+	}
+
+	/**
+	* Name: testRejectParentPath
+	* Description: An archive whose path climbs out of the output folder is refused by list, unpack and stream unpack
+	*/
+	bool testRejectParentPath(const TestContext& ctx)
+	{
+		const fs::path source = ctx.dir / "in";
+		const fs::path archive = ctx.dir / "in.tmar";
+		if (!check(writeFile(source / "zq" / "escape.txt", "outside\n"), "input is written") ||
+			!check(0 == tool(ctx, "pack " + quote(source) + " " + quote(archive) + " --no-cache"), "pack succeeds"))
+		{
+			return false;
+		}
+
+		// the only path is stored whole in the record and in the table, both get the same length replacement
+		std::string bytes;
+		readFile(archive, bytes);
+		const std::string from = "zq/escape.txt";
+		const std::string to = "../escape.txt";
+		std::size_t replaced = 0;
+		for (std::size_t at = bytes.find(from); std::string::npos != at; at = bytes.find(from, at + to.size()))
+		{
+			bytes.replace(at, from.size(), to);
+			replaced++;
+		}
+		writeFile(archive, bytes);
+
+		const fs::path out = ctx.dir / "out" / "inner";
+		return check(0 != replaced, "archive holds the path") &&
+			check(1 == tool(ctx, "list " + quote(archive)), "list refuses the path") &&
+			check(1 == tool(ctx, "verify " + quote(archive)), "verify refuses the path") &&
+			check(1 == tool(ctx, "unpack " + quote(archive) + " " + quote(out)), "unpack refuses the path") &&
+			check(1 == tool(ctx, "unpack - " + quote(out) + " < " + quote(archive)), "stream unpack refuses the path") &&
+			check(!fs::exists(ctx.dir / "out" / "escape.txt"), "nothing is written outside of the output folder");
+	}
+
+	/**
+	* Name: testLegacyVersion2
+	* Description: The checked in archive was written by the version 2 format, before the footer index
+	*/
+	bool testLegacyVersion2(const TestContext& ctx)
+	{
+		std::string text;
+		for (int i = 0; i < 40; i++)
+		{
+			text += "Back to the future\n";
+		}
+		const fs::path expected = ctx.dir / "expected";
+		const fs::path archive = ctx.data / "v2.tmar";
+		return check(writeFile(expected / "readme.txt", text) && writeFile(expected / "data" / "copy.txt", text) &&
+				writeFile(expected / "data" / "numbers.bin", pattern(5000)), "expected tree is written") &&
+			check(0 == tool(ctx, "list " + quote(archive)), "list succeeds") &&
+			check(0 == tool(ctx, "verify " + quote(archive)), "verify succeeds") &&
+			check(0 == tool(ctx, "unpack " + quote(archive) + " " + quote(ctx.dir / "out")), "unpack succeeds") &&
+			sameTree(expected, ctx.dir / "out");
+	}
+
+	/**
+	* Name: testCacheCollision
+	* Description: A small file holding the block digests of a split file has the digest of that file. With a warm
+	*              cache the two must still not be taken for copies of each other.
+	*/
+	bool testCacheCollision(const TestContext& ctx)
+	{
+		const fs::path source = ctx.dir / "in";
+		const uint64_t blockSize = 1 << 20;
+		std::string large((9 << 20) / 4, '\0');
+		CorpusParams params;
+		params.compressibility = 0.0;
+		CorpusGenerator(params).fill(large.data(), large.size());
+
+		std::string digests;
+		for (uint64_t offset = 0; offset < large.size(); offset += blockSize)
+		{
+			std::unique_ptr<IHasher> hasher = createHasher(HashId::Sha256);
+			hasher->update(large.data() + offset, std::min<uint64_t>(blockSize, large.size() - offset));
+			Digest digest = hasher->finalDigest();
+			digests.append(reinterpret_cast<const char*>(digest.bytes), digest.size);
+		}
+		if (!check(writeFile(source / "a_small", digests) && writeFile(source / "z_large", large), "input is written"))
+		{
+			return false;
+		}
+
+		// the cache keeps only entries older than its racy window
+		for (const char* name : { "a_small", "z_large" })
+		{
+			fs::last_write_time(source / name, fs::file_time_type::clock::now() - std::chrono::hours(24));
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+
+		const std::string pack = "pack " + quote(source) + " " + quote(ctx.dir / "in.tmar") + " --block-size 1M --cache " + quote(ctx.dir / "scan.cache");
+		return check(0 == tool(ctx, pack), "cold pack succeeds") &&
+			check(0 == tool(ctx, pack), "warm pack succeeds") &&
+			check(0 == tool(ctx, "unpack " + quote(ctx.dir / "in.tmar") + " " + quote(ctx.dir / "out")), "unpack succeeds") &&
+			sameTree(source, ctx.dir / "out");
+	}
+
+	/**
+	* Name: testBlake3Vectors
+	* Description: Built-in BLAKE3 against digests of the official implementation for the inputs of its test vectors,
+	*              fed whole and in odd pieces so every lane width and subtree size is taken
+	*/
+	bool testBlake3Vectors(const TestContext&)
+	{
+		const struct
+		{
+			std::size_t size;
+			const char* digest;
+		} vectors[] = {
+			{ 0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" },
+			{ 1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213" },
+			{ 1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11" },
+			{ 1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7" },
+			{ 1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" },
+			{ 2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a" },
+			{ 2049, "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030" },
+			{ 3072, "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2" },
+			{ 3073, "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3" },
+			{ 4096, "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969" },
+			{ 4097, "9b4052b38f1c5fc8b1f9ff7ac7b27cd242487b3d890d15c96a1c25b8aa0fb995" },
+			{ 5120, "9cadc15fed8b5d854562b26a9536d9707cadeda9b143978f319ab34230535833" },
+			{ 5121, "628bd2cb2004694adaab7bbd778a25df25c47b9d4155a55f8fbd79f2fe154cff" },
+			{ 6144, "3e2e5b74e048f3add6d21faab3f83aa44d3b2278afb83b80b3c35164ebeca205" },
+			{ 6145, "f1323a8631446cc50536a9f705ee5cb619424d46887f3c376c695b70e0f0507f" },
+			{ 7168, "61da957ec2499a95d6b8023e2b0e604ec7f6b50e80a9678b89d2628e99ada77a" },
+			{ 7169, "a003fc7a51754a9b3c7fae0367ab3d782dccf28855a03d435f8cfe74605e7817" },
+			{ 8192, "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63" },
+			{ 8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b" },
+			{ 16384, "f875d6646de28985646f34ee13be9a576fd515f76b5b0a26bb324735041ddde4" },
+			{ 31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47" },
+			{ 102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085" },
+			{ 1048577, "2f053cd7472cf0cd2f9adaf45c1180255b91b9a865404a63671a0ee5f792ed33" },
+		};
+
+		const std::string input = pattern(1048577);
+		bool ok = true;
+		for (const auto& vector : vectors)
+		{
+			for (std::size_t piece : { vector.size + 1, std::size_t(1000), std::size_t(65537) })
+			{
+				Blake3Hasher hasher;
+				for (std::size_t offset = 0; offset < vector.size; offset += piece)
+				{
+					hasher.update(input.data() + offset, std::min(piece, vector.size - offset));
+				}
+				ok = check(toHex(hasher.finalDigest()) == vector.digest,
+					"BLAKE3 of " + std::to_string(vector.size) + " bytes in pieces of " + std::to_string(piece)) && ok;
+			}
+		}
+		return ok;
+	}
+
+	const TestCase TESTS[] = {
+		{ "codec_store", [](const TestContext& ctx) { return roundTrip(ctx, "--codec store"); } },
+		{ "codec_zlib", [](const TestContext& ctx) { return roundTrip(ctx, "--codec zlib:9"); } },
+		{ "codec_zstd", [](const TestContext& ctx) { return roundTrip(ctx, "--codec zstd --long"); } },
+		{ "codec_lz4", [](const TestContext& ctx) { return roundTrip(ctx, "--codec lz4"); } },
+		{ "hash_sha256", [](const TestContext& ctx) { return roundTrip(ctx, "--hash sha256"); } },
+		{ "hash_blake3", [](const TestContext& ctx) { return roundTrip(ctx, "--hash blake3"); } },
+		{ "hash_xxh3", [](const TestContext& ctx) { return roundTrip(ctx, "--hash xxh3"); } },
+		{ "split", [](const TestContext& ctx) { return roundTrip(ctx, "--block-size 256K --threads 4"); } },
+		{ "cdc", [](const TestContext& ctx) { return roundTrip(ctx, "--cdc"); } },
+		{ "solid_dict", [](const TestContext& ctx) { return roundTrip(ctx, "--solid --dict"); } },
+		{ "sparse", testSparse },
+		{ "stream", testStream },
+		{ "pack_errors", testPackErrors },
+		{ "verify_corrupt", testVerifyCorrupt },
+		{ "reject_parent_path", testRejectParentPath },
+		{ "legacy_v2", testLegacyVersion2 },
+		{ "cache_collision", testCacheCollision },
+		{ "blake3_vectors", testBlake3Vectors },
+	};
+} // anonymous namespace
+
+/**
+* Name: main
+* Description: Run one test case: bttf_tests <test> <tool> <scratch_dir> <data_dir>
+*/
+int main(int argc, char** argv)
+{
+	if (5 != argc)
+	{
+		std::cerr << "Usage: bttf_tests <test> <tool> <scratch_dir> <data_dir>\n";
+		return 1;
+	}
+
+	for (const TestCase& test : TESTS)
+	{
+		if (0 != std::strcmp(test.name, argv[1]))
+		{
+			continue;
+		}
+
+		TestContext ctx{ quote(argv[2]), argv[3], argv[4] };
+		std::error_code error;
+		fs::remove_all(ctx.dir, error);
+		fs::create_directories(ctx.dir, error);
+		if (error)
+		{
+			std::cerr << "Cannot create " << ctx.dir.string() << "\n";
+			return 1;
+		}
+
+		bool passed = test.run(ctx);
+		std::cout << (passed ? "PASSED " : "FAILED ") << test.name << "\n";
+		if (passed)
+		{
+			fs::remove_all(ctx.dir, error);
+		}
+		return passed ? 0 : 1;
+	}
+
+	std::cerr << "Unknown test " << argv[1] << "\n";
+	return 1;
+}